@@ -181,12 +181,14 @@ void Session::process_message(Message &&) {
                                     Message r;
                                     r.type = FrameType::READ_RESP;
                                     if (vr) {
-                                        r.payload.reserve(
-                                            1 + 4 + vr->value.size() + 14);
+                                        std::string_view value = vr->value();
+                                        auto clock = vr->clock();
+                                        r.payload.reserve(1 + 4 +
+                                                          value.size() + 14);
                                         r.payload.push_back(0);
                                         uint32_t vlen_be =
                                             endian::native_to_big<uint32_t>(
-                                                vr->value.size());
+                                                value.size());
                                         r.payload.insert(
                                             r.payload.end(),
                                             reinterpret_cast<uint8_t *>(
@@ -195,9 +197,12 @@ void Session::process_message(Message &&) {
                                                 &vlen_be) +
                                                 4);
                                         r.payload.insert(r.payload.end(),
-                                                         vr->value.begin(),
-                                                         vr->value.end());
-                                        encode_hlc(vr->clock, r.payload);
+                                                         value.begin(),
+                                                         value.end());
+                                        encode_hlc(HLC{clock.physical_us,
+                                                       clock.logical,
+                                                       clock.node_id},
+                                                   r.payload);
                                     } else
                                         r.payload = {1};
                                     self->send(std::move(r));
@@ -404,13 +409,8 @@ void ConnectionManager::kv_put(const std::string &k, const std::string &v,
     db_.insert(k, v, mousedb::hlc::HLC{ts.physical_us, ts.logical, ts.node_id});
 }
 
-std::optional<ValueRec> ConnectionManager::kv_get(const std::string &k) {
-    std::optional<std::string_view> res = db_.find(k);
-    if (res) {
-        std::string res_str(res.value());
-        return ValueRec{res_str};
-
-    } else {
-        return std::nullopt;
-    }
+std::optional<mousedb::database::PinnableValue> ConnectionManager::kv_get(
+    const std::string &k) {
+    // pinned, so the value is copied straight into the response
+    return db_.find_pinned(k);
 }
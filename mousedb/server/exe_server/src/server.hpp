@@ -127,7 +127,8 @@ class ConnectionManager {
 
     /* kv helpers */
     void kv_put(const std::string &k, const std::string &v, const HLC &ts);
-    std::optional<ValueRec> kv_get(const std::string &k);
+    std::optional<mousedb::database::PinnableValue> kv_get(
+        const std::string &k);
 
     /* session callbacks */
     void on_identify(Session *s, Address const &addr);
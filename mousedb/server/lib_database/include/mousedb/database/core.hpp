@@ -1,43 +1,207 @@
 #pragma once
 
-#include <stdio.h>
-
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
 #include <deque>
 #include <filesystem>
+#include <functional>
+#include <memory>
 #include <mutex>
 #include <optional>
+#include <set>
 #include <shared_mutex>
+#include <span>
 #include <string>
 #include <thread>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
+#include "cache.hpp"
 #include "filter.hpp"
 #include "hlce.hpp"
+#include "iterator.hpp"
+#include "manifest.hpp"
 #include "memtable.hpp"
-#include "spin_mutex.hpp"
+#include "sstable.hpp"
+#include "table_cache.hpp"
+#include "wal.hpp"
+#include "write_batch.hpp"
 
 namespace mousedb {
 namespace database {
 
+enum class CompactionStyle {
+    // Keeps each level below level 0 one sorted run within a size target
+    // that grows by level, for the least read and space amplification.
+    leveled,
+    // Merges whole sorted runs of similar sizes, for the least write
+    // amplification at the cost of more runs to read.
+    universal,
+};
+
 struct Options {
     bool fresh = false;
     size_t max_height = 12;
     size_t branching_factor = 4;
     size_t flush_threshold = 4096;
+    // In bytes, the size at which SSTable data blocks are cut.
+    size_t block_size = 4096;
+    // In bytes, the capacity of the cache of SSTable data blocks, where 0
+    // disables it.
+    size_t block_cache_capacity = 8 << 20;
+    // In bytes, the size at which compactions start a new output SSTable.
+    size_t target_file_size = 2 << 20;
+    // The number of key ranges a compaction may be split into to run in
+    // parallel, each worth at least target_file_size.
+    size_t max_subcompactions = 4;
+    CompactionStyle compaction_style = CompactionStyle::leveled;
+    // The number of levels in leveled compaction, where the last one is never
+    // compacted further.
+    size_t num_levels = 7;
+    // The number of level 0 tables at which level 0 is compacted. In universal
+    // compaction, it is the number of sorted runs at which runs are merged,
+    // which also caps how many there are.
+    size_t level0_compaction_trigger = 4;
+    // In bytes, the target size of level 1. Each deeper level's target is
+    // level_size_multiplier times the one before it.
+    size_t max_bytes_for_level_base = 10 << 20;
+    size_t level_size_multiplier = 10;
+    // In universal compaction, the percentage by which a run may be bigger
+    // than the runs newer than it and still be merged with them.
+    size_t universal_size_ratio = 1;
+    // In universal compaction, the percentage of the oldest run's size that
+    // the newer runs may add up to before every run is merged.
+    size_t universal_max_size_amplification_percent = 200;
+    // How long a tombstone is kept after its HLC before compaction into the
+    // bottommost level may drop it. Until then, it still hides versions that
+    // replicas write late with older HLCs.
+    std::chrono::microseconds tombstone_grace_period = std::chrono::hours(1);
+    // When WAL writes are synced, and so how much a machine crash may lose.
+    wal::SyncMode sync_mode = wal::SyncMode::none;
+    // How often WAL writes are synced if sync_mode is interval.
+    std::chrono::microseconds sync_interval = std::chrono::milliseconds(100);
+    // In bytes, the size that WAL segments are preallocated to. A record that
+    // does not fit in the rest of a segment starts a new one.
+    size_t wal_segment_size = 4 << 20;
+    // The number of flushed WAL segments kept to be written over, beyond
+    // which they are deleted.
+    size_t max_free_wal_segments = 4;
+    // Whether WAL writes and syncs are submitted through io_uring where it is
+    // available.
+    bool wal_use_io_uring = true;
+    // In bytes, the size at which the manifest is rewritten as one snapshot
+    // of the tables.
+    size_t max_manifest_file_size = 1 << 20;
+    // The number of SSTables kept open at once.
+    size_t max_open_tables = 1024;
+    // The filter policy of the SSTables in each level from newest to oldest,
+    // where the last one also covers any deeper levels.
+    std::vector<std::shared_ptr<const filter::FilterPolicy>> filter_policies = {
+        std::make_shared<filter::BloomFilterPolicy>(
+            sstable::SSTABLE_BITS_PER_KEY)};
+};
+
+// An SSTable in a level, with the range of its keys.
+struct TableMeta {
+    uint64_t id;
+    std::string smallest;
+    std::string largest;
+    size_t file_size;
+};
+
+struct CompactionStats {
+    // Compactions that merged their inputs, rather than moving a table down.
+    uint64_t compactions = 0;
+    // The key ranges that those compactions were split into.
+    uint64_t subcompactions = 0;
+    // The most ranges that one compaction was split into.
+    size_t max_subcompactions = 0;
+};
+
+// A value read from a database, which pins the memtable, or the table and
+// cached blocks, that it points into. It stays valid for as long as it lives,
+// across flushes, compactions and evictions, so it can be used without being
+// copied. PinnableValues are move-only.
+// Example:
+//    if (auto value = db.find_pinned("key")) {
+//        send(value->value());
+//    }
+class PinnableValue {
+   public:
+    PinnableValue(const PinnableValue &) = delete;
+    PinnableValue &operator=(const PinnableValue &) = delete;
+    PinnableValue(PinnableValue &&other) noexcept = default;
+    PinnableValue &operator=(PinnableValue &&other) noexcept = default;
+
+    auto value() const -> std::string_view;
+    // The HLC the value was written at.
+    auto clock() const -> mousedb::hlc::HLC;
+
+   private:
+    friend class Database;
+
+    std::string_view value_;
+    mousedb::hlc::HLC clock_;
+    std::shared_ptr<const void> owner_;
+    std::vector<cache::BlockCache::Handle> blocks_;
+
+    PinnableValue(std::string_view value, mousedb::hlc::HLC clock,
+                  std::shared_ptr<const void> owner,
+                  std::vector<cache::BlockCache::Handle> blocks);
 };
 
 class Database {
    public:
+    class Iterator;
+    class Snapshot;
+
     Database(const std::filesystem::path &root_path, const Options &options);
     ~Database();
 
+    // The value stays valid until the next find or find_at on the thread.
     auto find(std::string_view key) -> std::optional<std::string_view>;
+    // Returns the value of key along with what backs it.
+    auto find_pinned(std::string_view key) -> std::optional<PinnableValue>;
+    // Returns the newest value of key at or before ts. Compaction only keeps
+    // the older versions of a key that a live snapshot can see.
+    auto find_at(std::string_view key, mousedb::hlc::HLC ts)
+        -> std::optional<std::string_view>;
+    // Returns the value of each key, in the order of keys. The keys are
+    // sorted once, so each memtable is searched under one lock and each table
+    // reads the data blocks it needs once for the whole batch. The values
+    // stay valid until the next multi_get on the thread.
+    auto multi_get(std::span<const std::string_view> keys)
+        -> std::vector<std::optional<std::string_view>>;
     auto insert(std::string_view key, std::string_view value,
                 mousedb::hlc::HLC ts) -> void;
     auto erase(std::string_view key, mousedb::hlc::HLC ts) -> void;
+    // Applies every entry of batch in order. The batch is logged as one WAL
+    // record, so a crash keeps all of it or none of it, but concurrent reads
+    // may see part of it until write returns.
+    auto write(const write_batch::WriteBatch &batch) -> void;
+    // Returns a snapshot as of now by the system clock, or as of ts.
+    auto get_snapshot() -> Snapshot;
+    auto get_snapshot(mousedb::hlc::HLC ts) -> Snapshot;
+    // Returns an unpositioned iterator over the memtables and tables as of
+    // now. Each memtable and level 0 table is merged on its own, while each
+    // deeper level is merged as one, opening its tables as it reaches them.
+    auto new_iterator() -> Iterator;
+    // Returns the pairs whose keys are in [begin, end) in key order.
+    auto scan(std::string_view begin, std::string_view end)
+        -> std::vector<std::pair<std::string, std::string>>;
+
+    // Returns nullptr if the block cache is disabled.
+    auto block_cache() const -> const cache::BlockCache *;
+    // Sums the group commit stats of the WALs since the database opened.
+    auto wal_stats() const -> wal::Stats;
+    auto compaction_stats() const -> CompactionStats;
+    // Returns the tables in a level, in the order that they are kept.
+    auto tables(size_t level) -> std::vector<TableMeta>;
+    // Waits until every memtable switched out so far is flushed, and until
+    // the compactions after those flushes are done.
+    auto wait_for_background_work() -> void;
 
    private:
     class Queue {
@@ -46,73 +210,341 @@ class Database {
               Database &db);
         ~Queue();
 
-        auto find(std::string_view key, std::vector<std::string_view> &values)
-            -> void;
+        // Waits until every memtable enqueued so far is flushed, along with
+        // the compactions that its flush set off.
+        auto wait() -> void;
+        // Runs task on a worker before any waiting memtable is flushed.
+        auto submit(std::function<void()> task) -> void;
+        // Returns the memtables that are waiting for or being flushed.
+        auto memtables() -> std::vector<
+            std::shared_ptr<memtable::MemTable<memtable::KVSkipList>>>;
 
         auto enqueue_memtable(
             std::shared_ptr<memtable::MemTable<memtable::KVSkipList>> memtable)
             -> void;
 
-        auto set_unused_sst_id(size_t id) -> void;
-
        private:
         auto process_memtable(
-            std::deque<std::shared_ptr<
-                memtable::MemTable<memtable::KVSkipList>>>::iterator it)
+            std::shared_ptr<memtable::MemTable<memtable::KVSkipList>> memtable)
             -> void;
 
         const std::filesystem::path data_path_;
         const size_t num_workers_;
         Database &db_;
 
-        std::atomic<size_t> unused_sst_id_;
-
         std::vector<std::thread> workers_;
 
         std::deque<std::shared_ptr<memtable::MemTable<memtable::KVSkipList>>>
             queue_;
         std::deque<std::shared_ptr<memtable::MemTable<memtable::KVSkipList>>>
             working_;
+        std::deque<std::function<void()>> tasks_;
+        // The memtables taken by workers that are still flushing them or
+        // compacting after them.
+        size_t active_ = 0;
         std::mutex queue_mutex_;
         std::condition_variable queue_cv_;
+        std::condition_variable idle_cv_;
 
         std::atomic<bool> stop_flag_ = false;
     };
 
     struct alignas(64) Shard {
-        FILE *file;
-        spin_mutex::SpinMutex mutex;
+        std::unique_ptr<wal::Writer> wal;
     };
 
+    // The file of a table in the levels. Once compaction drops the table, the
+    // file is removed when the last super version holding it is freed, so
+    // that reads through older super versions can still open it.
+    struct TableFile {
+        uint64_t id;
+        table_cache::TableCache &table_cache;
+        std::atomic<bool> obsolete = false;
+
+        ~TableFile();
+    };
+
+    // The memtables and tables that reads go through, from the active
+    // memtable to the immutable ones to the levels. One is never changed once
+    // published, and a new one is published whenever any of them change.
+    struct SuperVersion {
+        uint64_t number;
+        std::vector<std::shared_ptr<memtable::MemTable<memtable::KVSkipList>>>
+            memtables;
+        std::vector<std::vector<TableMeta>> levels;
+        // The files of the tables in levels, by id.
+        std::unordered_map<uint64_t, std::shared_ptr<TableFile>> files;
+    };
+
+    // A thread's state for one database. It holds the thread's reference to
+    // the super version, so that reads share in one without touching its
+    // reference count, and what backs the values last returned on the
+    // thread. The database keeps the state of every thread, so that
+    // publishing a super version drops the references to the older ones and
+    // closing the database drops the rest, rather than threads that stopped
+    // reading keeping memtables and tables alive.
+    struct LocalState {
+        uint64_t db_id;
+        // Null once dropped, and &in_use_ while a read on the thread has it.
+        std::atomic<std::shared_ptr<const SuperVersion> *> super_version =
+            nullptr;
+        // Set once the database is closed, so that the thread forgets it.
+        std::atomic<bool> closed = false;
+        // Keeps the value last returned by find on the thread alive.
+        std::optional<PinnableValue> pinned_value;
+        // Keeps the memtables, tables and cached blocks backing the values
+        // last returned by multi_get on the thread alive.
+        std::vector<std::shared_ptr<const void>> pinned;
+        std::vector<cache::BlockCache::Handle> pinned_blocks;
+
+        ~LocalState();
+    };
+
+    // A read's hold on its thread's reference to the super version, which is
+    // handed back to the thread once the read is done, unless a newer super
+    // version was published in the meantime.
+    class SuperVersionHandle {
+       public:
+        SuperVersionHandle(LocalState &local,
+                           std::shared_ptr<const SuperVersion> *ref);
+        SuperVersionHandle(const SuperVersionHandle &) = delete;
+        SuperVersionHandle &operator=(const SuperVersionHandle &) = delete;
+        ~SuperVersionHandle();
+
+        auto operator->() const -> const SuperVersion *;
+
+       private:
+        LocalState &local_;
+        std::shared_ptr<const SuperVersion> *ref_;
+    };
+
+    static std::atomic<uint64_t> next_id_;
     const Options &options_;
+    // Tells databases apart in thread local state, even at the same address.
+    const uint64_t id_;
     const size_t num_cpus_;
     const std::filesystem::path root_path_;
     const std::filesystem::path data_path_;
 
     static thread_local size_t cpu_id_;
+    // The states of the thread for every database it has read from.
+    static thread_local std::vector<std::shared_ptr<LocalState>> local_states_;
+    // Its address marks a thread's reference that a read is using.
+    static std::shared_ptr<const SuperVersion> in_use_;
+    // Declared before the shards so that it outlives their writers.
+    std::optional<wal::SegmentPool> wal_segments_;
     std::vector<Shard> shards_;
 
     std::atomic<size_t> operation_id_ = 0;
-    size_t unused_sst_id_ = 0;
+    // The clocks of the live snapshots, whose visible versions compaction
+    // keeps.
+    std::multiset<hlc::HLC> snapshots_;
+    std::mutex snapshots_mutex_;
+    std::atomic<size_t> unused_sst_id_ = 0;
     std::shared_ptr<memtable::MemTable<memtable::KVSkipList>> memtable_;
+    // Held shared across logging a write and inserting it into memtable_, so
+    // that switching memtables under it also switches WAL segments.
     std::shared_mutex memtable_mutex_;
-    std::deque<std::deque<size_t>> sstables_;
-    std::mutex sstables_mutex_;
+    // The WAL segments holding the records of each immutable memtable, which
+    // are released once it is flushed.
+    std::unordered_map<const memtable::MemTable<memtable::KVSkipList> *,
+                       std::vector<uint64_t>>
+        memtable_segments_;
+    std::mutex memtable_segments_mutex_;
+    // A merge of tables into output_level. In leveled compaction, the inputs
+    // are tables from the level above and then the tables they overlap in
+    // output_level. In universal compaction, they are the newest sorted runs.
+    struct Compaction {
+        std::vector<TableMeta> inputs;
+        size_t output_level;
+        // Whether the outputs go into a new level inserted at output_level.
+        bool new_level = false;
+    };
+
+    // Levels from newest to oldest. Level 0 has tables from oldest to newest,
+    // which may overlap, and deeper levels have tables sorted by key, which
+    // do not. In universal compaction, each level below level 0 is a sorted
+    // run, and levels come and go as runs are merged.
+    std::vector<std::vector<TableMeta>> sstables_;
+    // For each level, the largest key of the table it last compacted, so that
+    // compactions rotate through the level.
+    std::vector<std::string> compact_pointers_;
+    std::shared_ptr<cache::BlockCache> block_cache_;
+    table_cache::TableCache table_cache_;
+    // The files of the tables in sstables_, by id.
+    std::unordered_map<uint64_t, std::shared_ptr<TableFile>> table_files_;
+    std::shared_mutex sstables_mutex_;
+    // Logs every change to sstables_, which is only made through install.
+    std::optional<manifest::Manifest> manifest_;
+    std::mutex manifest_mutex_;
+    std::mutex compaction_mutex_;
+    std::atomic<uint64_t> compactions_ = 0;
+    std::atomic<uint64_t> subcompactions_ = 0;
+    std::atomic<size_t> max_subcompactions_ = 0;
+    std::shared_ptr<const SuperVersion> super_version_;
+    // The number of super_version_, which readers check their own against
+    // without locking.
+    std::atomic<uint64_t> super_version_number_ = 0;
+    std::mutex super_version_mutex_;
+    // The states of every thread that has read from the database.
+    std::vector<std::shared_ptr<LocalState>> thread_states_;
+    std::mutex thread_states_mutex_;
+    // Declared last so that its workers finish flushing before the tables
+    // they write to are destroyed.
     Queue queue_;
-    std::unordered_map<size_t, std::shared_ptr<filter::BloomFilter>> filters_;
-    std::shared_mutex filters_mutex_;
 
-    auto internal_find(std::string_view key) -> std::optional<std::string_view>;
+    // Replays the WALs of the last run and flushes everything they held.
+    auto recover_wals() -> void;
+    // Finds the newest value of key at or before at, or the latest one if at
+    // is not given.
+    auto internal_find(std::string_view key, std::optional<hlc::HLC> at)
+        -> std::optional<PinnableValue>;
+    // Returns the thread's state for the database, which is made on its
+    // first read.
+    auto local_state() -> LocalState &;
+    // Returns the current super version through the thread's reference to
+    // it, which only locks to refresh once a new one is published.
+    auto get_super_version() -> SuperVersionHandle;
+    // Drops the reference of every thread to the super version. With close,
+    // also drops what backs the values returned on every thread.
+    auto drop_thread_states(bool close) -> void;
+    // Publishes the memtables and tables as they are now, with memtable as
+    // the active one if it is given, and otherwise the last active one.
+    auto publish_super_version(
+        std::shared_ptr<memtable::MemTable<memtable::KVSkipList>> memtable =
+            nullptr) -> void;
+    // Inserts into the active memtable. The memtable mutex must be held.
     auto internal_insert(std::string_view key, std::string_view value) -> void;
     auto internal_erase(std::string_view key) -> void;
     auto wal_insert(std::string_view key, std::string_view value) -> void;
     auto wal_erase(std::string_view key) -> void;
+    // Queues the active memtable to be flushed once it is full, along with
+    // the WAL segments holding its records.
+    auto maybe_switch_memtable() -> void;
+    // Recycles the WAL segments of a memtable once it is flushed.
+    auto release_segments(
+        const memtable::MemTable<memtable::KVSkipList> *memtable) -> void;
 
-    auto compact(std::deque<size_t> &lvl) -> void;
+    // Runs compactions until every level is within its target.
+    auto maybe_compact() -> void;
+    // Returns the next compaction to run, if any. The sstables mutex must be
+    // held.
+    auto pick_compaction() const -> std::optional<Compaction>;
+    // Picks the level furthest over its target, if any is over.
+    auto pick_leveled_compaction() const -> std::optional<Compaction>;
+    // Picks the newest sorted runs to merge once there are too many runs.
+    auto pick_universal_compaction() const -> std::optional<Compaction>;
+    auto compact(const Compaction &compaction) -> void;
+    // Merges the keys of inputs in (lower, upper] into new tables for
+    // output_level, where a missing bound is unbounded. Only the latest
+    // version of each key and the newest one at or before each of snapshots
+    // are kept, and tombstones older than tombstone_horizon are dropped if it
+    // is given and no snapshot needs the versions they hide.
+    auto compact_range(
+        const std::vector<std::shared_ptr<sstable::SSTable>> &inputs,
+        size_t output_level, std::optional<std::string_view> lower,
+        std::optional<std::string_view> upper, size_t expected_count,
+        std::optional<uint64_t> tombstone_horizon,
+        std::span<const hlc::HLC> snapshots) -> std::vector<TableMeta>;
+    // Whether no table outside of the compaction may hold an older version
+    // of a key it merges. The sstables mutex must be held.
+    auto is_bottommost(const Compaction &compaction) const -> bool;
+    // Durably logs the change from sstables_ to levels in the manifest, and
+    // then makes levels current. The files of the tables it drops are
+    // removed once no super version holds them. The manifest mutex must be
+    // held.
+    auto install(std::vector<std::vector<TableMeta>> levels) -> void;
+    // How far over its target a level is, where 1 is at its target.
+    auto compaction_score(size_t level) const -> double;
+    auto level_target(size_t level) const -> size_t;
+    auto filter_policy(size_t level) const
+        -> std::shared_ptr<const filter::FilterPolicy>;
 
     inline auto get_shard(size_t cpu_id) const -> Shard *;
     inline auto reset_shard() -> Shard *;
 };
 
+// A consistent view of a database as of an HLC, for reading many keys as of
+// one point in time without blocking writers. Compaction keeps the versions
+// it sees until it is destroyed, though a write that arrives later with an
+// HLC at or before its clock is seen too. It must not outlive the database.
+// Example:
+//    auto snapshot = db.get_snapshot();
+//    auto a = snapshot.find("a");
+//    auto b = snapshot.find("b");
+class Database::Snapshot {
+   public:
+    ~Snapshot();
+    Snapshot(Snapshot &&other) noexcept;
+    Snapshot(const Snapshot &) = delete;
+    Snapshot &operator=(const Snapshot &) = delete;
+    Snapshot &operator=(Snapshot &&) = delete;
+
+    auto clock() const -> hlc::HLC;
+    auto find(std::string_view key) const -> std::optional<std::string_view>;
+
+   private:
+    friend class Database;
+
+    Database *db_;
+    std::multiset<hlc::HLC>::iterator it_;
+
+    Snapshot(Database &db, std::multiset<hlc::HLC>::iterator it);
+};
+
+// Iterates over the keys of a database in key order. It merges every memtable
+// and table, resolving each key to its latest value by HLC and skipping keys
+// whose latest value is a tombstone. The memtables and tables it merges are
+// kept alive, so later flushes and compactions are not seen, though inserts
+// into the active memtable may be.
+// Example:
+//    auto it = db.new_iterator();
+//    for (it.seek("a"); it.valid() && it.key() < "b"; it.next()) {
+//        std::println("{} = {}", it.key(), it.value());
+//    }
+class Database::Iterator {
+   public:
+    auto valid() const -> bool;
+    auto seek_to_first() -> void;
+    auto seek_to_last() -> void;
+    // Moves to the first key that is not less than key.
+    auto seek(std::string_view key) -> void;
+    auto next() -> void;
+    auto prev() -> void;
+
+    // The key stays valid until the iterator moves, and the value for as long
+    // as the iterator does.
+    auto key() const -> std::string_view;
+    auto value() const -> std::string_view;
+
+   private:
+    friend class Database;
+
+    // Moving forward, every child is past the current key, and moving in
+    // reverse, every child is before it.
+    enum class Direction { forward, reverse };
+
+    std::vector<std::unique_ptr<iterator::Iterator>> children_;
+    Direction direction_ = Direction::forward;
+    // Indexes of the valid children, as a heap with the nearest key in the
+    // direction first.
+    std::vector<size_t> heap_;
+    bool valid_ = false;
+    std::string key_;
+    std::string_view value_;
+    std::vector<std::string_view> values_;
+
+    explicit Iterator(
+        std::vector<std::unique_ptr<iterator::Iterator>> children);
+
+    // Rebuilds the heap once the children are repositioned.
+    auto build_heap() -> void;
+    // Orders children by their current keys, as std::push_heap expects.
+    auto after(size_t a, size_t b) const -> bool;
+    // Moves to the nearest key in the direction with a live value, taking
+    // every version of each key from the children on the way.
+    auto find() -> void;
+};
+
 }  // namespace database
 }  // namespace mousedb
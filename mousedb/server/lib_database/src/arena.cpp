@@ -4,6 +4,7 @@
 #include <unistd.h>
 
 #include <algorithm>
+#include <cstdint>
 #include <mutex>
 #include <thread>
 
@@ -132,6 +133,13 @@ auto ConcurrentArena::allocate(size_t size) -> ptr_type {
     return rv;
 }
 
+auto ConcurrentArena::allocate_aligned(size_t size, size_t alignment)
+    -> ptr_type {
+    ptr_type ptr = allocate(size + alignment - 1);
+    size_t misalignment = reinterpret_cast<uintptr_t>(ptr) & (alignment - 1);
+    return misalignment == 0 ? ptr : ptr + (alignment - misalignment);
+}
+
 inline auto ConcurrentArena::update() -> void {
     used_.store(arena_.used(), std::memory_order_relaxed);
     unused_.store(arena_.unused(), std::memory_order_relaxed);
@@ -58,6 +58,9 @@ class ConcurrentArena {
     auto size() const -> size_t;
 
     auto allocate(size_t size) -> ptr_type;
+    // Returns memory whose address is a multiple of alignment, which must be
+    // a power of two.
+    auto allocate_aligned(size_t size, size_t alignment) -> ptr_type;
 
    private:
     struct alignas(64) Shard {
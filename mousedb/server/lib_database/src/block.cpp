@@ -0,0 +1,193 @@
+#include "block.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "coding.hpp"
+
+namespace mousedb {
+namespace block {
+
+BlockBuilder::BlockBuilder(size_t restart_interval)
+    : restart_interval_(std::max(restart_interval, static_cast<size_t>(1))) {
+    restarts_.push_back(0);
+}
+
+auto BlockBuilder::add(std::string_view key, std::string_view value) -> void {
+    size_t shared = 0;
+    if (counter_ < restart_interval_) {
+        size_t limit = std::min(last_key_.size(), key.size());
+        while (shared < limit && last_key_[shared] == key[shared]) {
+            ++shared;
+        }
+    } else {
+        restarts_.push_back(static_cast<uint32_t>(buffer_.size()));
+        counter_ = 0;
+    }
+    size_t unshared = key.size() - shared;
+
+    coding::put_varint(buffer_, shared);
+    coding::put_varint(buffer_, unshared);
+    coding::put_varint(buffer_, value.size());
+    auto *key_data = reinterpret_cast<const std::byte *>(key.data());
+    buffer_.insert(buffer_.end(), key_data + shared, key_data + key.size());
+    auto *value_data = reinterpret_cast<const std::byte *>(value.data());
+    buffer_.insert(buffer_.end(), value_data, value_data + value.size());
+
+    last_key_.resize(shared);
+    last_key_.append(key.substr(shared));
+    ++counter_;
+}
+
+auto BlockBuilder::finish() -> std::span<const std::byte> {
+    for (uint32_t restart : restarts_) {
+        coding::put_fixed(buffer_, restart);
+    }
+    coding::put_fixed(buffer_, static_cast<uint32_t>(restarts_.size()));
+    return buffer_;
+}
+
+auto BlockBuilder::reset() -> void {
+    buffer_.clear();
+    restarts_.clear();
+    restarts_.push_back(0);
+    counter_ = 0;
+    last_key_.clear();
+}
+
+auto BlockBuilder::size() const -> size_t {
+    return buffer_.size() + (restarts_.size() + 1) * sizeof(uint32_t);
+}
+
+auto BlockBuilder::empty() const -> bool {
+    return buffer_.empty();
+}
+
+auto BlockBuilder::last_key() const -> std::string_view {
+    return last_key_;
+}
+
+Block::Block(std::span<const std::byte> data) : data_(data) {
+    if (data_.size() < sizeof(uint32_t)) {
+        throw std::runtime_error("Block is too small");
+    }
+    num_restarts_ = coding::decode_fixed<uint32_t>(data_.data() + data_.size() -
+                                                   sizeof(uint32_t));
+    size_t restarts_size = (num_restarts_ + 1) * sizeof(uint32_t);
+    if (num_restarts_ == 0 || restarts_size > data_.size()) {
+        throw std::runtime_error("Block has a corrupt restart array");
+    }
+    restarts_offset_ = data_.size() - restarts_size;
+}
+
+auto Block::begin() const -> Iterator {
+    Iterator it(*this);
+    it.seek_to_first();
+    return it;
+}
+
+auto Block::restart(size_t index) const -> size_t {
+    return coding::decode_fixed<uint32_t>(data_.data() + restarts_offset_ +
+                                          index * sizeof(uint32_t));
+}
+
+Block::Iterator::Iterator(const Block &block)
+    : block_(block),
+      offset_(block.restarts_offset_),
+      next_offset_(block.restarts_offset_) {
+}
+
+auto Block::Iterator::valid() const -> bool {
+    return offset_ < block_.restarts_offset_;
+}
+
+auto Block::Iterator::seek_to_first() -> void {
+    seek_to_restart(0);
+}
+
+auto Block::Iterator::seek_to_last() -> void {
+    seek_to_restart(block_.num_restarts_ - 1);
+    while (valid() && next_offset_ < block_.restarts_offset_) {
+        next();
+    }
+}
+
+auto Block::Iterator::seek(std::string_view key) -> void {
+    // Binary searches for the last restart whose key is less than key, and
+    // then scans forward from it.
+    size_t lo = 0;
+    size_t hi = block_.num_restarts_ - 1;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo + 1) / 2;
+        seek_to_restart(mid);
+        if (this->key() < key) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    seek_to_restart(lo);
+    while (valid() && this->key() < key) {
+        next();
+    }
+}
+
+auto Block::Iterator::next() -> void {
+    offset_ = next_offset_;
+    if (valid()) {
+        decode(offset_);
+    }
+}
+
+auto Block::Iterator::prev() -> void {
+    size_t current = offset_;
+    size_t index = block_.num_restarts_;
+    while (index > 0 && block_.restart(index - 1) >= current) {
+        --index;
+    }
+    if (index == 0) {
+        // moves before the first entry
+        offset_ = block_.restarts_offset_;
+        next_offset_ = block_.restarts_offset_;
+        return;
+    }
+    seek_to_restart(index - 1);
+    while (next_offset_ < current) {
+        next();
+    }
+}
+
+auto Block::Iterator::key() const -> std::string_view {
+    return key_;
+}
+
+auto Block::Iterator::value() const -> std::string_view {
+    return value_;
+}
+
+auto Block::Iterator::decode(size_t offset) -> void {
+    auto data = block_.data_.subspan(0, block_.restarts_offset_);
+    uint64_t shared, unshared, value_size;
+    offset += coding::decode_varint(data.subspan(offset), shared);
+    offset += coding::decode_varint(data.subspan(offset), unshared);
+    offset += coding::decode_varint(data.subspan(offset), value_size);
+    if (shared > key_.size() || offset + unshared + value_size > data.size()) {
+        throw std::runtime_error("Block has a corrupt entry");
+    }
+    auto *entry = reinterpret_cast<const char *>(data.data() + offset);
+    key_.resize(shared);
+    key_.append(entry, unshared);
+    value_ = {entry + unshared, value_size};
+    next_offset_ = offset + unshared + value_size;
+}
+
+auto Block::Iterator::seek_to_restart(size_t index) -> void {
+    key_.clear();
+    offset_ = block_.restart(index);
+    if (valid()) {
+        decode(offset_);
+    }
+}
+
+}  // namespace block
+}  // namespace mousedb
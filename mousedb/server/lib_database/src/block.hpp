@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace mousedb {
+namespace block {
+// Builds a block of sorted KV pairs. Each entry is stored as
+//    [shared key size][unshared key size][value size][unshared key][value]
+// where the shared part is taken from the previous key. Every
+// restart_interval entries, an entry stores its whole key and its offset is
+// added to the restart array, which is written with its size at the end.
+// Example:
+//    BlockBuilder builder(16);
+//    builder.add("apple", "1");
+//    builder.add("apricot", "2");
+//    std::span<const std::byte> data = builder.finish();
+class BlockBuilder {
+   public:
+    explicit BlockBuilder(size_t restart_interval);
+
+    // Keys must be added in sorted order.
+    auto add(std::string_view key, std::string_view value) -> void;
+    // Returns the finished block, which stays valid until reset.
+    auto finish() -> std::span<const std::byte>;
+    auto reset() -> void;
+
+    // In bytes, the size of the block if it were finished now.
+    auto size() const -> size_t;
+    auto empty() const -> bool;
+    auto last_key() const -> std::string_view;
+
+   private:
+    const size_t restart_interval_;
+
+    std::vector<std::byte> buffer_;
+    std::vector<uint32_t> restarts_;
+    size_t counter_ = 0;
+    std::string last_key_;
+};
+
+// Reads a block written by BlockBuilder without copying it. The block's bytes
+// must outlive the reader and its iterators.
+class Block {
+   public:
+    class Iterator;
+
+    explicit Block(std::span<const std::byte> data);
+
+    auto begin() const -> Iterator;
+
+   private:
+    std::span<const std::byte> data_;
+    size_t restarts_offset_;
+    uint32_t num_restarts_;
+
+    auto restart(size_t index) const -> size_t;
+};
+
+class Block::Iterator {
+   public:
+    // Starts out invalid until it is positioned with seek_to_first,
+    // seek_to_last or seek.
+    explicit Iterator(const Block &block);
+
+    auto valid() const -> bool;
+    auto seek_to_first() -> void;
+    auto seek_to_last() -> void;
+    // Moves to the first entry whose key is not less than key.
+    auto seek(std::string_view key) -> void;
+    auto next() -> void;
+    // Entries only decode forward, so this scans from the restart before the
+    // current entry.
+    auto prev() -> void;
+
+    auto key() const -> std::string_view;
+    auto value() const -> std::string_view;
+
+   private:
+    Block block_;
+    size_t offset_;
+    size_t next_offset_;
+    std::string key_;
+    std::string_view value_;
+
+    // Decodes the entry at offset onto the current key.
+    auto decode(size_t offset) -> void;
+    auto seek_to_restart(size_t index) -> void;
+};
+
+}  // namespace block
+}  // namespace mousedb
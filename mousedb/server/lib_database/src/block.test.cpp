@@ -0,0 +1,76 @@
+#include "block.hpp"
+
+#include <gtest/gtest.h>
+
+#include <format>
+#include <string>
+
+using namespace mousedb::block;
+
+TEST(block_Block, EmptyBlockIsInvalid) {
+    BlockBuilder builder(16);
+    EXPECT_TRUE(builder.empty());
+    Block block(builder.finish());
+    EXPECT_FALSE(block.begin().valid());
+}
+
+TEST(block_Block, SharesPrefixesBetweenRestarts) {
+    BlockBuilder shared(16);
+    BlockBuilder unshared(1);
+    for (int i = 0; i < 64; ++i) {
+        auto key = std::format("a_long_common_prefix_{:03}", i);
+        shared.add(key, "v");
+        unshared.add(key, "v");
+    }
+    EXPECT_LT(shared.size(), unshared.size() / 2);
+
+    Block block(shared.finish());
+    int i = 0;
+    for (auto it = block.begin(); it.valid(); it.next()) {
+        EXPECT_EQ(it.key(), std::format("a_long_common_prefix_{:03}", i));
+        EXPECT_EQ(it.value(), "v");
+        ++i;
+    }
+    EXPECT_EQ(i, 64);
+}
+
+TEST(block_Block, SeekAcrossRestarts) {
+    BlockBuilder builder(4);
+    for (int i = 0; i < 100; i += 2) {
+        builder.add(std::format("{:03}", i), std::to_string(i));
+    }
+    Block block(builder.finish());
+    Block::Iterator it(block);
+    for (int i = 0; i < 99; ++i) {
+        it.seek(std::format("{:03}", i));
+        ASSERT_TRUE(it.valid()) << i;
+        int expected = i % 2 == 0 ? i : i + 1;
+        EXPECT_EQ(it.key(), std::format("{:03}", expected));
+        EXPECT_EQ(it.value(), std::to_string(expected));
+    }
+    it.seek("999");
+    EXPECT_FALSE(it.valid());
+}
+
+TEST(block_Block, IteratesBackward) {
+    BlockBuilder builder(4);
+    for (int i = 0; i < 50; ++i) {
+        builder.add(std::format("{:03}", i), std::to_string(i));
+    }
+    Block block(builder.finish());
+    Block::Iterator it(block);
+    int i = 49;
+    for (it.seek_to_last(); it.valid(); it.prev()) {
+        EXPECT_EQ(it.key(), std::format("{:03}", i));
+        EXPECT_EQ(it.value(), std::to_string(i));
+        --i;
+    }
+    EXPECT_EQ(i, -1);
+
+    it.seek("020");
+    it.prev();
+    ASSERT_TRUE(it.valid());
+    EXPECT_EQ(it.key(), "019");
+    it.next();
+    EXPECT_EQ(it.key(), "020");
+}
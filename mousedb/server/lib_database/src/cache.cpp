@@ -0,0 +1,144 @@
+#include "cache.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
+namespace mousedb {
+namespace cache {
+
+BlockCache::BlockCache(size_t capacity)
+    : capacity_(capacity),
+      shards_(std::bit_ceil(
+          std::max(std::thread::hardware_concurrency(), 1u))),
+      shard_capacity_(capacity / shards_.size()) {
+}
+
+auto BlockCache::lookup(uint64_t sst_id, uint64_t offset) -> Handle {
+    Key key{sst_id, offset};
+    Shard &shard = get_shard(key);
+    std::scoped_lock lock(shard.mutex);
+    auto it = shard.slots.find(key);
+    if (it == shard.slots.end()) {
+        ++shard.misses;
+        return Handle();
+    }
+    ++shard.hits;
+    auto &entry = shard.clock[it->second];
+    entry->referenced = true;
+    return Handle(entry);
+}
+
+auto BlockCache::insert(uint64_t sst_id, uint64_t offset,
+                        std::span<const std::byte> data) -> Handle {
+    Key key{sst_id, offset};
+    Shard &shard = get_shard(key);
+    // copies outside of the lock
+    auto entry = std::make_shared<Entry>(
+        key, std::make_unique_for_overwrite<std::byte[]>(data.size()),
+        data.size());
+    std::memcpy(entry->data.get(), data.data(), data.size());
+
+    std::scoped_lock lock(shard.mutex);
+    auto it = shard.slots.find(key);
+    if (it != shard.slots.end()) {
+        auto &cached = shard.clock[it->second];
+        cached->referenced = true;
+        return Handle(cached);
+    }
+    evict(shard, data.size());
+    size_t slot = shard.clock.size();
+    if (shard.free_slots.empty()) {
+        shard.clock.push_back(entry);
+    } else {
+        slot = shard.free_slots.back();
+        shard.free_slots.pop_back();
+        shard.clock[slot] = entry;
+    }
+    shard.slots.emplace(key, slot);
+    shard.usage += data.size();
+    return Handle(std::move(entry));
+}
+
+auto BlockCache::capacity() const -> size_t {
+    return capacity_;
+}
+
+auto BlockCache::usage() const -> size_t {
+    size_t usage = 0;
+    for (auto &shard : shards_) {
+        std::scoped_lock lock(const_cast<Shard &>(shard).mutex);
+        usage += shard.usage;
+    }
+    return usage;
+}
+
+auto BlockCache::hits() const -> size_t {
+    size_t hits = 0;
+    for (auto &shard : shards_) {
+        std::scoped_lock lock(const_cast<Shard &>(shard).mutex);
+        hits += shard.hits;
+    }
+    return hits;
+}
+
+auto BlockCache::misses() const -> size_t {
+    size_t misses = 0;
+    for (auto &shard : shards_) {
+        std::scoped_lock lock(const_cast<Shard &>(shard).mutex);
+        misses += shard.misses;
+    }
+    return misses;
+}
+
+auto BlockCache::KeyHash::operator()(const Key &key) const -> size_t {
+    // offsets are block aligned, so their low bits are mixed in
+    uint64_t h = key.sst_id * 0x9e3779b97f4a7c15 ^ key.offset;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccd;
+    h ^= h >> 33;
+    return h;
+}
+
+inline auto BlockCache::get_shard(const Key &key) -> Shard & {
+    return shards_[KeyHash()(key) & (shards_.size() - 1)];
+}
+
+auto BlockCache::evict(Shard &shard, size_t size) -> void {
+    size_t steps = shard.clock.size() * 2;
+    while (shard.usage + size > shard_capacity_ && steps-- > 0) {
+        if (shard.hand >= shard.clock.size()) {
+            shard.hand = 0;
+        }
+        size_t slot = shard.hand++;
+        auto &entry = shard.clock[slot];
+        if (!entry || entry.use_count() > 1) {
+            continue;
+        }
+        if (entry->referenced) {
+            entry->referenced = false;
+            continue;
+        }
+        shard.usage -= entry->size;
+        shard.slots.erase(entry->key);
+        shard.free_slots.push_back(slot);
+        entry.reset();
+    }
+}
+
+BlockCache::Handle::Handle(std::shared_ptr<const Entry> entry)
+    : entry_(std::move(entry)) {
+}
+
+BlockCache::Handle::operator bool() const {
+    return entry_ != nullptr;
+}
+
+auto BlockCache::Handle::data() const -> std::span<const std::byte> {
+    return {entry_->data.get(), entry_->size};
+}
+
+}  // namespace cache
+}  // namespace mousedb
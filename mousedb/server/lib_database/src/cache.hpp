@@ -0,0 +1,115 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+#include "spin_mutex.hpp"
+
+namespace mousedb {
+namespace cache {
+// Caches SSTable blocks, keyed by the table's id and the block's offset in
+// it, up to capacity bytes. The cache is split into shards by key, each with
+// its own lock and CLOCK hand, so concurrent readers rarely contend. A block
+// is pinned for as long as a Handle to it lives and is never evicted while
+// pinned, which lets readers use it without copying. A handle keeps its block
+// alive even after the cache is destroyed.
+// Example:
+//    BlockCache cache(8 << 20);
+//    auto handle = cache.lookup(id, offset);
+//    if (!handle) {
+//        handle = cache.insert(id, offset, read_block());
+//    }
+//    use(handle.data());
+class BlockCache {
+   public:
+    class Handle;
+
+    explicit BlockCache(size_t capacity);
+    BlockCache(const BlockCache &) = delete;
+    BlockCache &operator=(const BlockCache &) = delete;
+
+    // Returns an empty handle if the block is not cached.
+    auto lookup(uint64_t sst_id, uint64_t offset) -> Handle;
+    // Copies data into the cache, evicting unpinned blocks to make room. If
+    // the block is already cached, the cached copy is returned instead.
+    auto insert(uint64_t sst_id, uint64_t offset,
+                std::span<const std::byte> data) -> Handle;
+
+    // In bytes, the most the cache holds when nothing is pinned.
+    auto capacity() const -> size_t;
+    // In bytes, the size of the cached blocks.
+    auto usage() const -> size_t;
+    auto hits() const -> size_t;
+    auto misses() const -> size_t;
+
+   private:
+    struct Key {
+        uint64_t sst_id;
+        uint64_t offset;
+
+        auto operator==(const Key &) const -> bool = default;
+    };
+
+    struct KeyHash {
+        auto operator()(const Key &key) const -> size_t;
+    };
+
+    struct Entry {
+        Key key;
+        std::unique_ptr<std::byte[]> data;
+        size_t size;
+        // Set on every use and cleared as the CLOCK hand passes.
+        bool referenced = true;
+    };
+
+    struct alignas(64) Shard {
+        // Maps keys to their slots in the CLOCK.
+        std::unordered_map<Key, size_t, KeyHash> slots;
+        // The CLOCK, where evicted entries leave empty slots for reuse. An
+        // entry is pinned while a handle shares it.
+        std::vector<std::shared_ptr<Entry>> clock;
+        std::vector<size_t> free_slots;
+        size_t hand = 0;
+        size_t usage = 0;
+        size_t hits = 0;
+        size_t misses = 0;
+        spin_mutex::SpinMutex mutex;
+    };
+
+    const size_t capacity_;
+    std::vector<Shard> shards_;
+    const size_t shard_capacity_;
+
+    inline auto get_shard(const Key &key) -> Shard &;
+    // Evicts unpinned entries until size more bytes fit in the shard or every
+    // entry has been passed twice.
+    auto evict(Shard &shard, size_t size) -> void;
+};
+
+// Pins a cached block. Handles are move-only and empty when default
+// constructed or moved from.
+class BlockCache::Handle {
+   public:
+    Handle() = default;
+    Handle(const Handle &) = delete;
+    Handle &operator=(const Handle &) = delete;
+    Handle(Handle &&other) noexcept = default;
+    Handle &operator=(Handle &&other) noexcept = default;
+
+    explicit operator bool() const;
+    auto data() const -> std::span<const std::byte>;
+
+   private:
+    friend class BlockCache;
+
+    std::shared_ptr<const Entry> entry_;
+
+    explicit Handle(std::shared_ptr<const Entry> entry);
+};
+
+}  // namespace cache
+}  // namespace mousedb
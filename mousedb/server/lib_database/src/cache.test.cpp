@@ -0,0 +1,101 @@
+#include "cache.hpp"
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace mousedb::cache;
+
+static auto as_bytes(std::string_view s) -> std::span<const std::byte> {
+    return {reinterpret_cast<const std::byte *>(s.data()), s.size()};
+}
+
+static auto as_string(std::span<const std::byte> data) -> std::string {
+    return {reinterpret_cast<const char *>(data.data()), data.size()};
+}
+
+TEST(cache_BlockCache, LookupAfterInsert) {
+    BlockCache cache(1 << 20);
+    EXPECT_FALSE(cache.lookup(1, 0));
+    {
+        auto handle = cache.insert(1, 0, as_bytes("block"));
+        ASSERT_TRUE(handle);
+        EXPECT_EQ(as_string(handle.data()), "block");
+    }
+    auto handle = cache.lookup(1, 0);
+    ASSERT_TRUE(handle);
+    EXPECT_EQ(as_string(handle.data()), "block");
+    EXPECT_FALSE(cache.lookup(1, 4096));
+    EXPECT_FALSE(cache.lookup(2, 0));
+    EXPECT_EQ(cache.hits(), 1u);
+    EXPECT_EQ(cache.misses(), 3u);
+    EXPECT_EQ(cache.usage(), 5u);
+}
+
+TEST(cache_BlockCache, InsertKeepsCachedCopy) {
+    BlockCache cache(1 << 20);
+    cache.insert(1, 0, as_bytes("first"));
+    auto handle = cache.insert(1, 0, as_bytes("second"));
+    EXPECT_EQ(as_string(handle.data()), "first");
+    EXPECT_EQ(cache.usage(), 5u);
+}
+
+TEST(cache_BlockCache, EvictsWithinCapacity) {
+    BlockCache cache(64 * 1024);
+    std::string block(1024, 'x');
+    for (uint64_t i = 0; i < 1024; ++i) {
+        cache.insert(1, i * block.size(), as_bytes(block));
+        EXPECT_LE(cache.usage(), cache.capacity());
+    }
+    size_t cached = 0;
+    for (uint64_t i = 0; i < 1024; ++i) {
+        cached += static_cast<bool>(cache.lookup(1, i * block.size()));
+    }
+    EXPECT_GT(cached, 0u);
+    EXPECT_LE(cached, 64u);
+}
+
+TEST(cache_BlockCache, PinnedBlocksSurviveEviction) {
+    BlockCache cache(4096);
+    std::string block(1024, 'x');
+    auto pinned = cache.insert(1, 0, as_bytes("pinned"));
+    for (uint64_t i = 1; i < 256; ++i) {
+        cache.insert(1, i * block.size(), as_bytes(block));
+    }
+    EXPECT_EQ(as_string(pinned.data()), "pinned");
+    EXPECT_TRUE(cache.lookup(1, 0));
+}
+
+TEST(cache_BlockCache, HandlesOutliveCache) {
+    BlockCache::Handle handle;
+    {
+        BlockCache cache(4096);
+        handle = cache.insert(1, 0, as_bytes("block"));
+    }
+    EXPECT_EQ(as_string(handle.data()), "block");
+}
+
+TEST(cache_BlockCache, ManyThreadsInsertAndLookup) {
+    BlockCache cache(256 * 1024);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 8; ++t) {
+        threads.emplace_back([&cache, t] {
+            for (uint64_t i = 0; i < 2000; ++i) {
+                uint64_t offset = (i * 7 + t) % 512 * 4096;
+                auto handle = cache.lookup(1, offset);
+                if (!handle) {
+                    handle = cache.insert(1, offset,
+                                          as_bytes(std::to_string(offset)));
+                }
+                ASSERT_EQ(as_string(handle.data()), std::to_string(offset));
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    EXPECT_EQ(cache.hits() + cache.misses(), 8u * 2000u);
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <vector>
+
+namespace mousedb {
+namespace coding {
+
+inline auto get_varint_size(uint64_t value) -> size_t {
+    size_t bits = 64 - std::countl_zero(value);
+    return bits == 0 ? 1 : (bits + 6) / 7;
+}
+
+inline auto encode_varint(std::span<std::byte> data, uint64_t value)
+    -> size_t {
+    size_t i = 0;
+    while (value > 0x7F) {
+        data[i] = static_cast<std::byte>((value & 0x7F) | 0x80);
+        value >>= 7;
+        ++i;
+    }
+    data[i] = static_cast<std::byte>(value);
+    return i + 1;
+}
+
+inline auto decode_varint(std::span<const std::byte> data, uint64_t &value)
+    -> size_t {
+    size_t i = 0;
+    value = 0;
+    while (true) {
+        value |= (static_cast<uint64_t>(data[i]) & 0x7F) << (i * 7);
+        if ((static_cast<uint64_t>(data[i]) & 0x80) == 0) {
+            break;
+        }
+        ++i;
+    }
+    return i + 1;
+}
+
+inline auto put_varint(std::vector<std::byte> &buffer, uint64_t value)
+    -> void {
+    size_t size = buffer.size();
+    buffer.resize(size + get_varint_size(value));
+    encode_varint({buffer.data() + size, buffer.size() - size}, value);
+}
+
+// Fixed-width integers are stored in host byte order.
+template <typename T>
+inline auto put_fixed(std::vector<std::byte> &buffer, T value) -> void {
+    size_t size = buffer.size();
+    buffer.resize(size + sizeof(T));
+    std::memcpy(buffer.data() + size, &value, sizeof(T));
+}
+
+template <typename T>
+inline auto decode_fixed(const std::byte *data) -> T {
+    T value;
+    std::memcpy(&value, data, sizeof(T));
+    return value;
+}
+
+}  // namespace coding
+}  // namespace mousedb
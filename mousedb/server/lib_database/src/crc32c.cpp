@@ -0,0 +1,91 @@
+#include "crc32c.hpp"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include <array>
+#include <cstring>
+
+// the Castagnoli polynomial, reversed
+constexpr uint32_t CRC32C_POLYNOMIAL = 0x82f63b78;
+
+// Tables for slicing by 8, where TABLES[k][b] is the CRC of byte b followed
+// by k zero bytes.
+static constexpr auto TABLES = [] {
+    std::array<std::array<uint32_t, 256>, 8> tables{};
+    for (uint32_t b = 0; b < 256; ++b) {
+        uint32_t crc = b;
+        for (int i = 0; i < 8; ++i) {
+            crc = (crc >> 1) ^ (crc & 1 ? CRC32C_POLYNOMIAL : 0);
+        }
+        tables[0][b] = crc;
+    }
+    for (size_t k = 1; k < 8; ++k) {
+        for (uint32_t b = 0; b < 256; ++b) {
+            uint32_t crc = tables[k - 1][b];
+            tables[k][b] = (crc >> 8) ^ tables[0][crc & 0xff];
+        }
+    }
+    return tables;
+}();
+
+static auto extend_scalar(uint32_t crc, const std::byte *data, size_t size)
+    -> uint32_t {
+    for (; size >= 8; data += 8, size -= 8) {
+        uint64_t word;
+        std::memcpy(&word, data, sizeof(word));
+        // assumes a little-endian host, as the rest of the storage does
+        word ^= crc;
+        crc = TABLES[7][word & 0xff] ^ TABLES[6][(word >> 8) & 0xff] ^
+              TABLES[5][(word >> 16) & 0xff] ^ TABLES[4][(word >> 24) & 0xff] ^
+              TABLES[3][(word >> 32) & 0xff] ^ TABLES[2][(word >> 40) & 0xff] ^
+              TABLES[1][(word >> 48) & 0xff] ^ TABLES[0][word >> 56];
+    }
+    for (; size > 0; ++data, --size) {
+        crc = (crc >> 8) ^
+              TABLES[0][(crc ^ static_cast<uint32_t>(*data)) & 0xff];
+    }
+    return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2"))) static auto extend_sse42(
+    uint32_t crc, const std::byte *data, size_t size) -> uint32_t {
+    uint64_t crc64 = crc;
+    for (; size >= 8; data += 8, size -= 8) {
+        uint64_t word;
+        std::memcpy(&word, data, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+    crc = static_cast<uint32_t>(crc64);
+    for (; size > 0; ++data, --size) {
+        crc = _mm_crc32_u8(crc, static_cast<uint8_t>(*data));
+    }
+    return crc;
+}
+
+static auto has_sse42() -> bool {
+    static const bool has_sse42 = [] {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("sse4.2") != 0;
+    }();
+    return has_sse42;
+}
+#endif
+
+namespace mousedb {
+namespace crc32c {
+
+auto extend(uint32_t crc, std::span<const std::byte> data) -> uint32_t {
+    crc = ~crc;
+#if defined(__x86_64__)
+    if (has_sse42()) {
+        return ~extend_sse42(crc, data.data(), data.size());
+    }
+#endif
+    return ~extend_scalar(crc, data.data(), data.size());
+}
+
+}  // namespace crc32c
+}  // namespace mousedb
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+namespace mousedb {
+namespace crc32c {
+
+// Returns the CRC32C of data appended to data whose CRC32C is crc, using
+// the SSE4.2 crc32 instruction where the CPU has it.
+// Example:
+//    uint32_t crc = crc32c::extend(crc32c::value(header), payload);
+auto extend(uint32_t crc, std::span<const std::byte> data) -> uint32_t;
+
+inline auto value(std::span<const std::byte> data) -> uint32_t {
+    return extend(0, data);
+}
+
+// Stored CRCs are masked, since the CRC of data that holds its own CRC is
+// prone to degenerate values.
+inline auto mask(uint32_t crc) -> uint32_t {
+    return ((crc >> 15) | (crc << 17)) + 0xa282ead8;
+}
+
+inline auto unmask(uint32_t masked) -> uint32_t {
+    uint32_t rotated = masked - 0xa282ead8;
+    return (rotated >> 17) | (rotated << 15);
+}
+
+}  // namespace crc32c
+}  // namespace mousedb
@@ -0,0 +1,47 @@
+#include "crc32c.hpp"
+
+#include <gtest/gtest.h>
+
+#include <string_view>
+#include <vector>
+
+using namespace mousedb;
+
+static auto bytes(std::string_view s) -> std::span<const std::byte> {
+    return std::as_bytes(std::span(s));
+}
+
+TEST(crc32c, MatchesKnownValues) {
+    EXPECT_EQ(crc32c::value({}), 0u);
+    EXPECT_EQ(crc32c::value(bytes("123456789")), 0xe3069283u);
+
+    // from RFC 3720
+    std::vector<std::byte> data(32, std::byte{0});
+    EXPECT_EQ(crc32c::value(data), 0x8a9136aau);
+    std::ranges::fill(data, std::byte{0xff});
+    EXPECT_EQ(crc32c::value(data), 0x62a8ab43u);
+    for (size_t i = 0; i < data.size(); ++i) {
+        data[i] = static_cast<std::byte>(i);
+    }
+    EXPECT_EQ(crc32c::value(data), 0x46dd794eu);
+}
+
+TEST(crc32c, ExtendsInPieces) {
+    std::string_view s = "the quick brown fox jumps over the lazy dog";
+    for (size_t i = 0; i <= s.size(); ++i) {
+        EXPECT_EQ(crc32c::extend(crc32c::value(bytes(s.substr(0, i))),
+                                 bytes(s.substr(i))),
+                  crc32c::value(bytes(s)))
+            << i;
+    }
+}
+
+TEST(crc32c, MasksReversibly) {
+    uint32_t crc = crc32c::value(bytes("foo"));
+    EXPECT_NE(crc32c::mask(crc), crc);
+    EXPECT_NE(crc32c::mask(crc32c::mask(crc)), crc);
+    EXPECT_EQ(crc32c::unmask(crc32c::mask(crc)), crc);
+    EXPECT_EQ(crc32c::unmask(crc32c::unmask(
+                  crc32c::mask(crc32c::mask(crc)))),
+              crc);
+}
@@ -0,0 +1,60 @@
+#include "filter.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <format>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace mousedb::filter;
+
+// Large enough that most lines miss in cache.
+constexpr size_t NUM_KEYS = 1 << 22;
+
+static auto make_filter() -> const BloomFilter & {
+    static const BloomFilter bf = [] {
+        BloomFilter bf({.num_keys = NUM_KEYS, .bits_per_key = 10});
+        for (size_t i = 0; i < NUM_KEYS; ++i) {
+            bf.add(std::format("key{}", i));
+        }
+        return bf;
+    }();
+    return bf;
+}
+
+static auto make_absent_keys(size_t count) -> std::vector<std::string> {
+    std::vector<std::string> keys;
+    for (size_t i = 0; i < count; ++i) {
+        keys.push_back(std::format("absent{}", i * 7919));
+    }
+    return keys;
+}
+
+static void filter_BloomFilterContains(benchmark::State &state) {
+    const auto &bf = make_filter();
+    auto keys = make_absent_keys(4096);
+    size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(bf.contains(keys[i++ & 4095]));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+static void filter_BloomFilterContainsBatch(benchmark::State &state) {
+    const auto &bf = make_filter();
+    auto keys = make_absent_keys(4096);
+    std::vector<std::string_view> items(keys.begin(), keys.end());
+    size_t batch = state.range(0);
+    auto results = std::make_unique<bool[]>(batch);
+    size_t i = 0;
+    for (auto _ : state) {
+        bf.contains(std::span(items).subspan(i, batch), {results.get(), batch});
+        benchmark::DoNotOptimize(results.get());
+        i = (i + batch) & 4095;
+    }
+    state.SetItemsProcessed(state.iterations() * batch);
+}
+
+BENCHMARK(filter_BloomFilterContains);
+BENCHMARK(filter_BloomFilterContainsBatch)->Arg(8)->Arg(32)->Arg(128);
@@ -1,102 +1,471 @@
 #include "filter.hpp"
 
-#include <functional>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cmath>
+#include <cstring>
+#include <format>
 #include <stdexcept>
+#include <utility>
+#include <ranges>
 #include <vector>
 
+#include "coding.hpp"
+
+constexpr size_t BITS_PER_LINE = mousedb::filter::BloomFilter::LINE_SIZE * 8;
+constexpr size_t MAX_PROBES = 16;
+constexpr size_t FUSE_HEADER_SIZE = sizeof(uint64_t) + 2 * sizeof(uint32_t);
+constexpr size_t FUSE_MAX_ATTEMPTS = 100;
+
+// Splits a key's hash into the two halves used for double hashing, which are
+// kept apart from the bits that pick the line.
+static auto probe_hashes(uint64_t h) -> std::pair<uint32_t, uint32_t> {
+    uint64_t g = (h >> 32 | h << 32) * 0x9e3779b97f4a7c15;
+    // an odd step visits distinct bits for the first 512 probes
+    return {static_cast<uint32_t>(g), static_cast<uint32_t>(g >> 32) | 1};
+}
+
+#if defined(__x86_64__)
+__attribute__((target("avx2"))) static auto probe_avx2(
+    const uint64_t *line, uint64_t h, size_t num_probes) -> bool {
+    auto [h1, h2] = probe_hashes(h);
+    const __m256i step = _mm256_set1_epi32(static_cast<int>(h2));
+    const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256i bit_mask = _mm256_set1_epi32(BITS_PER_LINE - 1);
+    const __m256i one = _mm256_set1_epi32(1);
+    for (size_t i = 0; i < num_probes; i += 8) {
+        // probes i to i + 7, with lanes past num_probes left out
+        __m256i index =
+            _mm256_add_epi32(lanes, _mm256_set1_epi32(static_cast<int>(i)));
+        __m256i active = _mm256_cmpgt_epi32(
+            _mm256_set1_epi32(static_cast<int>(num_probes)), index);
+        __m256i bits = _mm256_and_si256(
+            _mm256_add_epi32(_mm256_set1_epi32(static_cast<int>(h1)),
+                             _mm256_mullo_epi32(index, step)),
+            bit_mask);
+        // a little-endian line read as 32-bit words holds the same bits
+        __m256i words = _mm256_i32gather_epi32(
+            reinterpret_cast<const int *>(line), _mm256_srli_epi32(bits, 5),
+            4);
+        __m256i shifts = _mm256_and_si256(bits, _mm256_set1_epi32(31));
+        __m256i masks =
+            _mm256_and_si256(_mm256_sllv_epi32(one, shifts), active);
+        __m256i hit =
+            _mm256_cmpeq_epi32(_mm256_and_si256(words, masks), masks);
+        if (_mm256_movemask_epi8(hit) != -1) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static auto has_avx2() -> bool {
+    static const bool has_avx2 = [] {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2") != 0;
+    }();
+    return has_avx2;
+}
+#endif
+
+static auto probe_scalar(const uint64_t *line, uint64_t h, size_t num_probes)
+    -> bool {
+    auto [h1, h2] = probe_hashes(h);
+    for (size_t i = 0; i < num_probes; ++i) {
+        uint32_t bit = (h1 + i * h2) & (BITS_PER_LINE - 1);
+        if ((line[bit / 64] & (uint64_t(1) << (bit % 64))) == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// The finalizer of MurmurHash3, which reseeds a key's hash for each attempt
+// at building a binary fuse filter.
+static auto fuse_mix(uint64_t h) -> uint64_t {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccd;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53;
+    h ^= h >> 33;
+    return h;
+}
+
+static auto fuse_fingerprint(uint64_t h) -> uint8_t {
+    return static_cast<uint8_t>(h ^ h >> 32);
+}
+
+// Returns the segment length and count for n keys, which take up
+// (segment count + 2) * segment length fingerprints. The constants are from
+// Graf and Lemire's binary fuse filters for three positions per key.
+static auto fuse_shape(size_t n) -> std::pair<uint32_t, uint32_t> {
+    if (n == 0) {
+        return {4, 0};
+    }
+    uint32_t segment_length = std::min(
+        uint32_t(1) << static_cast<int>(
+            std::floor(std::log(static_cast<double>(n)) / std::log(3.33) +
+                       2.25)),
+        uint32_t(1) << 18);
+    double size_factor =
+        n <= 1 ? 0
+               : std::max(1.125, 0.875 + 0.25 * std::log(1000000.0) /
+                                             std::log(static_cast<double>(n)));
+    auto capacity = static_cast<size_t>(std::round(n * size_factor));
+    size_t segments = (capacity + segment_length - 1) / segment_length;
+    uint32_t segment_count = segments <= 2 ? 1 : segments - 2;
+    return {segment_length, segment_count};
+}
+
+// Returns a key's positions, one in each of three consecutive segments.
+static auto fuse_positions(uint64_t h, uint32_t segment_length,
+                           uint32_t segment_count) -> std::array<uint32_t, 3> {
+    uint64_t mask = segment_length - 1;
+    auto base = static_cast<uint32_t>(
+        (static_cast<unsigned __int128>(h) *
+         (static_cast<uint64_t>(segment_count) * segment_length)) >>
+        64);
+    return {base, static_cast<uint32_t>((base + segment_length) ^
+                                        ((h >> 18) & mask)),
+            static_cast<uint32_t>((base + 2 * segment_length) ^ (h & mask))};
+}
+
 namespace mousedb {
 namespace filter {
 
-BloomFilter::BloomFilter(std::size_t size, std::size_t hash_count)
-    : size_(size), hash_count_(hash_count), bits_(size) {
+auto hash(std::string_view item) -> uint64_t {
+    // MurmurHash64A
+    constexpr uint64_t m = 0xc6a4a7935bd1e995;
+    constexpr int r = 47;
+    uint64_t h = 0x5bd1e9955bd1e995 ^ (item.size() * m);
+    const char *p = item.data();
+    const char *end = p + item.size() / 8 * 8;
+    for (; p != end; p += 8) {
+        uint64_t k;
+        std::memcpy(&k, p, sizeof(k));
+        k *= m;
+        k ^= k >> r;
+        k *= m;
+        h ^= k;
+        h *= m;
+    }
+    size_t tail = item.size() % 8;
+    if (tail > 0) {
+        uint64_t k = 0;
+        std::memcpy(&k, p, tail);
+        h ^= k;
+        h *= m;
+    }
+    h ^= h >> r;
+    h *= m;
+    h ^= h >> r;
+    return h;
+}
+
+auto Filter::contains(std::span<const std::string_view> items,
+                      std::span<bool> results) const -> void {
+    for (size_t i = 0; i < items.size(); ++i) {
+        results[i] = contains(items[i]);
+    }
+}
+
+auto read(FilterType type, std::span<const std::byte> data)
+    -> std::unique_ptr<Filter> {
+    switch (type) {
+        case FilterType::bloom:
+            return std::make_unique<BloomFilter>(data);
+        case FilterType::binary_fuse:
+            return std::make_unique<BinaryFuseFilter>(data);
+    }
+    throw std::runtime_error(std::format("Unknown filter type {}",
+                                         static_cast<uint32_t>(type)));
+}
+
+BloomFilter::BloomFilter(const BloomFilterOptions &options)
+    : num_lines_(std::max(
+          (options.num_keys * options.bits_per_key + BITS_PER_LINE - 1) /
+              BITS_PER_LINE,
+          static_cast<size_t>(1))),
+      // k = ln 2 * bits per key minimizes false positives
+      num_probes_(std::clamp(
+          static_cast<size_t>(std::lround(options.bits_per_key * 0.69)),
+          static_cast<size_t>(1), MAX_PROBES)),
+      owned_lines_(std::make_unique<Line[]>(num_lines_)),
+      lines_(owned_lines_.get()) {
 }
 
 BloomFilter::BloomFilter(FILE *fp) {
     if (!fp) throw std::runtime_error("BloomFilter::load: null FILE*");
 
-    std::size_t bit_count, hash_count;
-    if (fread(&bit_count, sizeof(bit_count), 1, fp) != 1 ||
-        fread(&hash_count, sizeof(hash_count), 1, fp) != 1) {
+    Line header;
+    if (fread(&header, sizeof(header), 1, fp) != 1) {
         throw std::runtime_error("BloomFilter::load: failed to read header");
     }
-
-    std::size_t nblocks;
-    if (fread(&nblocks, sizeof(nblocks), 1, fp) != 1) {
-        throw std::runtime_error(
-            "BloomFilter::load: failed to read block count");
+    num_lines_ = header.words[0];
+    num_probes_ = header.words[1];
+    if (num_lines_ == 0 || num_probes_ == 0 || num_probes_ > MAX_PROBES) {
+        throw std::runtime_error("BloomFilter::load: corrupt header");
     }
-
-    using block_type = typename boost::dynamic_bitset<>::block_type;
-    std::vector<block_type> blocks(nblocks);
-    if (fread(blocks.data(), sizeof(block_type), nblocks, fp) != nblocks) {
-        throw std::runtime_error("BloomFilter::load: failed to read blocks");
+    owned_lines_ = std::make_unique_for_overwrite<Line[]>(num_lines_);
+    lines_ = owned_lines_.get();
+    if (fread(owned_lines_.get(), sizeof(Line), num_lines_, fp) !=
+        num_lines_) {
+        throw std::runtime_error("BloomFilter::load: failed to read lines");
     }
+}
 
-    boost::dynamic_bitset<> bits(bit_count);
-    constexpr std::size_t bits_per_block =
-        boost::dynamic_bitset<>::bits_per_block;
-    for (std::size_t i = 0; i < nblocks; ++i) {
-        block_type blk = blocks[i];
-        for (std::size_t b = 0; b < bits_per_block; ++b) {
-            if (blk & (block_type(1) << b)) {
-                std::size_t pos = i * bits_per_block + b;
-                if (pos < bit_count) bits.set(pos);
-            }
-        }
+BloomFilter::BloomFilter(std::span<const std::byte> data) {
+    if (data.size() < HEADER_SIZE) {
+        throw std::runtime_error("BloomFilter::load: missing header");
     }
-
-    size_ = bit_count;
-    hash_count_ = hash_count;
-    bits_ = std::move(bits);
+    std::memcpy(&num_lines_, data.data(), sizeof(uint64_t));
+    std::memcpy(&num_probes_, data.data() + sizeof(uint64_t),
+                sizeof(uint64_t));
+    if (num_lines_ == 0 || num_probes_ == 0 || num_probes_ > MAX_PROBES ||
+        data.size() - HEADER_SIZE != num_lines_ * sizeof(Line)) {
+        throw std::runtime_error("BloomFilter::load: corrupt header");
+    }
+    const std::byte *lines = data.data() + HEADER_SIZE;
+    if (reinterpret_cast<uintptr_t>(lines) % alignof(Line) == 0) {
+        lines_ = reinterpret_cast<const Line *>(lines);
+        return;
+    }
+    owned_lines_ = std::make_unique_for_overwrite<Line[]>(num_lines_);
+    std::memcpy(owned_lines_.get(), lines, num_lines_ * sizeof(Line));
+    lines_ = owned_lines_.get();
 }
 
 auto BloomFilter::add(std::string_view item) -> void {
-    for (std::size_t i = 0; i < hash_count_; ++i) {
-        auto h = hash(item, i) % size_;
-        bits_.set(h);
+    add_hash(hash(item));
+}
+
+auto BloomFilter::add_hash(uint64_t h) -> void {
+    if (!owned_lines_) {
+        throw std::runtime_error("BloomFilter::add: filter is read in place");
+    }
+    uint64_t *words = owned_lines_[line_index(h)].words;
+    auto [h1, h2] = probe_hashes(h);
+    for (size_t i = 0; i < num_probes_; ++i) {
+        uint32_t bit = (h1 + i * h2) & (BITS_PER_LINE - 1);
+        words[bit / 64] |= uint64_t(1) << (bit % 64);
     }
 }
 
 auto BloomFilter::contains(std::string_view item) const -> bool {
-    for (std::size_t i = 0; i < hash_count_; ++i) {
-        auto h = hash(item, i) % size_;
-        if (!bits_.test(h)) {
-            return false;
+    uint64_t h = hash(item);
+    return probe_scalar(lines_[line_index(h)].words, h, num_probes_);
+}
+
+auto BloomFilter::contains(std::span<const std::string_view> items,
+                           std::span<bool> results) const -> void {
+    std::vector<std::pair<uint64_t, const Line *>> probes(items.size());
+    for (size_t i = 0; i < items.size(); ++i) {
+        uint64_t h = hash(items[i]);
+        probes[i] = {h, &lines_[line_index(h)]};
+        __builtin_prefetch(probes[i].second);
+    }
+#if defined(__x86_64__)
+    if (has_avx2()) {
+        for (size_t i = 0; i < items.size(); ++i) {
+            auto [h, line] = probes[i];
+            results[i] = probe_avx2(line->words, h, num_probes_);
         }
+        return;
+    }
+#endif
+    for (size_t i = 0; i < items.size(); ++i) {
+        auto [h, line] = probes[i];
+        results[i] = probe_scalar(line->words, h, num_probes_);
     }
-    return true;
 }
 
 auto BloomFilter::save(FILE *fp) const -> size_t {
     if (!fp) throw std::runtime_error("BloomFilter::save: null FILE*");
 
-    if (fwrite(&size_, sizeof(size_), 1, fp) != 1 ||
-        fwrite(&hash_count_, sizeof(hash_count_), 1, fp) != 1) {
+    Line line = header();
+    if (fwrite(&line, sizeof(line), 1, fp) != 1) {
         throw std::runtime_error("BloomFilter::save: failed to write header");
     }
+    if (fwrite(lines_, sizeof(Line), num_lines_, fp) != num_lines_) {
+        throw std::runtime_error("BloomFilter::save: failed to write lines");
+    }
+    return HEADER_SIZE + num_lines_ * sizeof(Line);
+}
+
+auto BloomFilter::save(std::vector<std::byte> &out) const -> size_t {
+    Line line = header();
+    auto *begin = reinterpret_cast<const std::byte *>(&line);
+    out.insert(out.end(), begin, begin + sizeof(line));
+    begin = reinterpret_cast<const std::byte *>(lines_);
+    out.insert(out.end(), begin, begin + num_lines_ * sizeof(Line));
+    return HEADER_SIZE + num_lines_ * sizeof(Line);
+}
+
+auto BloomFilter::num_lines() const -> size_t {
+    return num_lines_;
+}
+
+auto BloomFilter::num_probes() const -> size_t {
+    return num_probes_;
+}
+
+auto BloomFilter::line_index(uint64_t h) const -> size_t {
+    // maps the hash onto the lines without a division
+    return static_cast<size_t>(
+        (static_cast<unsigned __int128>(h) * num_lines_) >> 64);
+}
+
+auto BloomFilter::header() const -> Line {
+    Line line{};
+    line.words[0] = num_lines_;
+    line.words[1] = num_probes_;
+    return line;
+}
+
+BinaryFuseFilter::BinaryFuseFilter(std::span<const std::byte> data) {
+    if (data.size() < FUSE_HEADER_SIZE) {
+        throw std::runtime_error("BinaryFuseFilter::load: missing header");
+    }
+    std::memcpy(&seed_, data.data(), sizeof(seed_));
+    std::memcpy(&segment_length_, data.data() + 8, sizeof(segment_length_));
+    std::memcpy(&segment_count_, data.data() + 12, sizeof(segment_count_));
+    size_t size = segment_count_ == 0
+                      ? 0
+                      : (segment_count_ + 2) * size_t(segment_length_);
+    if (!std::has_single_bit(segment_length_) ||
+        data.size() - FUSE_HEADER_SIZE != size) {
+        throw std::runtime_error("BinaryFuseFilter::load: corrupt header");
+    }
+    fingerprints_ = {
+        reinterpret_cast<const uint8_t *>(data.data() + FUSE_HEADER_SIZE),
+        size};
+}
+
+auto BinaryFuseFilter::build(std::span<const uint64_t> hashes,
+                             std::vector<std::byte> &out) -> void {
+    // distinct keys may still share a hash, which would never peel
+    std::vector<uint64_t> keys(hashes.begin(), hashes.end());
+    std::ranges::sort(keys);
+    keys.erase(std::ranges::unique(keys).begin(), keys.end());
+
+    auto [segment_length, segment_count] = fuse_shape(keys.size());
+    size_t size =
+        segment_count == 0 ? 0 : (segment_count + 2) * size_t(segment_length);
+    std::vector<uint8_t> fingerprints(size);
+    // Each slot counts its keys in the upper bits and XORs which of a key's
+    // three positions it is in the lower two, so a slot left with one key
+    // knows both the key and where the key's other positions are.
+    std::vector<uint32_t> counts(size);
+    std::vector<uint64_t> xors(size);
+    std::vector<uint32_t> queue;
+    std::vector<std::pair<uint64_t, uint8_t>> order;
+    order.reserve(keys.size());
+
+    uint64_t seed = 0;
+    for (size_t attempt = 0;; ++attempt) {
+        if (attempt == FUSE_MAX_ATTEMPTS) {
+            throw std::runtime_error("BinaryFuseFilter::build: failed to peel");
+        }
+        seed = fuse_mix(attempt + 0x9e3779b97f4a7c15);
+        std::ranges::fill(counts, 0);
+        std::ranges::fill(xors, 0);
+        order.clear();
+        for (uint64_t key : keys) {
+            uint64_t h = fuse_mix(key + seed);
+            auto positions = fuse_positions(h, segment_length, segment_count);
+            for (uint32_t j = 0; j < 3; ++j) {
+                counts[positions[j]] = (counts[positions[j]] + 4) ^ j;
+                xors[positions[j]] ^= h;
+            }
+        }
+        for (uint32_t i = 0; i < size; ++i) {
+            if (counts[i] >> 2 == 1) {
+                queue.push_back(i);
+            }
+        }
+        // peels slots with one key, which frees up the key's other slots
+        while (!queue.empty()) {
+            uint32_t i = queue.back();
+            queue.pop_back();
+            if (counts[i] >> 2 != 1) {
+                continue;
+            }
+            uint64_t h = xors[i];
+            order.emplace_back(h, counts[i] & 3);
+            auto positions = fuse_positions(h, segment_length, segment_count);
+            for (uint32_t j = 0; j < 3; ++j) {
+                counts[positions[j]] = (counts[positions[j]] - 4) ^ j;
+                xors[positions[j]] ^= h;
+                if (counts[positions[j]] >> 2 == 1) {
+                    queue.push_back(positions[j]);
+                }
+            }
+        }
+        if (order.size() == keys.size()) {
+            break;
+        }
+    }
+    // assigns in reverse peeling order, so that each key's slot is the last
+    // of its three to be set
+    for (auto [h, found] : std::views::reverse(order)) {
+        auto positions = fuse_positions(h, segment_length, segment_count);
+        uint8_t others = fingerprints[positions[(found + 1) % 3]] ^
+                         fingerprints[positions[(found + 2) % 3]];
+        fingerprints[positions[found]] = fuse_fingerprint(h) ^ others;
+    }
+
+    coding::put_fixed(out, seed);
+    coding::put_fixed(out, segment_length);
+    coding::put_fixed(out, segment_count);
+    auto *begin = reinterpret_cast<const std::byte *>(fingerprints.data());
+    out.insert(out.end(), begin, begin + fingerprints.size());
+}
 
-    std::size_t nblocks = bits_.num_blocks();
-    if (fwrite(&nblocks, sizeof(nblocks), 1, fp) != 1) {
-        throw std::runtime_error(
-            "BloomFilter::save: failed to write block count");
+auto BinaryFuseFilter::contains(std::string_view item) const -> bool {
+    if (fingerprints_.empty()) {
+        return false;
     }
+    uint64_t h = fuse_mix(hash(item) + seed_);
+    auto positions = fuse_positions(h, segment_length_, segment_count_);
+    return (fuse_fingerprint(h) ^ fingerprints_[positions[0]] ^
+            fingerprints_[positions[1]] ^ fingerprints_[positions[2]]) == 0;
+}
+
+auto BinaryFuseFilter::size() const -> size_t {
+    return fingerprints_.size();
+}
 
-    using block_type = typename boost::dynamic_bitset<>::block_type;
-    std::vector<block_type> blocks(nblocks);
-    boost::to_block_range(bits_, blocks.begin());
-    if (fwrite(blocks.data(), sizeof(block_type), nblocks, fp) != nblocks) {
-        throw std::runtime_error("BloomFilter::save: failed to write blocks");
+BloomFilterPolicy::BloomFilterPolicy(size_t bits_per_key)
+    : bits_per_key_(bits_per_key) {
+}
+
+auto BloomFilterPolicy::type() const -> FilterType {
+    return FilterType::bloom;
+}
+
+auto BloomFilterPolicy::build(std::span<const uint64_t> hashes,
+                              std::vector<std::byte> &out) const -> void {
+    BloomFilter filter(
+        {.num_keys = hashes.size(), .bits_per_key = bits_per_key_});
+    for (uint64_t h : hashes) {
+        filter.add_hash(h);
     }
-    return sizeof(size_) + sizeof(hash_count_) + sizeof(nblocks) +
-           nblocks * sizeof(block_type);
+    filter.save(out);
+}
+
+auto BinaryFuseFilterPolicy::type() const -> FilterType {
+    return FilterType::binary_fuse;
 }
 
-auto BloomFilter::hash(std::string_view item, std::size_t seed) const
-    -> size_t {
-    static std::hash<std::string_view> hasher;
-    auto h1 = hasher(item);
-    // 64-bit mix inspired by boost::hash_combine's magic constant
-    return h1 ^ (seed + 0x9e3779b97f4a7c15ULL + (h1 << 6) + (h1 >> 2));
+auto BinaryFuseFilterPolicy::build(std::span<const uint64_t> hashes,
+                                   std::vector<std::byte> &out) const
+    -> void {
+    BinaryFuseFilter::build(hashes, out);
 }
 
 }  // namespace filter
@@ -3,20 +3,22 @@
 #include <gtest/gtest.h>
 
 #include <cstdio>
+#include <format>
+#include <memory>
 #include <string>
 #include <vector>
 
 using namespace mousedb::filter;
 
 TEST(filter_BloomFilter, EmptyFilterContainsNothing) {
-    BloomFilter bf(1024, 3);
+    BloomFilter bf({.num_keys = 100});
     EXPECT_FALSE(bf.contains(""));
     EXPECT_FALSE(bf.contains("foo"));
     EXPECT_FALSE(bf.contains("bar"));
 }
 
 TEST(filter_BloomFilter, AddAndContainsSingleItem) {
-    BloomFilter bf(1024, 3);
+    BloomFilter bf({.num_keys = 100});
     const std::string item = "hello";
     EXPECT_FALSE(bf.contains(item));
     bf.add(item);
@@ -29,7 +31,7 @@ TEST(filter_BloomFilter, AddAndContainsSingleItem) {
 // still returns false.
 // -----------------------------------------------------------------------------
 TEST(filter_BloomFilter, AddMultipleItems) {
-    BloomFilter bf(2048, 5);
+    BloomFilter bf({.num_keys = 100});
     std::vector<std::string> items = {"alpha", "beta", "gamma", "delta",
                                       "epsilon"};
     for (const auto &s : items) {
@@ -43,7 +45,7 @@ TEST(filter_BloomFilter, AddMultipleItems) {
 }
 
 TEST(filter_BloomFilter, SaveAndLoadPreservesContents) {
-    BloomFilter bf1(4096, 4);
+    BloomFilter bf1({.num_keys = 100});
     std::vector<std::string> items = {"one", "two", "three"};
     for (const auto &s : items) {
         bf1.add(s);
@@ -64,8 +66,195 @@ TEST(filter_BloomFilter, SaveAndLoadPreservesContents) {
 }
 
 TEST(filter_BloomFilter, SupportsEmptyString) {
-    BloomFilter bf(128, 2);
+    BloomFilter bf({.num_keys = 16});
     EXPECT_FALSE(bf.contains(""));
     bf.add("");
     EXPECT_TRUE(bf.contains(""));
 }
+
+TEST(filter_BloomFilter, SizesFromBitsPerKey) {
+    BloomFilter bf({.num_keys = 1000, .bits_per_key = 10});
+    EXPECT_EQ(bf.num_lines(), (1000u * 10 + 511) / 512);
+    EXPECT_EQ(bf.num_probes(), 7u);
+    EXPECT_EQ(BloomFilter({.num_keys = 0}).num_lines(), 1u);
+}
+
+TEST(filter_BloomFilter, NoFalseNegatives) {
+    BloomFilter bf({.num_keys = 10000, .bits_per_key = 10});
+    for (int i = 0; i < 10000; ++i) {
+        bf.add(std::format("key{}", i));
+    }
+    for (int i = 0; i < 10000; ++i) {
+        ASSERT_TRUE(bf.contains(std::format("key{}", i))) << i;
+    }
+}
+
+static auto false_positive_rate(size_t bits_per_key) -> double {
+    constexpr int num_keys = 10000;
+    constexpr int num_probes = 100000;
+    BloomFilter bf({.num_keys = num_keys, .bits_per_key = bits_per_key});
+    for (int i = 0; i < num_keys; ++i) {
+        bf.add(std::format("key{}", i));
+    }
+    int false_positives = 0;
+    for (int i = 0; i < num_probes; ++i) {
+        false_positives += bf.contains(std::format("absent{}", i));
+    }
+    return static_cast<double>(false_positives) / num_probes;
+}
+
+TEST(filter_BloomFilter, FalsePositiveRateNearTarget) {
+    // an unblocked filter gets about 0.8% and 0.05%, and confining probes to
+    // a line costs a little on top of that, more so with more bits per key
+    EXPECT_LT(false_positive_rate(10), 0.015);
+    EXPECT_LT(false_positive_rate(16), 0.004);
+}
+
+TEST(filter_BloomFilter, FalsePositiveRateFallsWithBitsPerKey) {
+    double previous = 1;
+    for (size_t bits_per_key : {4, 8, 12}) {
+        double rate = false_positive_rate(bits_per_key);
+        EXPECT_LT(rate, previous) << bits_per_key;
+        previous = rate;
+    }
+}
+
+TEST(filter_BloomFilter, BatchMatchesSingleLookups) {
+    BloomFilter bf({.num_keys = 1000, .bits_per_key = 6});
+    for (int i = 0; i < 1000; ++i) {
+        bf.add(std::format("key{}", i));
+    }
+    std::vector<std::string> keys;
+    for (int i = 0; i < 4000; ++i) {
+        keys.push_back(std::format("key{}", i));
+    }
+    std::vector<std::string_view> items(keys.begin(), keys.end());
+    auto results = std::make_unique<bool[]>(items.size());
+    bf.contains(items, {results.get(), items.size()});
+    for (size_t i = 0; i < items.size(); ++i) {
+        EXPECT_EQ(results[i], bf.contains(items[i])) << items[i];
+    }
+}
+
+TEST(filter_BloomFilter, BatchSupportsManyProbes) {
+    BloomFilter bf({.num_keys = 100, .bits_per_key = 20});
+    ASSERT_GT(bf.num_probes(), 8u);
+    bf.add("present");
+    std::string_view items[] = {"present", "absent"};
+    bool results[2];
+    bf.contains(items, results);
+    EXPECT_TRUE(results[0]);
+    EXPECT_EQ(results[1], bf.contains("absent"));
+}
+
+TEST(filter_BloomFilter, ReadsSavedFilterInPlace) {
+    BloomFilter bf1({.num_keys = 1000, .bits_per_key = 10});
+    for (int i = 0; i < 1000; ++i) {
+        bf1.add(std::format("key{}", i));
+    }
+    FILE *fp = std::tmpfile();
+    ASSERT_NE(fp, nullptr);
+    size_t size = bf1.save(fp);
+    std::rewind(fp);
+
+    // places the lines on a line boundary
+    struct alignas(BloomFilter::LINE_SIZE) Line {
+        std::byte bytes[BloomFilter::LINE_SIZE];
+    };
+    auto buffer = std::make_unique<Line[]>(size / sizeof(Line) + 2);
+    auto *data = reinterpret_cast<std::byte *>(buffer.get()) + sizeof(Line) -
+                 BloomFilter::HEADER_SIZE;
+    ASSERT_EQ(std::fread(data, 1, size, fp), size);
+    std::fclose(fp);
+    BloomFilter in_place(std::span<const std::byte>(data, size));
+    // misaligned lines are copied instead
+    std::vector<std::byte> misaligned(size + 1);
+    std::copy_n(data, size, misaligned.begin() + 1);
+    BloomFilter copied(std::span<const std::byte>(misaligned).subspan(1));
+
+    EXPECT_EQ(in_place.num_lines(), bf1.num_lines());
+    EXPECT_EQ(in_place.num_probes(), bf1.num_probes());
+    for (int i = 0; i < 2000; ++i) {
+        auto key = std::format("key{}", i);
+        EXPECT_EQ(in_place.contains(key), bf1.contains(key)) << key;
+        EXPECT_EQ(copied.contains(key), bf1.contains(key)) << key;
+    }
+    EXPECT_THROW(in_place.add("key"), std::runtime_error);
+    EXPECT_THROW(
+        BloomFilter(std::span<const std::byte>(data, size - 1)),
+        std::runtime_error);
+}
+
+static auto key_hashes(std::string_view prefix, size_t count)
+    -> std::vector<uint64_t> {
+    std::vector<uint64_t> hashes;
+    for (size_t i = 0; i < count; ++i) {
+        hashes.push_back(hash(std::format("{}{}", prefix, i)));
+    }
+    return hashes;
+}
+
+TEST(filter_BinaryFuseFilter, NoFalseNegatives) {
+    for (size_t count : {1, 2, 3, 10, 100, 1000, 100000}) {
+        std::vector<std::byte> data;
+        BinaryFuseFilter::build(key_hashes("key", count), data);
+        BinaryFuseFilter bf(data);
+        for (size_t i = 0; i < count; ++i) {
+            ASSERT_TRUE(bf.contains(std::format("key{}", i)))
+                << count << " " << i;
+        }
+    }
+}
+
+TEST(filter_BinaryFuseFilter, EmptyFilterContainsNothing) {
+    std::vector<std::byte> data;
+    BinaryFuseFilter::build({}, data);
+    BinaryFuseFilter bf(data);
+    EXPECT_EQ(bf.size(), 0u);
+    EXPECT_FALSE(bf.contains(""));
+    EXPECT_FALSE(bf.contains("foo"));
+}
+
+TEST(filter_BinaryFuseFilter, SurvivesDuplicateHashes) {
+    auto hashes = key_hashes("key", 100);
+    hashes.insert(hashes.end(), hashes.begin(), hashes.begin() + 10);
+    std::vector<std::byte> data;
+    BinaryFuseFilter::build(hashes, data);
+    BinaryFuseFilter bf(data);
+    for (int i = 0; i < 100; ++i) {
+        EXPECT_TRUE(bf.contains(std::format("key{}", i)));
+    }
+}
+
+TEST(filter_BinaryFuseFilter, SmallerThanBloomAtLowerRate) {
+    constexpr size_t num_keys = 100000;
+    constexpr int num_probes = 100000;
+    std::vector<std::byte> fuse_data, bloom_data;
+    BinaryFuseFilterPolicy().build(key_hashes("key", num_keys), fuse_data);
+    BloomFilterPolicy(10).build(key_hashes("key", num_keys), bloom_data);
+    auto fuse = read(FilterType::binary_fuse, fuse_data);
+    auto bloom = read(FilterType::bloom, bloom_data);
+
+    int fuse_false_positives = 0;
+    int bloom_false_positives = 0;
+    for (int i = 0; i < num_probes; ++i) {
+        auto key = std::format("absent{}", i);
+        fuse_false_positives += fuse->contains(key);
+        bloom_false_positives += bloom->contains(key);
+    }
+    // 8-bit fingerprints give 1/256, or about 0.4%
+    EXPECT_LT(static_cast<double>(fuse_false_positives) / num_probes, 0.006);
+    EXPECT_LT(fuse_false_positives, bloom_false_positives);
+    EXPECT_LT(fuse_data.size() * 8.0 / num_keys, 10);
+    EXPECT_LT(fuse_data.size() * 1.0, bloom_data.size() * 0.95);
+}
+
+TEST(filter_BinaryFuseFilter, RejectsCorruptData) {
+    std::vector<std::byte> data;
+    BinaryFuseFilter::build(key_hashes("key", 100), data);
+    EXPECT_THROW(BinaryFuseFilter(std::span(data).first(data.size() - 1)),
+                 std::runtime_error);
+    EXPECT_THROW(BinaryFuseFilter(std::span(data).first(4)),
+                 std::runtime_error);
+    EXPECT_THROW(read(static_cast<FilterType>(99), data), std::runtime_error);
+}
@@ -0,0 +1,233 @@
+#include "iterator.hpp"
+
+#include <algorithm>
+
+namespace mousedb {
+namespace iterator {
+
+MemTableIterator::MemTableIterator(
+    std::shared_ptr<const memtable::MemTable<memtable::KVSkipList>> memtable)
+    : memtable_(std::move(memtable)), it_(memtable_->end()) {
+}
+
+auto MemTableIterator::valid() const -> bool {
+    return it_ != memtable_->end();
+}
+
+auto MemTableIterator::seek_to_first() -> void {
+    it_ = memtable_->begin();
+}
+
+auto MemTableIterator::seek_to_last() -> void {
+    it_ = memtable_->before(memtable_->end());
+}
+
+auto MemTableIterator::seek(std::string_view key) -> void {
+    it_ = memtable_->lower_bound(key);
+}
+
+auto MemTableIterator::next() -> void {
+    ++it_;
+}
+
+auto MemTableIterator::prev() -> void {
+    it_ = memtable_->before(it_);
+}
+
+auto MemTableIterator::key() const -> std::string_view {
+    auto key = memtable::KVStore::get_key(*it_);
+    return {reinterpret_cast<const char *>(key.data()), key.size()};
+}
+
+auto MemTableIterator::value() const -> std::string_view {
+    auto value = memtable::KVStore::get_value(*it_);
+    return {reinterpret_cast<const char *>(value.data()), value.size()};
+}
+
+TableIterator::TableIterator(std::shared_ptr<const sstable::SSTable> table)
+    : table_(std::move(table)), it_(*table_) {
+}
+
+auto TableIterator::valid() const -> bool {
+    return it_.valid();
+}
+
+auto TableIterator::seek_to_first() -> void {
+    it_.seek_to_first();
+}
+
+auto TableIterator::seek_to_last() -> void {
+    it_.seek_to_last();
+}
+
+auto TableIterator::seek(std::string_view key) -> void {
+    it_.seek(key);
+}
+
+auto TableIterator::next() -> void {
+    it_.next();
+}
+
+auto TableIterator::prev() -> void {
+    it_.prev();
+}
+
+auto TableIterator::key() const -> std::string_view {
+    return it_.key();
+}
+
+auto TableIterator::value() const -> std::string_view {
+    return it_.value();
+}
+
+LevelIterator::LevelIterator(std::vector<std::string> largest, Open open)
+    : largest_(std::move(largest)),
+      open_(std::move(open)),
+      tables_(largest_.size()) {
+}
+
+auto LevelIterator::valid() const -> bool {
+    return it_.has_value() && it_->valid();
+}
+
+auto LevelIterator::seek_to_first() -> void {
+    if (largest_.empty()) {
+        return;
+    }
+    move_to(0);
+    it_->seek_to_first();
+    skip_empty_tables();
+}
+
+auto LevelIterator::seek_to_last() -> void {
+    if (largest_.empty()) {
+        return;
+    }
+    move_to(largest_.size() - 1);
+    it_->seek_to_last();
+    skip_empty_tables_backward();
+}
+
+auto LevelIterator::seek(std::string_view key) -> void {
+    // the only table that may hold key is the first that ends at or after it
+    size_t index = std::ranges::lower_bound(largest_, key) - largest_.begin();
+    if (index == largest_.size()) {
+        it_.reset();
+        return;
+    }
+    move_to(index);
+    it_->seek(key);
+    skip_empty_tables();
+}
+
+auto LevelIterator::next() -> void {
+    it_->next();
+    skip_empty_tables();
+}
+
+auto LevelIterator::prev() -> void {
+    it_->prev();
+    skip_empty_tables_backward();
+}
+
+auto LevelIterator::key() const -> std::string_view {
+    return it_->key();
+}
+
+auto LevelIterator::value() const -> std::string_view {
+    return it_->value();
+}
+
+auto LevelIterator::move_to(size_t index) -> void {
+    if (it_.has_value() && index_ == index) {
+        return;
+    }
+    auto &table = tables_[index];
+    if (table == nullptr) {
+        table = open_(index);
+    }
+    index_ = index;
+    it_.emplace(*table);
+}
+
+auto LevelIterator::skip_empty_tables() -> void {
+    while (!it_->valid() && index_ + 1 < largest_.size()) {
+        move_to(index_ + 1);
+        it_->seek_to_first();
+    }
+}
+
+auto LevelIterator::skip_empty_tables_backward() -> void {
+    while (!it_->valid() && index_ > 0) {
+        move_to(index_ - 1);
+        it_->seek_to_last();
+    }
+}
+
+MergingIterator::MergingIterator(
+    std::vector<std::unique_ptr<Iterator>> children)
+    : children_(std::move(children)) {
+    heap_.reserve(children_.size());
+}
+
+auto MergingIterator::valid() const -> bool {
+    return !heap_.empty();
+}
+
+auto MergingIterator::seek_to_first() -> void {
+    for (auto &child : children_) {
+        child->seek_to_first();
+    }
+    build_heap();
+}
+
+auto MergingIterator::seek(std::string_view key) -> void {
+    for (auto &child : children_) {
+        child->seek(key);
+    }
+    build_heap();
+}
+
+auto MergingIterator::next() -> void {
+    auto greater = [this](size_t a, size_t b) { return this->greater(a, b); };
+    std::ranges::pop_heap(heap_, greater);
+    auto &child = children_[heap_.back()];
+    child->next();
+    if (child->valid()) {
+        std::ranges::push_heap(heap_, greater);
+    } else {
+        heap_.pop_back();
+    }
+}
+
+auto MergingIterator::key() const -> std::string_view {
+    return children_[heap_.front()]->key();
+}
+
+auto MergingIterator::value() const -> std::string_view {
+    return children_[heap_.front()]->value();
+}
+
+auto MergingIterator::build_heap() -> void {
+    heap_.clear();
+    for (size_t i = 0; i < children_.size(); ++i) {
+        if (children_[i]->valid()) {
+            heap_.push_back(i);
+        }
+    }
+    std::ranges::make_heap(
+        heap_, [this](size_t a, size_t b) { return greater(a, b); });
+}
+
+auto MergingIterator::greater(size_t a, size_t b) const -> bool {
+    const auto &child_a = children_[a];
+    const auto &child_b = children_[b];
+    int cmp = child_a->key().compare(child_b->key());
+    if (cmp != 0) {
+        return cmp > 0;
+    }
+    return child_a->value() > child_b->value();
+}
+
+}  // namespace iterator
+}  // namespace mousedb
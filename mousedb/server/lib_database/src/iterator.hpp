@@ -0,0 +1,154 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "memtable.hpp"
+#include "sstable.hpp"
+
+namespace mousedb {
+namespace iterator {
+// Iterates over sorted KV pairs, where a key may have many values, so that
+// memtables and tables can be merged together.
+class Iterator {
+   public:
+    virtual ~Iterator() = default;
+
+    virtual auto valid() const -> bool = 0;
+    virtual auto seek_to_first() -> void = 0;
+    virtual auto seek_to_last() -> void = 0;
+    // Moves to the first entry whose key is not less than key.
+    virtual auto seek(std::string_view key) -> void = 0;
+    virtual auto next() -> void = 0;
+    virtual auto prev() -> void = 0;
+
+    // The key stays valid until the iterator moves, and the value for as long
+    // as the iterator does.
+    virtual auto key() const -> std::string_view = 0;
+    virtual auto value() const -> std::string_view = 0;
+};
+
+// Iterates over a memtable, which it keeps alive. Pairs inserted while it is
+// in use may or may not be seen.
+class MemTableIterator : public Iterator {
+   public:
+    explicit MemTableIterator(
+        std::shared_ptr<const memtable::MemTable<memtable::KVSkipList>>
+            memtable);
+
+    auto valid() const -> bool override;
+    auto seek_to_first() -> void override;
+    auto seek_to_last() -> void override;
+    auto seek(std::string_view key) -> void override;
+    auto next() -> void override;
+    auto prev() -> void override;
+
+    auto key() const -> std::string_view override;
+    auto value() const -> std::string_view override;
+
+   private:
+    const std::shared_ptr<const memtable::MemTable<memtable::KVSkipList>>
+        memtable_;
+    memtable::KVSkipList::Iterator it_;
+};
+
+// Iterates over a table, which it keeps alive.
+class TableIterator : public Iterator {
+   public:
+    explicit TableIterator(std::shared_ptr<const sstable::SSTable> table);
+
+    auto valid() const -> bool override;
+    auto seek_to_first() -> void override;
+    auto seek_to_last() -> void override;
+    auto seek(std::string_view key) -> void override;
+    auto next() -> void override;
+    auto prev() -> void override;
+
+    auto key() const -> std::string_view override;
+    auto value() const -> std::string_view override;
+
+   private:
+    const std::shared_ptr<const sstable::SSTable> table_;
+    sstable::SSTable::Iterator it_;
+};
+
+// Iterates over tables that are sorted by key and do not overlap, such as the
+// tables of a level below level 0, as if they were one. A table is opened
+// through open only once the iterator reaches it, and is then kept so that
+// its values stay valid for as long as the iterator does.
+// Example:
+//    LevelIterator it(largest_keys,
+//                     [&](size_t i) { return tables.get(ids[i]); });
+//    it.seek("key");
+class LevelIterator : public Iterator {
+   public:
+    using Open =
+        std::function<std::shared_ptr<const sstable::SSTable>(size_t index)>;
+
+    // largest holds the largest key of each table, in order.
+    LevelIterator(std::vector<std::string> largest, Open open);
+
+    auto valid() const -> bool override;
+    auto seek_to_first() -> void override;
+    auto seek_to_last() -> void override;
+    auto seek(std::string_view key) -> void override;
+    auto next() -> void override;
+    auto prev() -> void override;
+
+    auto key() const -> std::string_view override;
+    auto value() const -> std::string_view override;
+
+   private:
+    const std::vector<std::string> largest_;
+    const Open open_;
+    // Null until opened.
+    std::vector<std::shared_ptr<const sstable::SSTable>> tables_;
+    size_t index_ = 0;
+    // Over the table at index_, unless the iterator is unpositioned.
+    std::optional<sstable::SSTable::Iterator> it_;
+
+    auto move_to(size_t index) -> void;
+    // Moves past exhausted tables.
+    auto skip_empty_tables() -> void;
+    auto skip_empty_tables_backward() -> void;
+};
+
+// Merges children into one forward iterator, ordered by key and then by
+// value, so that exact duplicates across children come out back to back. The
+// children are kept in a heap by their current entries, so each step costs
+// O(log n) comparisons for n children.
+// Example:
+//    MergingIterator it(std::move(children));
+//    for (it.seek_to_first(); it.valid(); it.next()) {
+//        builder.add(it.key(), it.value());
+//    }
+class MergingIterator {
+   public:
+    explicit MergingIterator(std::vector<std::unique_ptr<Iterator>> children);
+
+    auto valid() const -> bool;
+    auto seek_to_first() -> void;
+    // Moves to the first entry whose key is not less than key.
+    auto seek(std::string_view key) -> void;
+    auto next() -> void;
+
+    // Follow the lifetimes of the current child's key and value.
+    auto key() const -> std::string_view;
+    auto value() const -> std::string_view;
+
+   private:
+    std::vector<std::unique_ptr<Iterator>> children_;
+    // Indexes of the valid children, as a heap with the least entry first.
+    std::vector<size_t> heap_;
+
+    auto build_heap() -> void;
+    // Orders children by their current entries, as std::push_heap expects.
+    auto greater(size_t a, size_t b) const -> bool;
+};
+
+}  // namespace iterator
+}  // namespace mousedb
@@ -0,0 +1,115 @@
+#include "iterator.hpp"
+
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <format>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace mousedb::iterator;
+using mousedb::memtable::KVSkipList;
+using mousedb::memtable::MemTable;
+using mousedb::sstable::SSTable;
+using mousedb::sstable::SSTableBuilder;
+
+TEST(iterator_MergingIterator, MergesInKeyThenValueOrder) {
+    auto a = std::make_shared<MemTable<KVSkipList>>();
+    auto b = std::make_shared<MemTable<KVSkipList>>();
+    auto c = std::make_shared<MemTable<KVSkipList>>();
+    for (int i = 0; i < 100; ++i) {
+        auto key = std::format("{:03}", i);
+        (i % 2 == 0 ? a : b)->insert(key, "1");
+        if (i % 10 == 0) {
+            c->insert(key, "0");
+            c->insert(key, "2");
+        }
+    }
+
+    std::vector<std::unique_ptr<Iterator>> children;
+    for (const auto &memtable : {a, b, c}) {
+        children.push_back(std::make_unique<MemTableIterator>(memtable));
+    }
+    MergingIterator it(std::move(children));
+    std::vector<std::pair<std::string, std::string>> expected;
+    for (int i = 0; i < 100; ++i) {
+        auto key = std::format("{:03}", i);
+        if (i % 10 == 0) {
+            expected.emplace_back(key, "0");
+        }
+        expected.emplace_back(key, "1");
+        if (i % 10 == 0) {
+            expected.emplace_back(key, "2");
+        }
+    }
+    std::vector<std::pair<std::string, std::string>> merged;
+    for (it.seek_to_first(); it.valid(); it.next()) {
+        merged.emplace_back(it.key(), it.value());
+    }
+    EXPECT_EQ(merged, expected);
+
+    it.seek("100");
+    EXPECT_FALSE(it.valid());
+    it.seek("049");
+    ASSERT_TRUE(it.valid());
+    EXPECT_EQ(it.key(), "049");
+    it.next();
+    ASSERT_TRUE(it.valid());
+    EXPECT_EQ(it.key(), "050");
+    EXPECT_EQ(it.value(), "0");
+}
+
+TEST(iterator_MergingIterator, NoChildren) {
+    MergingIterator it({});
+    it.seek_to_first();
+    EXPECT_FALSE(it.valid());
+}
+
+TEST(iterator_LevelIterator, OpensTablesAsItReachesThem) {
+    auto dir = std::filesystem::temp_directory_path() / "mousedb_level_it";
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+    // three tables of ten keys each, and an empty one in between
+    std::vector<std::string> largest;
+    for (int t = 0; t < 4; ++t) {
+        SSTableBuilder builder(dir / std::format("{}.sst", t), 10, 256);
+        int first = t < 2 ? t * 10 : (t - 1) * 10;
+        if (t != 2) {
+            for (int i = first; i < first + 10; ++i) {
+                builder.add(std::format("{:03}", i), "v");
+            }
+        }
+        builder.finish();
+        largest.push_back(std::format("{:03}", t == 2 ? 19 : first + 9));
+    }
+    std::vector<int> opened;
+    LevelIterator it(largest, [&](size_t i) {
+        opened.push_back(static_cast<int>(i));
+        return std::make_shared<const SSTable>(dir / std::format("{}.sst", i));
+    });
+
+    it.seek("015");
+    ASSERT_TRUE(it.valid());
+    EXPECT_EQ(it.key(), "015");
+    EXPECT_EQ(opened, (std::vector<int>{1}));
+
+    std::vector<std::string> keys;
+    for (it.seek_to_first(); it.valid(); it.next()) {
+        keys.emplace_back(it.key());
+    }
+    ASSERT_EQ(keys.size(), 30u);
+    EXPECT_EQ(keys.front(), "000");
+    EXPECT_EQ(keys.back(), "029");
+    // each table is opened once, however often the iterator comes back to it
+    EXPECT_EQ(opened, (std::vector<int>{1, 0, 2, 3}));
+
+    size_t count = 0;
+    for (it.seek_to_last(); it.valid(); it.prev()) {
+        ++count;
+    }
+    EXPECT_EQ(count, 30u);
+    it.seek("030");
+    EXPECT_FALSE(it.valid());
+    std::filesystem::remove_all(dir);
+}
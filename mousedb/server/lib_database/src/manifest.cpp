@@ -0,0 +1,368 @@
+#include "manifest.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <charconv>
+#include <format>
+#include <stdexcept>
+#include <unordered_set>
+#include <utility>
+
+#include "coding.hpp"
+#include "crc32c.hpp"
+
+namespace mousedb {
+namespace manifest {
+
+namespace {
+// the size and the masked CRC32C of the edit
+constexpr size_t HEADER_SIZE = 2 * sizeof(uint32_t);
+
+enum class Tag : uint64_t {
+    next_table_id = 1,
+    last_sequence = 2,
+    removed = 3,
+    added = 4,
+};
+
+// Reads the fields of an edit, throwing instead of reading past the end.
+class Reader {
+   public:
+    explicit Reader(std::span<const std::byte> data) : data_(data) {}
+
+    auto done() const -> bool {
+        return offset_ == data_.size();
+    }
+
+    auto varint() -> uint64_t {
+        uint64_t value = 0;
+        for (size_t shift = 0; shift < 64; shift += 7) {
+            if (offset_ == data_.size()) {
+                break;
+            }
+            auto byte = static_cast<uint64_t>(data_[offset_++]);
+            value |= (byte & 0x7F) << shift;
+            if ((byte & 0x80) == 0) {
+                return value;
+            }
+        }
+        throw std::runtime_error("Truncated varint in version edit");
+    }
+
+    auto bytes() -> std::string {
+        uint64_t size = varint();
+        if (size > data_.size() - offset_) {
+            throw std::runtime_error("Truncated key in version edit");
+        }
+        std::string value(reinterpret_cast<const char *>(&data_[offset_]),
+                          size);
+        offset_ += size;
+        return value;
+    }
+
+   private:
+    std::span<const std::byte> data_;
+    size_t offset_ = 0;
+};
+
+auto put_bytes(std::vector<std::byte> &buffer, std::string_view value)
+    -> void {
+    coding::put_varint(buffer, value.size());
+    auto data = std::as_bytes(std::span(value));
+    buffer.insert(buffer.end(), data.begin(), data.end());
+}
+
+auto put_tag(std::vector<std::byte> &buffer, Tag tag) -> void {
+    coding::put_varint(buffer, static_cast<uint64_t>(tag));
+}
+
+auto sync(FILE *file, const std::filesystem::path &path) -> void {
+    if (fflush(file) != 0 || fsync(fileno(file)) != 0) {
+        throw std::runtime_error(
+            std::format("Failed to sync {}", path.c_str()));
+    }
+}
+
+// makes renames and new files in dir durable
+auto sync_dir(const std::filesystem::path &dir) -> void {
+    int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd < 0) {
+        throw std::runtime_error(std::format("Failed to open {}", dir.c_str()));
+    }
+    int result = fsync(fd);
+    close(fd);
+    if (result != 0) {
+        throw std::runtime_error(std::format("Failed to sync {}", dir.c_str()));
+    }
+}
+
+auto read_file(const std::filesystem::path &path) -> std::vector<std::byte> {
+    FILE *file = fopen(path.c_str(), "rb");
+    if (!file) {
+        throw std::runtime_error(
+            std::format("Failed to open {}", path.c_str()));
+    }
+    std::vector<std::byte> data(std::filesystem::file_size(path));
+    size_t size = fread(data.data(), 1, data.size(), file);
+    fclose(file);
+    if (size != data.size()) {
+        throw std::runtime_error(
+            std::format("Failed to read {}", path.c_str()));
+    }
+    return data;
+}
+}  // namespace
+
+auto VersionEdit::encode() const -> std::vector<std::byte> {
+    std::vector<std::byte> buffer;
+    if (next_table_id.has_value()) {
+        put_tag(buffer, Tag::next_table_id);
+        coding::put_varint(buffer, *next_table_id);
+    }
+    if (last_sequence.has_value()) {
+        put_tag(buffer, Tag::last_sequence);
+        coding::put_varint(buffer, *last_sequence);
+    }
+    for (uint64_t id : removed) {
+        put_tag(buffer, Tag::removed);
+        coding::put_varint(buffer, id);
+    }
+    for (const auto &table : added) {
+        put_tag(buffer, Tag::added);
+        coding::put_varint(buffer, table.level);
+        coding::put_varint(buffer, table.id);
+        coding::put_varint(buffer, table.file_size);
+        put_bytes(buffer, table.smallest);
+        put_bytes(buffer, table.largest);
+    }
+    return buffer;
+}
+
+auto VersionEdit::decode(std::span<const std::byte> data) -> VersionEdit {
+    VersionEdit edit;
+    Reader reader(data);
+    while (!reader.done()) {
+        uint64_t tag = reader.varint();
+        switch (static_cast<Tag>(tag)) {
+            case Tag::next_table_id:
+                edit.next_table_id = reader.varint();
+                break;
+            case Tag::last_sequence:
+                edit.last_sequence = reader.varint();
+                break;
+            case Tag::removed:
+                edit.removed.push_back(reader.varint());
+                break;
+            case Tag::added: {
+                TableEntry table;
+                table.level = reader.varint();
+                table.id = reader.varint();
+                table.file_size = reader.varint();
+                table.smallest = reader.bytes();
+                table.largest = reader.bytes();
+                edit.added.push_back(std::move(table));
+                break;
+            }
+            default:
+                throw std::runtime_error(
+                    std::format("Unknown tag {} in version edit", tag));
+        }
+    }
+    return edit;
+}
+
+auto Version::apply(const VersionEdit &edit) -> void {
+    if (edit.next_table_id.has_value()) {
+        next_table_id = *edit.next_table_id;
+    }
+    if (edit.last_sequence.has_value()) {
+        last_sequence = *edit.last_sequence;
+    }
+    std::unordered_set<uint64_t> dropped(edit.removed.begin(),
+                                         edit.removed.end());
+    for (const auto &table : edit.added) {
+        dropped.insert(table.id);
+    }
+    std::erase_if(tables, [&](const TableEntry &table) {
+        return dropped.contains(table.id);
+    });
+    tables.insert(tables.end(), edit.added.begin(), edit.added.end());
+}
+
+Manifest::Manifest(const std::filesystem::path &dir, size_t max_file_size)
+    : dir_(dir), max_file_size_(max_file_size) {
+    recover();
+    rotate();
+}
+
+Manifest::~Manifest() {
+    if (file_) {
+        fclose(file_);
+    }
+}
+
+auto Manifest::apply(const VersionEdit &edit) -> void {
+    if (file_size_ >= max_file_size_) {
+        rotate();
+    }
+    append(edit, path(number_));
+    version_.apply(edit);
+}
+
+auto Manifest::version() const -> const Version & {
+    return version_;
+}
+
+auto Manifest::number() const -> uint64_t {
+    return number_;
+}
+
+auto Manifest::file_size() const -> size_t {
+    return file_size_;
+}
+
+auto Manifest::path(uint64_t number) const -> std::filesystem::path {
+    return dir_ / std::format("{}{}", MANIFEST_PREFIX, number);
+}
+
+auto Manifest::recover() -> void {
+    auto current_path = dir_ / MANIFEST_CURRENT;
+    if (!std::filesystem::exists(current_path)) {
+        return;
+    }
+    auto current = read_file(current_path);
+    std::string_view name(reinterpret_cast<const char *>(current.data()),
+                          current.size());
+    if (name.ends_with('\n')) {
+        name.remove_suffix(1);
+    }
+    if (!name.starts_with(MANIFEST_PREFIX) ||
+        std::from_chars(name.data() + MANIFEST_PREFIX.size(),
+                        name.data() + name.size(), number_)
+                .ptr != name.data() + name.size()) {
+        throw std::runtime_error(
+            std::format("Malformed {}", current_path.c_str()));
+    }
+
+    auto data = read_file(path(number_));
+    size_t offset = 0;
+    while (data.size() - offset >= HEADER_SIZE) {
+        auto size = coding::decode_fixed<uint32_t>(data.data() + offset);
+        if (size > data.size() - offset - HEADER_SIZE) {
+            // cut short by a crash while it was being logged
+            break;
+        }
+        auto crc = crc32c::unmask(coding::decode_fixed<uint32_t>(
+            data.data() + offset + sizeof(uint32_t)));
+        std::span<const std::byte> payload(data.data() + offset + HEADER_SIZE,
+                                           size);
+        if (crc32c::value(payload) != crc) {
+            if (offset + HEADER_SIZE + size == data.size()) {
+                // the last record, whose payload a crash left unwritten
+                break;
+            }
+            throw std::runtime_error(std::format(
+                "Corrupt record at {} in {}", offset, path(number_).c_str()));
+        }
+        version_.apply(VersionEdit::decode(payload));
+        offset += HEADER_SIZE + size;
+    }
+}
+
+auto Manifest::rotate() -> void {
+    uint64_t number = number_ + 1;
+    auto new_path = path(number);
+    FILE *file = fopen(new_path.c_str(), "wb");
+    if (!file) {
+        throw std::runtime_error(
+            std::format("Failed to create {}", new_path.c_str()));
+    }
+    std::swap(file, file_);
+    size_t file_size = std::exchange(file_size_, 0);
+    try {
+        append({.next_table_id = version_.next_table_id,
+                .last_sequence = version_.last_sequence,
+                .added = version_.tables},
+               new_path);
+
+        // switches CURRENT atomically through a rename
+        auto current_path = dir_ / MANIFEST_CURRENT;
+        auto temp_path = dir_ / std::format("{}.tmp", MANIFEST_CURRENT);
+        FILE *current = fopen(temp_path.c_str(), "wb");
+        if (!current) {
+            throw std::runtime_error(
+                std::format("Failed to create {}", temp_path.c_str()));
+        }
+        auto name = std::format("{}{}\n", MANIFEST_PREFIX, number);
+        bool written =
+            fwrite(name.data(), 1, name.size(), current) == name.size();
+        try {
+            if (!written) {
+                throw std::runtime_error(
+                    std::format("Failed to write {}", temp_path.c_str()));
+            }
+            sync(current, temp_path);
+        } catch (...) {
+            fclose(current);
+            throw;
+        }
+        fclose(current);
+        std::filesystem::rename(temp_path, current_path);
+        sync_dir(dir_);
+    } catch (...) {
+        // keeps logging to the old manifest, which CURRENT still names
+        if (file_) {
+            fclose(file_);
+        }
+        file_ = file;
+        file_size_ = file_size;
+        std::filesystem::remove(new_path);
+        throw;
+    }
+    if (file) {
+        fclose(file);
+    }
+    std::filesystem::remove(path(number_));
+    number_ = number;
+}
+
+auto Manifest::append(const VersionEdit &edit,
+                      const std::filesystem::path &path) -> void {
+    if (!file_) {
+        throw std::runtime_error(
+            std::format("Failed to reopen {}", path.c_str()));
+    }
+    auto payload = edit.encode();
+    std::vector<std::byte> record;
+    record.reserve(HEADER_SIZE + payload.size());
+    coding::put_fixed(record, static_cast<uint32_t>(payload.size()));
+    coding::put_fixed(record, crc32c::mask(crc32c::value(payload)));
+    record.insert(record.end(), payload.begin(), payload.end());
+    try {
+        if (fwrite(record.data(), 1, record.size(), file_) != record.size()) {
+            throw std::runtime_error(
+                std::format("Failed to write {}", path.c_str()));
+        }
+        sync(file_, path);
+    } catch (...) {
+        truncate(path);
+        throw;
+    }
+    file_size_ += record.size();
+}
+
+auto Manifest::truncate(const std::filesystem::path &path) -> void {
+    // reopens the file, since the stream may still buffer part of the record
+    fclose(file_);
+    file_ = nullptr;
+    std::error_code error;
+    std::filesystem::resize_file(path, file_size_, error);
+    if (!error) {
+        file_ = fopen(path.c_str(), "ab");
+    }
+}
+
+}  // namespace manifest
+}  // namespace mousedb
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <stdio.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace mousedb {
+namespace manifest {
+
+constexpr std::string_view MANIFEST_CURRENT = "CURRENT";
+constexpr std::string_view MANIFEST_PREFIX = "MANIFEST-";
+
+// An SSTable in a level, with the range of its keys.
+struct TableEntry {
+    size_t level;
+    uint64_t id;
+    std::string smallest;
+    std::string largest;
+    size_t file_size;
+};
+
+// A change to the tables of a database. Added tables that already exist are
+// moved to their new level, after the removed tables are dropped.
+struct VersionEdit {
+    std::optional<uint64_t> next_table_id = std::nullopt;
+    std::optional<uint64_t> last_sequence = std::nullopt;
+    std::vector<uint64_t> removed = {};
+    std::vector<TableEntry> added = {};
+
+    // Each field is a varint tag followed by its varints and length-prefixed
+    // keys, so that missing fields take no space.
+    auto encode() const -> std::vector<std::byte>;
+    // Throws if data is not an encoded edit.
+    static auto decode(std::span<const std::byte> data) -> VersionEdit;
+};
+
+// The tables of a database and the counters it must not reuse.
+struct Version {
+    uint64_t next_table_id = 0;
+    uint64_t last_sequence = 0;
+    // In the order that they were last added, which is oldest to newest
+    // within level 0.
+    std::vector<TableEntry> tables;
+
+    auto apply(const VersionEdit &edit) -> void;
+};
+
+// Logs version edits to an append-only file in dir, so that opening a
+// database replays a log of edits instead of rebuilding its tables from the
+// files. Each record is
+//    [size][masked CRC32C of edit][edit]
+// and is synced before apply returns. A record cut short by a crash was never
+// applied, so it is ignored, as is a last record that fails its checksum.
+// One that fails it earlier in the log is corruption. CURRENT names the live
+// manifest. Once the log reaches max_file_size, it is rewritten as one edit
+// holding the whole version into a new manifest, which CURRENT is then
+// atomically switched to.
+// Example:
+//    Manifest manifest("data", 1 << 20);  // replays data/CURRENT if any
+//    manifest.apply({.added = {{0, 1, "a", "z", 4096}}});
+class Manifest {
+   public:
+    // Replays the manifest that CURRENT points to, unless there is none, and
+    // starts a new one holding the result. Throws if the manifest is
+    // corrupt.
+    Manifest(const std::filesystem::path &dir, size_t max_file_size);
+    ~Manifest();
+    Manifest(const Manifest &) = delete;
+    Manifest &operator=(const Manifest &) = delete;
+
+    // Logs edit durably and then applies it. Throws if it cannot be logged,
+    // in which case the version is unchanged.
+    auto apply(const VersionEdit &edit) -> void;
+
+    auto version() const -> const Version &;
+    // The number in the name of the live manifest.
+    auto number() const -> uint64_t;
+    // In bytes, the size of the live manifest.
+    auto file_size() const -> size_t;
+
+   private:
+    const std::filesystem::path dir_;
+    const size_t max_file_size_;
+    Version version_;
+    uint64_t number_ = 0;
+    FILE *file_ = nullptr;
+    size_t file_size_ = 0;
+
+    auto path(uint64_t number) const -> std::filesystem::path;
+    auto recover() -> void;
+    // Writes the version into a new manifest and points CURRENT at it.
+    auto rotate() -> void;
+    // Logs edit to the manifest at path, which file_ is open on. If that
+    // fails, the file is cut back to its last whole record.
+    auto append(const VersionEdit &edit, const std::filesystem::path &path)
+        -> void;
+    // Leaves file_ null if the file cannot be cut back and reopened, which
+    // fails later appends.
+    auto truncate(const std::filesystem::path &path) -> void;
+};
+
+}  // namespace manifest
+}  // namespace mousedb
@@ -0,0 +1,183 @@
+#include "manifest.hpp"
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <filesystem>
+#include <format>
+
+using namespace mousedb::manifest;
+
+namespace fs = std::filesystem;
+
+static auto make_dir(std::string_view name) -> fs::path {
+    auto dir = fs::temp_directory_path() / name;
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+    return dir;
+}
+
+static auto count_manifests(const fs::path &dir) -> size_t {
+    size_t count = 0;
+    for (const auto &entry : fs::directory_iterator(dir)) {
+        if (entry.path().filename().string().starts_with(MANIFEST_PREFIX)) {
+            ++count;
+        }
+    }
+    return count;
+}
+
+TEST(manifest_VersionEdit, RoundTrips) {
+    VersionEdit edit = {
+        .next_table_id = 300,
+        .last_sequence = 1 << 20,
+        .removed = {1, 2},
+        .added = {{0, 3, "a", "m", 4096}, {2, 4, "", std::string(200, 'z'), 7}},
+    };
+    auto decoded = VersionEdit::decode(edit.encode());
+    EXPECT_EQ(decoded.next_table_id, 300u);
+    EXPECT_EQ(decoded.last_sequence, 1u << 20);
+    EXPECT_EQ(decoded.removed, (std::vector<uint64_t>{1, 2}));
+    ASSERT_EQ(decoded.added.size(), 2u);
+    EXPECT_EQ(decoded.added[1].level, 2u);
+    EXPECT_EQ(decoded.added[1].id, 4u);
+    EXPECT_EQ(decoded.added[1].smallest, "");
+    EXPECT_EQ(decoded.added[1].largest, std::string(200, 'z'));
+    EXPECT_EQ(decoded.added[1].file_size, 7u);
+
+    auto empty = VersionEdit::decode({});
+    EXPECT_FALSE(empty.next_table_id.has_value());
+    EXPECT_TRUE(empty.added.empty());
+
+    auto data = edit.encode();
+    data.pop_back();
+    EXPECT_THROW(VersionEdit::decode(data), std::runtime_error);
+}
+
+TEST(manifest_Manifest, ReplaysEdits) {
+    auto dir = make_dir("mousedb_manifest_replay");
+    {
+        Manifest manifest(dir, 1 << 20);
+        EXPECT_TRUE(manifest.version().tables.empty());
+        manifest.apply({.next_table_id = 2,
+                        .added = {{0, 0, "a", "c", 10}, {0, 1, "b", "d", 20}}});
+        // moves table 0 down and drops table 1
+        manifest.apply({.next_table_id = 3,
+                        .last_sequence = 9,
+                        .removed = {1},
+                        .added = {{1, 0, "a", "c", 10}}});
+    }
+    Manifest manifest(dir, 1 << 20);
+    const auto &version = manifest.version();
+    EXPECT_EQ(version.next_table_id, 3u);
+    EXPECT_EQ(version.last_sequence, 9u);
+    ASSERT_EQ(version.tables.size(), 1u);
+    EXPECT_EQ(version.tables[0].level, 1u);
+    EXPECT_EQ(version.tables[0].id, 0u);
+    EXPECT_EQ(version.tables[0].largest, "c");
+    // each open starts a new manifest and removes the old one
+    EXPECT_EQ(manifest.number(), 2u);
+    EXPECT_EQ(count_manifests(dir), 1u);
+    fs::remove_all(dir);
+}
+
+TEST(manifest_Manifest, RotatesAtMaxFileSize) {
+    auto dir = make_dir("mousedb_manifest_rotate");
+    {
+        Manifest manifest(dir, 256);
+        for (uint64_t id = 0; id < 100; ++id) {
+            manifest.apply({.next_table_id = id + 1,
+                            .added = {{0, id, "a", "b", id}}});
+            if (id % 2 == 1) {
+                manifest.apply({.removed = {id - 1}});
+            }
+        }
+        EXPECT_GT(manifest.number(), 2u);
+        EXPECT_LT(manifest.file_size(), 512u);
+        EXPECT_EQ(count_manifests(dir), 1u);
+    }
+    Manifest manifest(dir, 256);
+    EXPECT_EQ(manifest.version().next_table_id, 100u);
+    ASSERT_EQ(manifest.version().tables.size(), 50u);
+    EXPECT_EQ(manifest.version().tables[0].id, 1u);
+    EXPECT_EQ(manifest.version().tables[49].id, 99u);
+    fs::remove_all(dir);
+}
+
+TEST(manifest_Manifest, IgnoresTornRecord) {
+    auto dir = make_dir("mousedb_manifest_torn");
+    uint64_t number;
+    {
+        Manifest manifest(dir, 1 << 20);
+        manifest.apply({.added = {{0, 7, "a", "b", 1}}});
+        number = manifest.number();
+    }
+    // a record whose size runs past the end of the file
+    FILE *file =
+        fopen((dir / std::format("{}{}", MANIFEST_PREFIX, number)).c_str(),
+              "ab");
+    ASSERT_NE(file, nullptr);
+    uint32_t size = 100;
+    fwrite(&size, sizeof(size), 1, file);
+    fputs("partial", file);
+    fclose(file);
+
+    Manifest manifest(dir, 1 << 20);
+    ASSERT_EQ(manifest.version().tables.size(), 1u);
+    EXPECT_EQ(manifest.version().tables[0].id, 7u);
+    fs::remove_all(dir);
+}
+
+// Zeroes the bytes of the manifest in dir from offset up to end.
+static auto zero(const fs::path &dir, uint64_t number, size_t offset,
+                 size_t end) -> void {
+    FILE *file =
+        fopen((dir / std::format("{}{}", MANIFEST_PREFIX, number)).c_str(),
+              "r+b");
+    ASSERT_NE(file, nullptr);
+    fseek(file, static_cast<long>(offset), SEEK_SET);
+    std::string zeros(end - offset, '\0');
+    fwrite(zeros.data(), 1, zeros.size(), file);
+    fclose(file);
+}
+
+TEST(manifest_Manifest, IgnoresLastRecordFailingChecksum) {
+    auto dir = make_dir("mousedb_manifest_checksum");
+    uint64_t number;
+    size_t offset;
+    size_t end;
+    {
+        Manifest manifest(dir, 1 << 20);
+        manifest.apply({.added = {{0, 7, "a", "b", 1}}});
+        offset = manifest.file_size();
+        manifest.apply({.added = {{0, 8, "c", "d", 1}}});
+        end = manifest.file_size();
+        number = manifest.number();
+    }
+    // keeps the size of the last record but loses its payload, as when a
+    // crash lands before the data reaches the disk
+    zero(dir, number, offset + 2 * sizeof(uint32_t), end);
+
+    Manifest manifest(dir, 1 << 20);
+    ASSERT_EQ(manifest.version().tables.size(), 1u);
+    EXPECT_EQ(manifest.version().tables[0].id, 7u);
+    fs::remove_all(dir);
+}
+
+TEST(manifest_Manifest, ThrowsOnEarlierRecordFailingChecksum) {
+    auto dir = make_dir("mousedb_manifest_corrupt");
+    uint64_t number;
+    size_t offset;
+    {
+        Manifest manifest(dir, 1 << 20);
+        offset = manifest.file_size();
+        manifest.apply({.added = {{0, 7, "a", "b", 1}}});
+        manifest.apply({.added = {{0, 8, "c", "d", 1}}});
+        number = manifest.number();
+    }
+    zero(dir, number, offset + 2 * sizeof(uint32_t),
+         offset + 2 * sizeof(uint32_t) + 1);
+
+    EXPECT_THROW(Manifest(dir, 1 << 20), std::runtime_error);
+    fs::remove_all(dir);
+}
@@ -2,6 +2,7 @@
 
 #include <benchmark/benchmark.h>
 
+#include <cstdio>
 #include <random>
 
 using namespace mousedb::memtable;
@@ -58,6 +59,49 @@ static void memtable_KVStoreInsertRandom(benchmark::State &state) {
     state.SetItemsProcessed(state.iterations());
 }
 
+static void memtable_KVSkipListInsertSequential(benchmark::State &state) {
+    static MemTable<KVSkipList> *memtable;
+    if (state.thread_index() == 0) {
+        memtable = new MemTable<KVSkipList>();
+    }
+    size_t i = state.thread_index();
+    char key[17];
+    for (auto _ : state) {
+        std::snprintf(key, sizeof(key), "%016zu", i);
+        memtable->insert(key, "value");
+        i += state.threads();
+    }
+    state.SetItemsProcessed(state.iterations());
+    if (state.thread_index() == 0) {
+        delete memtable;
+    }
+}
+
+static void memtable_KVSkipListFind(benchmark::State &state) {
+    static MemTable<KVSkipList> *memtable;
+    constexpr size_t size = 100000;
+    if (state.thread_index() == 0) {
+        memtable = new MemTable<KVSkipList>();
+        char key[17];
+        for (size_t i = 0; i < size; ++i) {
+            std::snprintf(key, sizeof(key), "%016zu", i);
+            memtable->insert(key, "value");
+        }
+    }
+    thread_local std::mt19937 rng(std::random_device{}());
+    std::uniform_int_distribution<size_t> dist(0, size - 1);
+    char key[17];
+    for (auto _ : state) {
+        std::snprintf(key, sizeof(key), "%016zu", dist(rng));
+        auto values = memtable->find(key);
+        benchmark::DoNotOptimize(values);
+    }
+    state.SetItemsProcessed(state.iterations());
+    if (state.thread_index() == 0) {
+        delete memtable;
+    }
+}
+
 BENCHMARK(memtable_KVStoreInsertSmall)
     ->Threads(1)
     ->Threads(2)
@@ -78,3 +122,17 @@ BENCHMARK(memtable_KVStoreInsertRandom)
     ->Threads(4)
     ->Threads(8)
     ->UseRealTime();
+
+BENCHMARK(memtable_KVSkipListInsertSequential)
+    ->Threads(1)
+    ->Threads(2)
+    ->Threads(4)
+    ->Threads(8)
+    ->UseRealTime();
+
+BENCHMARK(memtable_KVSkipListFind)
+    ->Threads(1)
+    ->Threads(2)
+    ->Threads(4)
+    ->Threads(8)
+    ->UseRealTime();
@@ -1,40 +1,23 @@
 #include "memtable.hpp"
 
+#include <sched.h>
+
+#include <algorithm>
+#include <bit>
 #include <cstring>
 #include <mutex>
+#include <thread>
 
-size_t get_varint_size(uint64_t value) {
-    size_t bits = 64 - std::countl_zero(value);
-    return bits == 0 ? 1 : (bits + 6) / 7;
-}
-
-auto encode_varint(std::span<std::byte> data, uint64_t value) -> size_t {
-    size_t i = 0;
-    while (value > 0x7F) {
-        data[i] = static_cast<std::byte>((value & 0x7F) | 0x80);
-        value >>= 7;
-        ++i;
-    }
-    data[i] = static_cast<std::byte>(value);
-    return i + 1;
-}
-
-auto decode_varint(std::span<std::byte> data, uint64_t &value) -> size_t {
-    size_t i = 0;
-    value = 0;
-    while (true) {
-        value |= (static_cast<uint64_t>(data[i]) & 0x7F) << (i * 7);
-        if ((static_cast<uint64_t>(data[i]) & 0x80) == 0) {
-            break;
-        }
-        ++i;
-    }
-    return i + 1;
-}
+#include "coding.hpp"
+#include "random.hpp"
 
 namespace mousedb {
 namespace memtable {
 
+using coding::decode_varint;
+using coding::encode_varint;
+using coding::get_varint_size;
+
 KVStore::KVStore(size_t slab_size) : arena_(slab_size) {
 }
 
@@ -134,6 +117,32 @@ auto KVStore::insert(std::span<std::byte> key, std::span<std::byte> value)
     return ptr;
 }
 
+auto KVStore::insert(std::span<std::byte> key, std::span<std::byte> value,
+                     size_t prefix_size) -> ptr_type {
+    const auto size_key = key.size();
+    const auto size_value = value.size();
+    const auto size_varint_key = get_varint_size(size_key);
+    const auto size_varint_value = get_varint_size(size_value);
+    const auto size =
+        size_varint_key + size_varint_value + size_key + size_value;
+
+    // Copies into ptr as [prefix, key_size, key, value_size, value]
+    auto ptr =
+        arena_.allocate_aligned(prefix_size + size, alignof(std::byte *)) +
+        prefix_size;
+    encode_varint({ptr, size_varint_key}, size_key);
+    if (size_key > 0) {
+        std::memcpy(ptr + size_varint_key, key.data(), size_key);
+    }
+    encode_varint({ptr + size_varint_key + size_key, size_varint_value},
+                  size_value);
+    if (size_value > 0) {
+        std::memcpy(ptr + size_varint_key + size_key + size_varint_value,
+                    value.data(), size_value);
+    }
+    return ptr;
+}
+
 auto KVStore::used() const -> size_t {
     return arena_.used();
 }
@@ -142,30 +151,275 @@ auto KVStore::size() const -> size_t {
     return arena_.size();
 }
 
+thread_local size_t KVSkipList::cpu_id_ = 0;
+
 KVSkipList::KVSkipList(size_t max_height, size_t branching_factor)
-    : max_height_(max_height), branching_factor_(branching_factor), kvs_(4096) {
-    std::ignore = max_height_;
-    std::ignore = branching_factor_;
+    : max_height_(std::max(max_height, static_cast<size_t>(1))),
+      branching_factor_(std::max(branching_factor, static_cast<size_t>(2))),
+      kvs_(4096),
+      head_(kvs_.insert({}, {}, max_height_ * sizeof(link_type))),
+      shards_(std::bit_ceil(
+          std::max(std::thread::hardware_concurrency(), 1u))) {
+    for (size_t i = 0; i < max_height_; ++i) {
+        new (link(head_, i)) link_type(nullptr);
+    }
+    for (auto &shard : shards_) {
+        shard.splice.prev.resize(max_height_ + 1);
+        shard.splice.next.resize(max_height_ + 1);
+    }
+}
+
+auto KVSkipList::Iterator::operator++() -> Iterator & {
+    node_ = next(node_, 0);
+    return *this;
+}
+
+auto KVSkipList::Iterator::operator++(int) -> Iterator {
+    Iterator it = *this;
+    ++*this;
+    return it;
+}
+
+auto KVSkipList::begin() const -> Iterator {
+    return Iterator(next(head_, 0));
+}
+
+auto KVSkipList::end() const -> Iterator {
+    return Iterator();
+}
+
+auto KVSkipList::lower_bound(std::span<std::byte> key) const -> Iterator {
+    return Iterator(find_greater_or_equal(key));
+}
+
+auto KVSkipList::before(Iterator it) const -> Iterator {
+    ptr_type node = find_less_than(it.node_);
+    return Iterator(node == head_ ? nullptr : node);
 }
 
 auto KVSkipList::find(std::span<std::byte> key) const
     -> std::vector<std::span<std::byte>> {
     std::vector<std::span<std::byte>> values;
-    std::shared_lock lock(nodes_mutex_);
-    for (const auto &node : nodes_) {
-        auto [test_key, value] = KVStore::get(node);
-        if (KVStore::compare(key, test_key) == 0) {
-            values.push_back(value);
+    for (ptr_type node = find_greater_or_equal(key); node != nullptr;
+         node = next(node, 0)) {
+        auto [node_key, value] = KVStore::get(node);
+        if (KVStore::compare(key, node_key) != 0) {
+            break;
         }
+        values.push_back(value);
     }
     return values;
 }
 
 auto KVSkipList::insert(std::span<std::byte> key, std::span<std::byte> value)
     -> void {
-    std::unique_lock lock(nodes_mutex_);
-    auto ptr = kvs_.insert(key, value);
-    nodes_.push_back(ptr);
+    size_t height = random_height();
+    ptr_type entry = kvs_.insert(key, value, height * sizeof(link_type));
+
+    Shard *shard = get_shard(cpu_id_);
+    if (!shard->mutex.try_lock()) {
+        shard = reset_shard();
+        if (!shard->mutex.try_lock()) {
+            // Another insert on this CPU owns the splice, so this one searches
+            // from the head instead of waiting for it.
+            Splice splice;
+            splice.prev.resize(max_height_ + 1);
+            splice.next.resize(max_height_ + 1);
+            if (insert(entry, height, splice)) {
+                size_.fetch_add(1, std::memory_order_relaxed);
+            }
+            return;
+        }
+    }
+    std::unique_lock shard_lock(shard->mutex, std::adopt_lock);
+    if (insert(entry, height, shard->splice)) {
+        size_.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+auto KVSkipList::compare(ptr_type a, ptr_type b) -> int {
+    auto [key_a, value_a] = KVStore::get(a);
+    auto [key_b, value_b] = KVStore::get(b);
+    int cmp = KVStore::compare(key_a, key_b);
+    if (cmp != 0) {
+        return cmp;
+    }
+    return KVStore::compare(value_a, value_b);
+}
+
+auto KVSkipList::random_height() const -> size_t {
+    auto *rnd = random::Random::instance();
+    size_t height = 1;
+    while (height < max_height_ && rnd->next32() % branching_factor_ == 0) {
+        ++height;
+    }
+    return height;
+}
+
+auto KVSkipList::is_after(ptr_type node, ptr_type entry) const -> bool {
+    return node != nullptr && compare(node, entry) < 0;
+}
+
+auto KVSkipList::find_greater_or_equal(std::span<std::byte> key) const
+    -> ptr_type {
+    ptr_type node = head_;
+    size_t level = height_.load(std::memory_order_relaxed) - 1;
+    ptr_type last_bigger = nullptr;
+    for (;;) {
+        ptr_type next_node = next(node, level);
+        // Nodes at lower levels are not compared twice when they were already
+        // found to be bigger at a higher level.
+        int cmp = next_node == nullptr || next_node == last_bigger
+                      ? 1
+                      : KVStore::compare(KVStore::get_key(next_node), key);
+        if (cmp < 0) {
+            node = next_node;
+        } else if (level == 0) {
+            return next_node;
+        } else {
+            last_bigger = next_node;
+            --level;
+        }
+    }
+}
+
+auto KVSkipList::find_less_than(ptr_type entry) const -> ptr_type {
+    ptr_type node = head_;
+    size_t level = height_.load(std::memory_order_relaxed) - 1;
+    for (;;) {
+        ptr_type next_node = next(node, level);
+        if (next_node != nullptr &&
+            (entry == nullptr || compare(next_node, entry) < 0)) {
+            node = next_node;
+        } else if (level == 0) {
+            return node;
+        } else {
+            --level;
+        }
+    }
+}
+
+auto KVSkipList::find_splice(ptr_type entry, ptr_type before, ptr_type after,
+                             size_t level, ptr_type &out_prev,
+                             ptr_type &out_next) const -> void {
+    for (;;) {
+        ptr_type next_node = next(before, level);
+        if (next_node == after || !is_after(next_node, entry)) {
+            out_prev = before;
+            out_next = next_node;
+            return;
+        }
+        before = next_node;
+    }
+}
+
+auto KVSkipList::recompute_splice(ptr_type entry, Splice &splice,
+                                  size_t level) const -> void {
+    while (level-- > 0) {
+        find_splice(entry, splice.prev[level + 1], splice.next[level + 1],
+                    level, splice.prev[level], splice.next[level]);
+    }
+}
+
+auto KVSkipList::insert(ptr_type entry, size_t height, Splice &splice)
+    -> bool {
+    size_t list_height = height_.load(std::memory_order_relaxed);
+    while (height > list_height &&
+           !height_.compare_exchange_weak(list_height, height)) {
+    }
+    list_height = std::max(list_height, height);
+
+    // Finds the lowest level from which the splice still brackets the entry
+    // and searches again only below it.
+    size_t recompute_height = 0;
+    if (splice.height < list_height) {
+        splice.prev[list_height] = head_;
+        splice.next[list_height] = nullptr;
+        splice.height = list_height;
+        recompute_height = list_height;
+    } else {
+        while (recompute_height < list_height) {
+            ptr_type prev = splice.prev[recompute_height];
+            ptr_type next_node = splice.next[recompute_height];
+            if (next(prev, recompute_height) != next_node) {
+                // Other inserts landed inside the bracket.
+                ++recompute_height;
+            } else if (prev != head_ && !is_after(prev, entry)) {
+                // The entry is before the bracket.
+                while (recompute_height < list_height &&
+                       splice.prev[recompute_height] == prev) {
+                    ++recompute_height;
+                }
+            } else if (is_after(next_node, entry)) {
+                // The entry is after the bracket.
+                while (recompute_height < list_height &&
+                       splice.next[recompute_height] == next_node) {
+                    ++recompute_height;
+                }
+            } else {
+                break;
+            }
+        }
+    }
+    if (recompute_height > 0) {
+        if (recompute_height == list_height) {
+            splice.prev[list_height] = head_;
+            splice.next[list_height] = nullptr;
+        }
+        recompute_splice(entry, splice, recompute_height);
+    }
+
+    for (size_t level = 0; level < height; ++level) {
+        new (link(entry, level)) link_type(nullptr);
+    }
+    bool splice_is_valid = true;
+    for (size_t level = 0; level < height; ++level) {
+        for (;;) {
+            if (level == 0 && splice.next[0] != nullptr &&
+                compare(entry, splice.next[0]) == 0) {
+                // The exact pair is already stored.
+                return false;
+            }
+            link(entry, level)
+                ->store(splice.next[level], std::memory_order_relaxed);
+            ptr_type expected = splice.next[level];
+            if (link(splice.prev[level], level)
+                    ->compare_exchange_strong(expected, entry,
+                                              std::memory_order_release,
+                                              std::memory_order_relaxed)) {
+                break;
+            }
+            // A concurrent insert took the slot, so the bracket is searched
+            // again starting from the old predecessor.
+            find_splice(entry, splice.prev[level], nullptr, level,
+                        splice.prev[level], splice.next[level]);
+            if (level > 0) {
+                splice_is_valid = false;
+            }
+        }
+    }
+
+    if (splice_is_valid) {
+        for (size_t level = 0; level < height; ++level) {
+            splice.prev[level] = entry;
+        }
+    } else {
+        splice.height = 0;
+    }
+    return true;
+}
+
+inline auto KVSkipList::get_shard(size_t cpu_id) const -> Shard * {
+    return const_cast<Shard *>(&shards_[cpu_id & (shards_.size() - 1)]);
+}
+
+inline auto KVSkipList::reset_shard() -> Shard * {
+    size_t cpu_id = sched_getcpu();
+    if (cpu_id == static_cast<size_t>(-1)) [[unlikely]] {
+        cpu_id = std::hash<std::thread::id>()(std::this_thread::get_id());
+    }
+    cpu_id_ = cpu_id | shards_.size();
+    return get_shard(cpu_id);
 }
 
 }  // namespace memtable
@@ -1,12 +1,12 @@
 #pragma once
 
-#include <condition_variable>
-#include <shared_mutex>
+#include <atomic>
 #include <span>
 #include <string>
-#include <unordered_map>
+#include <vector>
 
 #include "arena.hpp"
+#include "spin_mutex.hpp"
 
 namespace mousedb {
 namespace memtable {
@@ -35,6 +35,10 @@ class KVStore {
 
     auto insert(std::span<std::byte> key, std::span<std::byte> value)
         -> ptr_type;
+    // Reserves prefix_size bytes right before the returned pair, aligned for
+    // pointers.
+    auto insert(std::span<std::byte> key, std::span<std::byte> value,
+                size_t prefix_size) -> ptr_type;
     auto used() const -> size_t;
     auto size() const -> size_t;
 
@@ -42,8 +46,46 @@ class KVStore {
     arena::ConcurrentArena arena_;
 };
 
+// Sorted map of KV pairs built as a concurrent skiplist. Nodes are linked
+// with CAS and readers never lock. Multiple values may be stored for one key,
+// ordered by their bytes, and an exact duplicate of a stored pair is dropped.
+// Example:
+//    KVSkipList sl;
+//    sl.insert(key, value);
+//    for (auto ptr : sl) {
+//        auto [key, value] = KVStore::get(ptr);
+//    }
 class KVSkipList {
    public:
+    using ptr_type = KVStore::ptr_type;
+
+    class Iterator {
+       public:
+        using value_type = ptr_type;
+        using difference_type = std::ptrdiff_t;
+
+        Iterator() = default;
+
+        auto operator*() const -> ptr_type {
+            return node_;
+        }
+
+        auto operator++() -> Iterator &;
+        auto operator++(int) -> Iterator;
+
+        friend auto operator==(const Iterator &a, const Iterator &b) -> bool {
+            return a.node_ == b.node_;
+        }
+
+       private:
+        friend class KVSkipList;
+
+        explicit Iterator(ptr_type node) : node_(node) {
+        }
+
+        ptr_type node_ = nullptr;
+    };
+
     explicit KVSkipList(size_t max_height = 12, size_t branching_factor = 4);
     KVSkipList(const KVSkipList &) = delete;
     KVSkipList &operator=(const KVSkipList &) = delete;
@@ -58,26 +100,73 @@ class KVSkipList {
     }
 
     auto size() const -> size_t {
-        return nodes_.size();
+        return size_.load(std::memory_order_relaxed);
     }
 
-    auto begin() {
-        return nodes_.begin();
-    }
-
-    auto end() {
-        return nodes_.end();
-    }
+    auto begin() const -> Iterator;
+    auto end() const -> Iterator;
+    // Returns the first node whose key is not less than key.
+    auto lower_bound(std::span<std::byte> key) const -> Iterator;
+    // Returns the node before it, or end if there is none, where the node
+    // before end is the last one. Nodes only link forward, so this searches
+    // from the head.
+    auto before(Iterator it) const -> Iterator;
 
    private:
-    struct Splice {};
+    using link_type = std::atomic<ptr_type>;
+
+    // Bracketing nodes for a key at each level, such that prev[i] < key <=
+    // next[i]. Kept between inserts so that sequential keys only need to
+    // search the bottom levels. Levels at or above height are not valid.
+    struct Splice {
+        size_t height = 0;
+        std::vector<ptr_type> prev;
+        std::vector<ptr_type> next;
+    };
+
+    struct alignas(64) Shard {
+        Splice splice;
+        spin_mutex::SpinMutex mutex;
+    };
+
+    static thread_local size_t cpu_id_;
 
     const size_t max_height_;
     const size_t branching_factor_;
 
     KVStore kvs_;
-    std::deque<KVStore::ptr_type> nodes_;
-    mutable std::shared_mutex nodes_mutex_;
+    ptr_type head_;
+    std::atomic<size_t> height_ = 1;
+    std::atomic<size_t> size_ = 0;
+    std::vector<Shard> shards_;
+
+    // Links for a node are stored right before its KV pair, with level 0
+    // closest to it.
+    static auto link(ptr_type node, size_t level) -> link_type * {
+        return reinterpret_cast<link_type *>(node) - (level + 1);
+    }
+
+    static auto next(ptr_type node, size_t level) -> ptr_type {
+        return link(node, level)->load(std::memory_order_acquire);
+    }
+
+    // Orders by key, then by value.
+    static auto compare(ptr_type a, ptr_type b) -> int;
+
+    auto random_height() const -> size_t;
+    auto is_after(ptr_type node, ptr_type entry) const -> bool;
+    auto find_greater_or_equal(std::span<std::byte> key) const -> ptr_type;
+    // Returns the last node before entry, or the last node if entry is null.
+    auto find_less_than(ptr_type entry) const -> ptr_type;
+    auto find_splice(ptr_type entry, ptr_type before, ptr_type after,
+                     size_t level, ptr_type &out_prev, ptr_type &out_next) const
+        -> void;
+    auto recompute_splice(ptr_type entry, Splice &splice, size_t level) const
+        -> void;
+    auto insert(ptr_type entry, size_t height, Splice &splice) -> bool;
+
+    inline auto get_shard(size_t cpu_id) const -> Shard *;
+    inline auto reset_shard() -> Shard *;
 };
 
 template <typename T>
@@ -106,6 +195,25 @@ class MemTable {
         return byte_map_.end();
     }
 
+    auto begin() const {
+        return byte_map_.begin();
+    }
+
+    auto end() const {
+        return byte_map_.end();
+    }
+
+    auto lower_bound(std::string_view key) const {
+        return byte_map_.lower_bound(
+            {const_cast<std::byte *>(
+                 reinterpret_cast<const std::byte *>(key.data())),
+             key.size()});
+    }
+
+    auto before(auto it) const {
+        return byte_map_.before(it);
+    }
+
    private:
     T byte_map_;
 };
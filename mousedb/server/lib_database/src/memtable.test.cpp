@@ -2,7 +2,9 @@
 
 #include <gtest/gtest.h>
 
+#include <atomic>
 #include <format>
+#include <thread>
 
 using namespace mousedb::memtable;
 
@@ -221,3 +223,106 @@ TEST(memtable_KVSkipList, InsertAndGetMultiple) {
         memtable.insert(key, value);
     }
 }
+
+TEST(memtable_KVSkipList, IteratesInOrder) {
+    MemTable<KVSkipList> memtable;
+    for (int i = 999; i >= 0; --i) {
+        memtable.insert(std::format("{:04}", i), std::to_string(i));
+    }
+    EXPECT_EQ(memtable.size(), 1000u);
+    int i = 0;
+    for (auto ptr : memtable) {
+        auto key = KVStore::get_key(ptr);
+        EXPECT_EQ(std::string(reinterpret_cast<const char *>(key.data()),
+                              key.size()),
+                  std::format("{:04}", i));
+        ++i;
+    }
+    EXPECT_EQ(i, 1000);
+}
+
+TEST(memtable_KVSkipList, FindsEveryValueForKey) {
+    MemTable<KVSkipList> memtable;
+    memtable.insert("a", "1");
+    memtable.insert("b", "2");
+    memtable.insert("b", "3");
+    memtable.insert("b", "3");
+    memtable.insert("c", "4");
+    EXPECT_EQ(memtable.size(), 4u);
+    auto values = memtable.find("b");
+    ASSERT_EQ(values.size(), 2u);
+    EXPECT_EQ(values[0], "2");
+    EXPECT_EQ(values[1], "3");
+    EXPECT_TRUE(memtable.find("bb").empty());
+    EXPECT_TRUE(memtable.find("").empty());
+}
+
+TEST(memtable_KVSkipList, SeeksAndStepsBackward) {
+    MemTable<KVSkipList> memtable;
+    for (int i = 0; i < 1000; i += 2) {
+        memtable.insert(std::format("{:04}", i), std::to_string(i));
+    }
+    auto key_of = [](auto it) {
+        auto key = KVStore::get_key(*it);
+        return std::string(reinterpret_cast<const char *>(key.data()),
+                           key.size());
+    };
+    auto it = memtable.lower_bound("0501");
+    ASSERT_NE(it, memtable.end());
+    EXPECT_EQ(key_of(it), "0502");
+    EXPECT_EQ(key_of(memtable.before(it)), "0500");
+    EXPECT_EQ(memtable.lower_bound("0999"), memtable.end());
+    EXPECT_EQ(memtable.before(memtable.begin()), memtable.end());
+
+    int i = 998;
+    for (auto it = memtable.before(memtable.end()); it != memtable.end();
+         it = memtable.before(it)) {
+        EXPECT_EQ(key_of(it), std::format("{:04}", i));
+        i -= 2;
+    }
+    EXPECT_EQ(i, -2);
+}
+
+TEST(memtable_KVSkipList, ManyThreadsInsertAndFind) {
+    constexpr int THREADS = 8;
+    constexpr int OPS_PER_THREAD = 2000;
+
+    MemTable<KVSkipList> memtable;
+    std::atomic<bool> done = false;
+
+    // reads concurrently with the writers without ever seeing a partial node
+    std::thread reader([&]() {
+        while (!done.load()) {
+            std::string prev;
+            for (auto ptr : memtable) {
+                auto key = KVStore::get_key(ptr);
+                std::string curr(reinterpret_cast<const char *>(key.data()),
+                                 key.size());
+                EXPECT_LE(prev, curr);
+                prev = std::move(curr);
+            }
+        }
+    });
+
+    auto worker = [&](int tid) {
+        for (int i = 0; i < OPS_PER_THREAD; ++i) {
+            // interleaves sequential runs across threads
+            memtable.insert(std::format("k{:06}_{}", i, tid),
+                            std::format("v{}", tid));
+        }
+    };
+    std::vector<std::thread> threads;
+    for (int t = 0; t < THREADS; ++t) threads.emplace_back(worker, t);
+    for (auto &th : threads) th.join();
+    done = true;
+    reader.join();
+
+    EXPECT_EQ(memtable.size(), static_cast<size_t>(THREADS * OPS_PER_THREAD));
+    for (int t = 0; t < THREADS; ++t) {
+        for (int i = 0; i < OPS_PER_THREAD; ++i) {
+            auto values = memtable.find(std::format("k{:06}_{}", i, t));
+            ASSERT_EQ(values.size(), 1u);
+            EXPECT_EQ(values[0], std::format("v{}", t));
+        }
+    }
+}
@@ -1,42 +1,153 @@
 #include "mousedb/database/core.hpp"
 
+#include <fcntl.h>
 #include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <bit>
+#include <chrono>
 #include <cstdint>
 #include <cstring>
-#include <iostream>
-#include <map>
+#include <exception>
+#include <format>
+#include <iterator>
+#include <limits>
+#include <numeric>
 #include <optional>
-#include <print>
 #include <ranges>
 #include <span>
 #include <thread>
+#include <unordered_map>
+#include <utility>
 
-namespace fs = std::filesystem;
+#include "coding.hpp"
 
-struct WalState {
-    fs::path path;
-    FILE *file;
-    size_t ot;
-    size_t oid;
-    std::vector<char> key, value;
-};
+namespace fs = std::filesystem;
 
 namespace mousedb {
 namespace database {
 
+std::atomic<uint64_t> Database::next_id_ = 1;
 thread_local size_t Database::cpu_id_ = 0;
+thread_local std::vector<std::shared_ptr<Database::LocalState>>
+    Database::local_states_;
+std::shared_ptr<const Database::SuperVersion> Database::in_use_;
+
+namespace {
+// Every stored value starts with the HLC it was written at, and a value that
+// is only an HLC is a tombstone.
+constexpr size_t CLOCK_SIZE = sizeof(hlc::HLC::physical_us) +
+                              sizeof(hlc::HLC::logical) +
+                              sizeof(hlc::HLC::node_id);
+
+auto decode_clock(std::string_view value) -> hlc::HLC {
+    hlc::HLC hclock;
+    std::memcpy(&hclock.physical_us, value.data(), sizeof(hclock.physical_us));
+    std::memcpy(&hclock.logical, value.data() + sizeof(hclock.physical_us),
+                sizeof(hclock.logical));
+    std::memcpy(
+        &hclock.node_id,
+        value.data() + sizeof(hclock.physical_us) + sizeof(hclock.logical),
+        sizeof(hclock.node_id));
+    return hclock;
+}
+
+// Picks the index of the value with the latest HLC out of every version of a
+// key, or out of those at or before at if it is given, or returns nothing if
+// it is a tombstone.
+auto latest(std::span<const std::string_view> values,
+            std::optional<hlc::HLC> at = std::nullopt)
+    -> std::optional<size_t> {
+    struct Item {
+        size_t index;
+        hlc::HLC clock;
+    };
+
+    std::vector<Item> items;
+    items.reserve(values.size());
+    for (size_t i = 0; i < values.size(); ++i) {
+        auto clock = decode_clock(values[i]);
+        if (!at.has_value() || clock <= *at) {
+            items.push_back({i, clock});
+        }
+    }
+    auto it = hlc::lww_select(items.begin(), items.end());
+    if (it == items.end() || values[it->index].size() <= CLOCK_SIZE) {
+        return std::nullopt;
+    }
+    return it->index;
+}
+
+// Strips the HLC from the latest version of a key, as picked by latest.
+auto resolve(std::span<const std::string_view> values,
+             std::optional<hlc::HLC> at = std::nullopt)
+    -> std::optional<std::string_view> {
+    auto i = latest(values, at);
+    if (!i.has_value()) {
+        return std::nullopt;
+    }
+    return values[*i].substr(CLOCK_SIZE);
+}
+
+auto table_meta(const sstable::SSTable &table) -> TableMeta {
+    return {table.id(), std::string(table.smallest()),
+            std::string(table.largest()), table.file_size()};
+}
+
+auto overlaps(const TableMeta &meta, std::string_view smallest,
+              std::string_view largest) -> bool {
+    return meta.smallest <= largest && smallest <= meta.largest;
+}
+
+// Removes the tables that are only in before, and adds the tables that are
+// new in after or in a different level than before.
+auto diff(const std::vector<std::vector<TableMeta>> &before,
+          const std::vector<std::vector<TableMeta>> &after)
+    -> manifest::VersionEdit {
+    std::unordered_map<uint64_t, size_t> levels;
+    for (size_t level = 0; level < before.size(); ++level) {
+        for (const auto &meta : before[level]) {
+            levels.emplace(meta.id, level);
+        }
+    }
+    manifest::VersionEdit edit;
+    for (size_t level = 0; level < after.size(); ++level) {
+        for (const auto &meta : after[level]) {
+            auto it = levels.find(meta.id);
+            if (it == levels.end() || it->second != level) {
+                edit.added.push_back({level, meta.id, meta.smallest,
+                                      meta.largest, meta.file_size});
+            }
+            if (it != levels.end()) {
+                levels.erase(it);
+            }
+        }
+    }
+    for (const auto &[id, level] : levels) {
+        edit.removed.push_back(id);
+    }
+    return edit;
+}
+}  // namespace
 
 Database::Database(const fs::path &root_path, const Options &options)
     : options_(options),
+      id_(next_id_++),
       num_cpus_(std::thread::hardware_concurrency()),
       root_path_(root_path),
       data_path_(root_path_ / "data"),
       shards_(num_cpus_),
       memtable_(std::make_shared<memtable::MemTable<memtable::KVSkipList>>()),
-      sstables_(1),
+      sstables_(std::max(options_.num_levels, size_t{2})),
+      compact_pointers_(sstables_.size()),
+      block_cache_(options_.block_cache_capacity > 0
+                       ? std::make_shared<cache::BlockCache>(
+                             options_.block_cache_capacity)
+                       : nullptr),
+      table_cache_(data_path_, options_.max_open_tables, block_cache_),
       queue_(data_path_,
              std::max(std::thread::hardware_concurrency() / 2,
                       static_cast<unsigned int>(1)),
@@ -53,151 +164,181 @@ Database::Database(const fs::path &root_path, const Options &options)
         throw std::runtime_error(
             std::format("{} is not a directory", data_path_.c_str()));
     }
-    if (!fs::is_empty(data_path_)) {
+    {
+        // restores the tables and reserves their ids before recovery can
+        // flush
+        manifest_.emplace(data_path_, options_.max_manifest_file_size);
+        const auto &version = manifest_->version();
+        unused_sst_id_ = version.next_table_id;
+        operation_id_ = version.last_sequence;
+        if (options_.fresh && !version.tables.empty()) {
+            manifest::VersionEdit edit;
+            for (const auto &table : version.tables) {
+                edit.removed.push_back(table.id);
+            }
+            manifest_->apply(edit);
+            for (uint64_t id : edit.removed) {
+                fs::remove(table_cache_.path(id));
+            }
+        }
+        for (const auto &table : version.tables) {
+            if (table.level >= sstables_.size()) {
+                sstables_.resize(table.level + 1);
+            }
+            sstables_[table.level].push_back({table.id, table.smallest,
+                                              table.largest, table.file_size});
+        }
+        for (auto &level : sstables_ | std::views::drop(1)) {
+            std::ranges::sort(level, {}, &TableMeta::smallest);
+        }
+        for (const auto &table : version.tables) {
+            table_files_.emplace(table.id, std::make_shared<TableFile>(
+                                               table.id, table_cache_));
+        }
+        compact_pointers_.resize(sstables_.size());
+        publish_super_version(memtable_);
+
         // recovers WAL
+        wal_segments_.emplace(data_path_, options_.wal_segment_size,
+                              options_.max_free_wal_segments);
         if (!options_.fresh) {
-            std::vector<WalState> wals;
-            for (auto &entry : fs::directory_iterator(data_path_)) {
-                if (entry.path().extension() != ".wal") continue;
-                std::cout << "ENTRY " << entry.path().c_str() << std::endl;
-                FILE *f = fopen(entry.path().c_str(), "rb");
-                if (!f) {
-                    throw std::runtime_error(
-                        std::format("Failed to open {}", entry.path().c_str()));
-                }
+            recover_wals();
+        }
+        wal_segments_->release(wal_segments_->live());
+    }
+    reset_shard();
+    for (auto &shard : shards_) {
+        shard.wal = std::make_unique<wal::Writer>(
+            *wal_segments_, options_.sync_mode, options_.sync_interval,
+            options_.wal_use_io_uring, operation_id_);
+    }
+}
 
-                WalState ws;
-                ws.file = f;
-                ws.path = entry.path();
-                // read one entry inline
-                if (fread(&ws.ot, sizeof(ws.ot), 1, f) != 1 ||
-                    fread(&ws.oid, sizeof(ws.oid), 1, f) != 1) {
-                    std::cout << "HELLO " << entry.path().c_str() << std::endl;
-                    fclose(f);
-                    fs::remove(entry.path());
-                    continue;
-                }
-                size_t key_sz;
-                std::ignore = fread(&key_sz, sizeof(key_sz), 1, f);
-                ws.key.resize(key_sz);
-                std::ignore = fread(ws.key.data(), 1, key_sz, f);
-
-                if (ws.ot == 0) {
-                    size_t val_sz;
-                    std::ignore = fread(&val_sz, sizeof(val_sz), 1, f);
-                    ws.value.resize(val_sz);
-                    std::ignore = fread(ws.value.data(), 1, val_sz, f);
-                }
-                wals.push_back(std::move(ws));
-            }
-            std::cout << "HERE" << std::endl;
-
-            // always process the lowest-oid entry next
-            while (!wals.empty()) {
-                // find index of smallest oid
-                size_t best = 0;
-                for (size_t i = 1; i < wals.size(); ++i)
-                    if (wals[i].oid < wals[best].oid) best = i;
-
-                WalState &ws = wals[best];
-
-                switch (ws.ot) {
-                    case 0:
-                        std::cout
-                            << std::format("RINSERTING {}",
-                                           std::string_view(ws.key.data(),
-                                                            ws.key.size()))
-                            << std::endl;
-                        internal_insert(
-                            std::string_view(ws.key.data(), ws.key.size()),
-                            std::string_view(ws.value.data(), ws.value.size()));
-                        break;
-                    case 1:
-                        internal_erase(
-                            std::string_view(ws.key.data(), ws.key.size()));
-                        break;
-                    default:
-                        throw std::runtime_error(std::format(
-                            "Unknown op {} in {}", ws.ot, ws.path.c_str()));
-                }
+Database::~Database() {
+    // values returned on any thread are invalid from now on, and must not
+    // pin memtables, tables or cached blocks past the database
+    drop_thread_states(true);
+}
 
-                FILE *f = ws.file;
-                size_t ot, oid;
-                if (fread(&ot, sizeof(ot), 1, f) != 1 ||
-                    fread(&oid, sizeof(oid), 1, f) != 1) {
-                    fclose(f);
-                    fs::remove(ws.path);
-                    wals.erase(wals.begin() + best);
-                    continue;
-                }
+PinnableValue::PinnableValue(std::string_view value, hlc::HLC clock,
+                             std::shared_ptr<const void> owner,
+                             std::vector<cache::BlockCache::Handle> blocks)
+    : value_(value),
+      clock_(clock),
+      owner_(std::move(owner)),
+      blocks_(std::move(blocks)) {
+}
 
-                ws.ot = ot;
-                ws.oid = oid;
+auto PinnableValue::value() const -> std::string_view {
+    return value_;
+}
 
-                size_t key_sz;
-                std::ignore = fread(&key_sz, sizeof(key_sz), 1, f);
-                ws.key.resize(key_sz);
-                std::ignore = fread(ws.key.data(), 1, key_sz, f);
+auto PinnableValue::clock() const -> hlc::HLC {
+    return clock_;
+}
 
-                if (ws.ot == 0) {
-                    size_t val_sz;
-                    std::ignore = fread(&val_sz, sizeof(val_sz), 1, f);
-                    ws.value.resize(val_sz);
-                    std::ignore = fread(ws.value.data(), 1, val_sz, f);
-                } else {
-                    ws.value.clear();
-                }
-            }
+auto Database::find(std::string_view key) -> std::optional<std::string_view> {
+    auto &pinned_value = local_state().pinned_value;
+    pinned_value = internal_find(key, std::nullopt);
+    if (!pinned_value.has_value()) {
+        return std::nullopt;
+    }
+    return pinned_value->value();
+}
 
-            // flushes memtable from wal
-            if (memtable_->used() > options.flush_threshold) {
-                std::cout << "FLUSHING" << std::endl;
-                queue_.enqueue_memtable(std::move(memtable_));
-                memtable_ = std::make_shared<
-                    memtable::MemTable<memtable::KVSkipList>>();
-            }
+auto Database::find_at(std::string_view key, hlc::HLC ts)
+    -> std::optional<std::string_view> {
+    auto &pinned_value = local_state().pinned_value;
+    pinned_value = internal_find(key, ts);
+    if (!pinned_value.has_value()) {
+        return std::nullopt;
+    }
+    return pinned_value->value();
+}
+
+auto Database::find_pinned(std::string_view key)
+    -> std::optional<PinnableValue> {
+    return internal_find(key, std::nullopt);
+}
+
+auto Database::multi_get(std::span<const std::string_view> keys)
+    -> std::vector<std::optional<std::string_view>> {
+    std::vector<std::string_view> sorted(keys.begin(), keys.end());
+    std::ranges::sort(sorted);
+    auto duplicates = std::ranges::unique(sorted);
+    sorted.erase(duplicates.begin(), duplicates.end());
+
+    // The memtables are pinned along with the tables, since values found in
+    // them point into their arenas.
+    auto &local = local_state();
+    local.pinned.clear();
+    local.pinned_blocks.clear();
+    auto super_version = get_super_version();
+    std::vector<std::vector<std::string_view>> values(sorted.size());
+    for (const auto &memtable : super_version->memtables) {
+        for (size_t i = 0; i < sorted.size(); ++i) {
+            auto res = memtable->find(sorted[i]);
+            values[i].insert(values[i].end(), res.begin(), res.end());
         }
+        local.pinned.push_back(memtable);
+    }
 
-        // recovers sstables and constructs bloom filter
-        size_t max_used_id = 0;
-        for (const auto &entry : fs::directory_iterator(data_path_)) {
-            if (entry.path().extension() != ".sst") {
-                continue;
-            }
-            std::string id_str = entry.path().filename().string();
-            size_t id = std::stoull(id_str);
-            if (id > max_used_id) {
-                max_used_id = id;
+    // As in find, every key is looked for in every level, since an older
+    // version may be in a newer level. Each table is given the keys that fall
+    // in its range, [first, last) of sorted, as one sorted batch.
+    std::vector<std::vector<std::string_view>> batch_values;
+    auto find_in = [&](const TableMeta &meta, size_t first, size_t last) {
+        std::span<const std::string_view> batch(sorted.begin() + first,
+                                                sorted.begin() + last);
+        batch_values.assign(batch.size(), {});
+        auto table = table_cache_.get(meta.id);
+        if (table->find(batch, batch_values, local.pinned_blocks)) {
+            local.pinned.push_back(std::move(table));
+            for (size_t j = 0; j < batch.size(); ++j) {
+                auto &found = values[first + j];
+                found.insert(found.end(), batch_values[j].begin(),
+                             batch_values[j].end());
             }
         }
-        unused_sst_id_ = max_used_id + 1;
+    };
+    const auto &levels = super_version->levels;
+    for (const auto &meta : std::views::reverse(levels[0])) {
+        auto first = std::ranges::lower_bound(sorted, meta.smallest);
+        auto last = std::ranges::upper_bound(first, sorted.end(), meta.largest);
+        if (first != last) {
+            find_in(meta, first - sorted.begin(), last - sorted.begin());
+        }
     }
-    queue_.set_unused_sst_id(unused_sst_id_);
-    std::cout << "CREATED" << std::endl;
-    reset_shard();
-    std::cout << "CREATED2" << std::endl;
-    for (size_t i = 0; i < shards_.size(); ++i) {
-        std::cout << "CREATED f" << i << std::endl;
-        FILE *file =
-            fopen((data_path_ / (std::to_string(i) + ".wal")).c_str(), "w");
-        shards_[i].file = file;
+    for (const auto &tables : levels | std::views::drop(1)) {
+        auto table = tables.begin();
+        auto key = sorted.begin();
+        while (key != sorted.end()) {
+            table = std::ranges::lower_bound(table, tables.end(), *key, {},
+                                             &TableMeta::largest);
+            if (table == tables.end()) {
+                break;
+            }
+            // moves past at least *key, which is at most the table's largest
+            auto first = std::ranges::lower_bound(key, sorted.end(),
+                                                  table->smallest);
+            key = std::ranges::upper_bound(first, sorted.end(), table->largest);
+            if (first != key) {
+                find_in(*table, first - sorted.begin(), key - sorted.begin());
+            }
+        }
     }
-}
 
-Database::~Database() {
-    for (auto &shard : shards_) {
-        fclose(shard.file);
+    std::vector<std::optional<std::string_view>> results;
+    results.reserve(keys.size());
+    for (auto key : keys) {
+        auto i = std::ranges::lower_bound(sorted, key) - sorted.begin();
+        results.push_back(resolve(values[i]));
     }
-}
-
-auto Database::find(std::string_view key) -> std::optional<std::string_view> {
-    std::cout << "FINDING " << key << std::endl;
-    return internal_find(key);
+    return results;
 }
 
 auto Database::insert(std::string_view key, std::string_view value,
                       hlc::HLC hclock) -> void {
-    std::cout << "INSERTING " << key << std::endl;
     std::string value_copy;
     value_copy.resize(sizeof(hclock.physical_us) + sizeof(hclock.logical) +
                       sizeof(hclock.node_id));
@@ -209,12 +350,15 @@ auto Database::insert(std::string_view key, std::string_view value,
         value_copy.data() + sizeof(hclock.physical_us) + sizeof(hclock.logical),
         &hclock.node_id, sizeof(hclock.node_id));
     value_copy += std::string(value);
-    wal_insert(key, value_copy);
-    internal_insert(key, value_copy);
+    {
+        std::shared_lock lock(memtable_mutex_);
+        wal_insert(key, value_copy);
+        internal_insert(key, value_copy);
+    }
+    maybe_switch_memtable();
 }
 
 auto Database::erase(std::string_view key, hlc::HLC hclock) -> void {
-    std::cout << "ERASING " << key << std::endl;
     std::string value_copy;
     value_copy.resize(sizeof(hclock.physical_us) + sizeof(hclock.logical) +
                       sizeof(hclock.node_id));
@@ -225,86 +369,380 @@ auto Database::erase(std::string_view key, hlc::HLC hclock) -> void {
     std::memcpy(
         value_copy.data() + sizeof(hclock.physical_us) + sizeof(hclock.logical),
         &hclock.node_id, sizeof(hclock.node_id));
-    wal_insert(key, value_copy);
-    internal_insert(key, value_copy);
+    {
+        std::shared_lock lock(memtable_mutex_);
+        wal_insert(key, value_copy);
+        internal_insert(key, value_copy);
+    }
+    maybe_switch_memtable();
 }
 
-auto Database::internal_find(std::string_view key)
-    -> std::optional<std::string_view> {
-    std::vector<std::string_view> values;
+auto Database::write(const write_batch::WriteBatch &batch) -> void {
+    if (batch.empty()) {
+        return;
+    }
     {
         std::shared_lock lock(memtable_mutex_);
-        auto res = memtable_->find(key);
-        values.insert(values.end(), res.begin(), res.end());
+        Shard *shard = cpu_id_ == 0 ? reset_shard() : get_shard(cpu_id_);
+        shard->wal->append_batch(batch.data(), batch.count());
+        // not gated from readers, which may see the entries inserted so far
+        write_batch::WriteBatch::for_each(
+            batch.data(), [&](std::string_view key, std::string_view value) {
+                internal_insert(key, value);
+            });
+    }
+    maybe_switch_memtable();
+}
+
+auto Database::get_snapshot() -> Snapshot {
+    auto now = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch());
+    // sees every write up to now, whatever its logical time and node
+    return get_snapshot({static_cast<uint64_t>(now.count()),
+                         std::numeric_limits<uint16_t>::max(),
+                         std::numeric_limits<uint32_t>::max()});
+}
+
+auto Database::get_snapshot(hlc::HLC ts) -> Snapshot {
+    std::scoped_lock lock(snapshots_mutex_);
+    return Snapshot(*this, snapshots_.insert(ts));
+}
+
+auto Database::new_iterator() -> Iterator {
+    std::vector<std::unique_ptr<iterator::Iterator>> children;
+    auto super_version = get_super_version();
+    for (const auto &memtable : super_version->memtables) {
+        children.push_back(
+            std::make_unique<iterator::MemTableIterator>(memtable));
+    }
+    // tables in level 0 may overlap, but those of each deeper level do not
+    const auto &levels = super_version->levels;
+    for (const auto &meta : levels[0]) {
+        children.push_back(std::make_unique<iterator::TableIterator>(
+            table_cache_.get(meta.id)));
+    }
+    for (const auto &level : levels | std::views::drop(1)) {
+        if (level.empty()) {
+            continue;
+        }
+        // holds the files so that the tables it opens later are not removed
+        std::vector<std::string> largest;
+        std::vector<std::shared_ptr<TableFile>> files;
+        for (const auto &meta : level) {
+            largest.push_back(meta.largest);
+            files.push_back(super_version->files.at(meta.id));
+        }
+        children.push_back(std::make_unique<iterator::LevelIterator>(
+            std::move(largest), [this, files = std::move(files)](size_t i) {
+                return table_cache_.get(files[i]->id);
+            }));
+    }
+    return Iterator(std::move(children));
+}
+
+auto Database::scan(std::string_view begin, std::string_view end)
+    -> std::vector<std::pair<std::string, std::string>> {
+    std::vector<std::pair<std::string, std::string>> pairs;
+    auto it = new_iterator();
+    for (it.seek(begin); it.valid() && it.key() < end; it.next()) {
+        pairs.emplace_back(it.key(), it.value());
+    }
+    return pairs;
+}
+
+auto Database::block_cache() const -> const cache::BlockCache * {
+    return block_cache_.get();
+}
+
+auto Database::wal_stats() const -> wal::Stats {
+    wal::Stats stats;
+    for (const auto &shard : shards_) {
+        auto shard_stats = shard.wal->stats();
+        stats.records += shard_stats.records;
+        stats.groups += shard_stats.groups;
+        stats.max_group_size =
+            std::max(stats.max_group_size, shard_stats.max_group_size);
+        stats.syncs += shard_stats.syncs;
+        stats.sync_time += shard_stats.sync_time;
+    }
+    return stats;
+}
+
+auto Database::compaction_stats() const -> CompactionStats {
+    return {compactions_, subcompactions_, max_subcompactions_};
+}
+
+auto Database::tables(size_t level) -> std::vector<TableMeta> {
+    std::shared_lock lock(sstables_mutex_);
+    if (level >= sstables_.size()) {
+        return {};
+    }
+    return sstables_[level];
+}
+
+auto Database::recover_wals() -> void {
+    std::vector<wal::Reader> wals;
+    for (uint64_t number : wal_segments_->live()) {
+        wal::Reader wal(wal_segments_->path(number), number);
+        if (wal.next()) {
+            wals.push_back(std::move(wal));
+        }
     }
+
+    // Each segment is in operation order, so a heap of the segments by their
+    // next record replays every record in operation order. Records go straight
+    // into the memtable, and full memtables are flushed by the workers while
+    // replay goes on.
+    auto later = [&](size_t a, size_t b) { return wals[a].oid > wals[b].oid; };
+    std::vector<size_t> heap(wals.size());
+    std::iota(heap.begin(), heap.end(), size_t{0});
+    std::ranges::make_heap(heap, later);
+    size_t next_oid = operation_id_;
+    while (!heap.empty()) {
+        std::ranges::pop_heap(heap, later);
+        auto &wal = wals[heap.back()];
+        size_t count = 1;
+        switch (wal.op) {
+            case wal::Op::insert:
+                memtable_->insert(wal.key, wal.value);
+                break;
+            case wal::Op::erase:
+                internal_erase(wal.key);
+                break;
+            case wal::Op::batch:
+                count = write_batch::WriteBatch::for_each(
+                    std::as_bytes(std::span(wal.value)),
+                    [&](std::string_view key, std::string_view value) {
+                        memtable_->insert(key, value);
+                    });
+                break;
+            default:
+                throw std::runtime_error(
+                    std::format("Unknown op {} in {}",
+                                static_cast<size_t>(wal.op),
+                                wal.path().c_str()));
+        }
+        next_oid = std::max(next_oid, wal.oid + count);
+        if (memtable_->size() > options_.flush_threshold) {
+            queue_.enqueue_memtable(std::move(memtable_));
+            memtable_ =
+                std::make_shared<memtable::MemTable<memtable::KVSkipList>>();
+            publish_super_version(memtable_);
+        }
+        if (wal.next()) {
+            std::ranges::push_heap(heap, later);
+        } else {
+            heap.pop_back();
+        }
+    }
+    operation_id_ = next_oid;
+
+    // the segments are recycled once the database opens, so every record
+    // must be in a table by then
+    if (memtable_->size() > 0) {
+        queue_.enqueue_memtable(std::move(memtable_));
+        memtable_ =
+            std::make_shared<memtable::MemTable<memtable::KVSkipList>>();
+        publish_super_version(memtable_);
+    }
+    queue_.wait();
+}
+
+auto Database::internal_find(std::string_view key, std::optional<hlc::HLC> at)
+    -> std::optional<PinnableValue> {
+    // Each memtable or table that holds versions of the key is kept along
+    // with where its versions end, so that the one backing the result is
+    // pinned by it.
+    struct Source {
+        size_t end;
+        std::shared_ptr<const void> owner;
+        std::vector<cache::BlockCache::Handle> blocks;
+    };
+
+    std::vector<std::string_view> values;
+    std::vector<Source> sources;
+    auto pin = [&]() -> std::optional<PinnableValue> {
+        auto i = latest(values, at);
+        if (!i.has_value()) {
+            return std::nullopt;
+        }
+        auto source = std::ranges::upper_bound(sources, *i, {}, &Source::end);
+        return PinnableValue(values[*i].substr(CLOCK_SIZE),
+                             decode_clock(values[*i]), std::move(source->owner),
+                             std::move(source->blocks));
+    };
+    auto super_version = get_super_version();
+    for (const auto &memtable : super_version->memtables) {
+        auto res = memtable->find(key);
+        if (!res.empty()) {
+            values.insert(values.end(), res.begin(), res.end());
+            sources.push_back({values.size(), memtable, {}});
+        }
+    }
+
+    // Replicas write with their own HLCs, so an older version may land in a
+    // newer memtable or level than a newer one. Every level is checked, and
+    // the versions of them all are resolved together. Tables in level 0 may
+    // overlap, so each one whose range holds the key is checked, while
+    // deeper levels have at most one such table.
+    auto find_in = [&](const TableMeta &meta) {
+        auto table = table_cache_.get(meta.id);
+        std::vector<cache::BlockCache::Handle> blocks;
+        if (table->find(key, values, blocks)) {
+            sources.push_back(
+                {values.size(), std::move(table), std::move(blocks)});
+        }
+    };
+    const auto &levels = super_version->levels;
+    for (const auto &meta : std::views::reverse(levels[0])) {
+        if (meta.smallest <= key && key <= meta.largest) {
+            find_in(meta);
+        }
+    }
+    for (size_t level = 1; level < levels.size(); ++level) {
+        const auto &tables = levels[level];
+        auto it =
+            std::ranges::lower_bound(tables, key, {}, &TableMeta::largest);
+        if (it != tables.end() && it->smallest <= key) {
+            find_in(*it);
+        }
+    }
+    return pin();
+}
+
+auto Database::local_state() -> LocalState & {
+    for (const auto &state : local_states_) {
+        if (state->db_id == id_) {
+            return *state;
+        }
+    }
+    // forgets the databases closed since the thread last read from one
+    std::erase_if(local_states_,
+                  [](const auto &state) { return state->closed.load(); });
+    auto state = std::make_shared<LocalState>();
+    state->db_id = id_;
     {
-        queue_.find(key, values);
+        std::scoped_lock lock(thread_states_mutex_);
+        thread_states_.push_back(state);
     }
-    if (values.empty()) {
-        return std::nullopt;
+    local_states_.push_back(std::move(state));
+    return *local_states_.back();
+}
+
+auto Database::get_super_version() -> SuperVersionHandle {
+    // Only a new super version takes the lock, to share in it. Otherwise,
+    // a read only swaps the thread's own reference out and back in.
+    auto &local = local_state();
+    auto *ref = local.super_version.exchange(&in_use_);
+    if (ref == &in_use_) {
+        // an enclosing read on the thread has it
+        ref = nullptr;
+    }
+    if (ref == nullptr ||
+        (*ref)->number !=
+            super_version_number_.load(std::memory_order_acquire)) {
+        delete ref;
+        std::scoped_lock lock(super_version_mutex_);
+        ref = new std::shared_ptr<const SuperVersion>(super_version_);
     }
+    return SuperVersionHandle(local, ref);
+}
+
+auto Database::publish_super_version(
+    std::shared_ptr<memtable::MemTable<memtable::KVSkipList>> memtable)
+    -> void {
     {
-        std::scoped_lock lock(filters_mutex_, sstables_mutex_);
-        for (const auto &sstable : sstables_[0]) {
-            auto it = filters_.find(sstable);
-            if (it == filters_.end()) {
-                continue;
+        std::scoped_lock lock(super_version_mutex_);
+        auto super_version = std::make_shared<SuperVersion>();
+        super_version->number = super_version_number_ + 1;
+        super_version->memtables.push_back(
+            memtable ? std::move(memtable)
+                     : super_version_->memtables.front());
+        std::ranges::move(queue_.memtables(),
+                          std::back_inserter(super_version->memtables));
+        {
+            std::shared_lock sstables_lock(sstables_mutex_);
+            super_version->levels = sstables_;
+            super_version->files = table_files_;
+        }
+        super_version_ = std::move(super_version);
+        super_version_number_.store(super_version_->number,
+                                    std::memory_order_release);
+    }
+    // threads that read again take the new one, and the others no longer
+    // keep the old one alive
+    drop_thread_states(false);
+}
+
+auto Database::drop_thread_states(bool close) -> void {
+    std::vector<std::shared_ptr<const SuperVersion> *> refs;
+    {
+        std::scoped_lock lock(thread_states_mutex_);
+        for (const auto &state : thread_states_) {
+            // a read that has the reference drops it itself once done
+            auto *ref = state->super_version.exchange(nullptr);
+            if (ref != &in_use_) {
+                refs.push_back(ref);
             }
-            if (it->second->contains(std::string(key))) {
+            if (close) {
+                state->pinned_value.reset();
+                state->pinned.clear();
+                state->pinned_blocks.clear();
+                state->closed = true;
             }
         }
+        if (close) {
+            thread_states_.clear();
+        } else {
+            // the states of threads that have exited are only held here
+            std::erase_if(thread_states_, [](const auto &state) {
+                return state.use_count() == 1;
+            });
+        }
     }
+    // the super versions are freed outside the lock
+    for (auto *ref : refs) {
+        delete ref;
+    }
+}
 
-    // convert values and get the starting HLC and put into HLC struct
-
-    struct Item {
-        std::string_view value;
-        hlc::HLC clock;
-    };
+Database::TableFile::~TableFile() {
+    if (obsolete) {
+        table_cache.evict(id);
+        // a destructor must not throw, and the file is garbage either way
+        std::error_code error;
+        fs::remove(table_cache.path(id), error);
+    }
+}
 
-    std::vector<Item> hclocks;
-    hclocks.reserve(values.size());
-    for (const auto &value : values) {
-        hlc::HLC hclock;
-        std::memcpy(&hclock.physical_us, value.data(),
-                    sizeof(hclock.physical_us));
-        std::memcpy(&hclock.logical, value.data() + sizeof(hclock.physical_us),
-                    sizeof(hclock.logical));
-        std::memcpy(
-            &hclock.node_id,
-            value.data() + sizeof(hclock.physical_us) + sizeof(hclock.logical),
-            sizeof(hclock.node_id));
-        hclocks.push_back({value, hclock});
-        std::println("HLC: {} {} {}", hclock.physical_us, hclock.logical,
-                     hclock.node_id);
-    }
-    auto value = hlc::lww_select(std::move(hclocks));
-    if (!value.has_value()) {
-        return std::nullopt;
+Database::LocalState::~LocalState() {
+    auto *ref = super_version.load();
+    if (ref != &in_use_) {
+        delete ref;
     }
-    size_t erase_size = sizeof(Item::clock.physical_us) +
-                        sizeof(Item::clock.logical) +
-                        sizeof(Item::clock.node_id);
-    if (value->value.size() <= erase_size) {
-        return std::nullopt;
+}
+
+Database::SuperVersionHandle::SuperVersionHandle(
+    LocalState &local, std::shared_ptr<const SuperVersion> *ref)
+    : local_(local), ref_(ref) {
+}
+
+Database::SuperVersionHandle::~SuperVersionHandle() {
+    // unless a publish dropped the thread's reference in the meantime, in
+    // which case this one is out of date
+    auto *expected = &in_use_;
+    if (!local_.super_version.compare_exchange_strong(expected, ref_)) {
+        delete ref_;
     }
-    return std::string_view{
-        value->value.data() + sizeof(Item::clock.physical_us) +
-            sizeof(Item::clock.logical) + sizeof(Item::clock.node_id),
-        value->value.size() -
-            (sizeof(Item::clock.physical_us) + sizeof(Item::clock.logical) +
-             sizeof(Item::clock.node_id))};
+}
+
+auto Database::SuperVersionHandle::operator->() const -> const SuperVersion * {
+    return ref_->get();
 }
 
 auto Database::internal_insert(std::string_view key, std::string_view value)
     -> void {
     memtable_->insert(key, value);
-    if (memtable_->size() > options_.flush_threshold) {
-        std::unique_lock lock(memtable_mutex_);
-        queue_.enqueue_memtable(std::move(memtable_));
-        memtable_ =
-            std::make_shared<memtable::MemTable<memtable::KVSkipList>>();
-    }
 }
 
 auto Database::internal_erase(std::string_view key) -> void {
@@ -314,38 +752,57 @@ auto Database::internal_erase(std::string_view key) -> void {
 
 auto Database::wal_insert(std::string_view key, std::string_view value)
     -> void {
-    Shard *shard = get_shard(cpu_id_);
-    if (!shard->mutex.try_lock()) {
-        shard = reset_shard();
-        shard->mutex.lock();
-    }
-    std::unique_lock shard_lock(shard->mutex, std::adopt_lock);
-    size_t ot = 0;
-    fwrite(&ot, sizeof(size_t), 1, shard->file);
-    size_t oid = operation_id_.fetch_add(1);
-    fwrite(&oid, sizeof(size_t), 1, shard->file);
-    size_t key_size = key.size();
-    fwrite(&key_size, sizeof(size_t), 1, shard->file);
-    fwrite(key.data(), sizeof(char), key_size, shard->file);
-    size_t value_size = value.size();
-    fwrite(&value_size, sizeof(size_t), 1, shard->file);
-    fwrite(value.data(), sizeof(char), value_size, shard->file);
+    // concurrent writers to a shard commit as a group
+    Shard *shard = cpu_id_ == 0 ? reset_shard() : get_shard(cpu_id_);
+    shard->wal->append(wal::Op::insert, key, value);
 }
 
 auto Database::wal_erase(std::string_view key) -> void {
-    Shard *shard = get_shard(cpu_id_);
-    if (!shard->mutex.try_lock()) {
-        shard = reset_shard();
-        shard->mutex.lock();
+    Shard *shard = cpu_id_ == 0 ? reset_shard() : get_shard(cpu_id_);
+    shard->wal->append(wal::Op::erase, key, {});
+}
+
+auto Database::maybe_switch_memtable() -> void {
+    {
+        std::shared_lock lock(memtable_mutex_);
+        if (memtable_->size() <= options_.flush_threshold) {
+            return;
+        }
+    }
+    std::unique_lock lock(memtable_mutex_);
+    // another writer may have switched it first
+    if (memtable_->size() <= options_.flush_threshold) {
+        return;
+    }
+    // no write is between its WAL append and its memtable insert, so the
+    // segments rolled now hold exactly the records of this memtable
+    std::vector<uint64_t> segments;
+    for (auto &shard : shards_) {
+        auto closed = shard.wal->roll();
+        segments.insert(segments.end(), closed.begin(), closed.end());
+    }
+    {
+        std::scoped_lock segments_lock(memtable_segments_mutex_);
+        memtable_segments_.emplace(memtable_.get(), std::move(segments));
     }
-    std::unique_lock shard_lock(shard->mutex, std::adopt_lock);
-    size_t ot = 1;
-    fwrite(&ot, sizeof(size_t), 1, shard->file);
-    size_t oid = operation_id_.fetch_add(1);
-    fwrite(&oid, sizeof(size_t), 1, shard->file);
-    size_t key_size = key.size();
-    fwrite(&key_size, sizeof(size_t), 1, shard->file);
-    fwrite(key.data(), sizeof(char), key_size, shard->file);
+    queue_.enqueue_memtable(std::move(memtable_));
+    memtable_ = std::make_shared<memtable::MemTable<memtable::KVSkipList>>();
+    // published before any write can reach the new memtable
+    publish_super_version(memtable_);
+}
+
+auto Database::release_segments(
+    const memtable::MemTable<memtable::KVSkipList> *memtable) -> void {
+    std::vector<uint64_t> segments;
+    {
+        std::scoped_lock lock(memtable_segments_mutex_);
+        auto node = memtable_segments_.extract(memtable);
+        if (node.empty()) {
+            return;
+        }
+        segments = std::move(node.mapped());
+    }
+    wal_segments_->release(segments);
 }
 
 inline auto Database::get_shard(size_t cpu_id) const -> Shard * {
@@ -361,129 +818,502 @@ inline auto Database::reset_shard() -> Shard * {
     return get_shard(cpu_id);
 }
 
-auto Database::compact(std::deque<size_t> &level_ssts) -> void {
-    if (level_ssts.empty()) return;
+auto Database::wait_for_background_work() -> void {
+    queue_.wait();
+}
 
-    std::unique_lock read_lk(sstables_mutex_);
-    auto lvl_it = std::find_if(sstables_.begin(), sstables_.end(),
-                               [&](auto &dq) { return &dq == &level_ssts; });
-    if (lvl_it == sstables_.end()) {
-        // shouldn't happen
-        return;
+auto Database::maybe_compact() -> void {
+    std::scoped_lock compaction_lock(compaction_mutex_);
+    for (;;) {
+        std::optional<Compaction> compaction;
+        {
+            std::shared_lock lock(sstables_mutex_);
+            compaction = pick_compaction();
+        }
+        if (!compaction.has_value()) {
+            return;
+        }
+        compact(*compaction);
     }
-    auto next_it = std::next(lvl_it);
-    read_lk.unlock();
-
-    std::map<std::string, std::vector<char>> merged;
-    for (size_t sst_id : level_ssts) {
-        fs::path p = data_path_ / std::format("{}.sst", sst_id);
-        FILE *in = fopen(p.c_str(), "rb");
-        if (!in)
-            throw std::runtime_error("Failed to open SSTable for compaction");
+}
 
-        fseek(in, -static_cast<long>(sizeof(size_t)), SEEK_END);
-        size_t entry_count;
-        std::ignore = fread(&entry_count, sizeof(size_t), 1, in);
+auto Database::pick_compaction() const -> std::optional<Compaction> {
+    switch (options_.compaction_style) {
+        case CompactionStyle::leveled:
+            return pick_leveled_compaction();
+        case CompactionStyle::universal:
+            return pick_universal_compaction();
+    }
+    return std::nullopt;
+}
 
-        long idx_pos = -static_cast<long>(sizeof(size_t) * (entry_count + 1));
-        fseek(in, idx_pos, SEEK_END);
-        std::vector<size_t> offsets(entry_count);
-        std::ignore = fread(offsets.data(), sizeof(size_t), entry_count, in);
+auto Database::pick_leveled_compaction() const -> std::optional<Compaction> {
+    // the last level has nowhere to compact into
+    size_t level = 0;
+    double score = 0;
+    for (size_t i = 0; i + 1 < sstables_.size(); ++i) {
+        double level_score = compaction_score(i);
+        if (level_score > score) {
+            level = i;
+            score = level_score;
+        }
+    }
+    if (score < 1) {
+        return std::nullopt;
+    }
 
-        // read bloom-filter size just before index[]
-        fseek(in, idx_pos - static_cast<long>(sizeof(size_t)), SEEK_END);
-        size_t bf_sz;
-        std::ignore = fread(&bf_sz, sizeof(size_t), 1, in);
+    Compaction compaction{{}, level + 1};
+    const auto &tables = sstables_[level];
+    if (level == 0) {
+        // tables in level 0 may overlap each other, so they all go together
+        compaction.inputs = tables;
+    } else {
+        auto it = std::ranges::upper_bound(tables, compact_pointers_[level], {},
+                                           &TableMeta::largest);
+        compaction.inputs.push_back(it == tables.end() ? tables.front() : *it);
+    }
+    // copied, since adding to the inputs moves them
+    std::string smallest = compaction.inputs.front().smallest;
+    std::string largest = compaction.inputs.front().largest;
+    for (const auto &input : compaction.inputs) {
+        smallest = std::min(smallest, input.smallest);
+        largest = std::max(largest, input.largest);
+    }
+    for (const auto &meta : sstables_[level + 1]) {
+        if (overlaps(meta, smallest, largest)) {
+            compaction.inputs.push_back(meta);
+        }
+    }
+    return compaction;
+}
 
-        long data_end = idx_pos - static_cast<long>(sizeof(size_t)) -
-                        static_cast<long>(bf_sz);
+auto Database::pick_universal_compaction() const -> std::optional<Compaction> {
+    struct Run {
+        std::span<const TableMeta> tables;
+        size_t level;
+        size_t size;
+    };
 
-        for (size_t i = 0; i < entry_count; ++i) {
-            size_t start = offsets[i];
-            size_t end = (i + 1 < entry_count ? offsets[i + 1] : data_end);
-            size_t seq_sz = end - start;
+    // each level 0 table is a run of its own
+    std::vector<Run> runs;
+    for (const auto &meta : std::views::reverse(sstables_[0])) {
+        runs.push_back({{&meta, 1}, 0, meta.file_size});
+    }
+    for (size_t level = 1; level < sstables_.size(); ++level) {
+        const auto &tables = sstables_[level];
+        if (tables.empty()) {
+            continue;
+        }
+        size_t size = 0;
+        for (const auto &meta : tables) {
+            size += meta.file_size;
+        }
+        runs.push_back({tables, level, size});
+    }
+    size_t trigger = std::max(options_.level0_compaction_trigger, size_t{2});
+    if (runs.size() < trigger) {
+        return std::nullopt;
+    }
 
-            std::vector<char> buf(seq_sz);
-            fseek(in, start, SEEK_SET);
-            std::ignore = fread(buf.data(), 1, seq_sz, in);
+    // Merges every run once the newer runs take too much space next to the
+    // oldest one, which holds most of the data. Otherwise, merges the newest
+    // runs while each next one is not much bigger than those before it, and
+    // failing that, merges just enough of the newest runs to drop below the
+    // trigger.
+    size_t newer_size = 0;
+    for (const auto &run : runs | std::views::take(runs.size() - 1)) {
+        newer_size += run.size;
+    }
+    size_t width = 1;
+    if (newer_size * 100 >= options_.universal_max_size_amplification_percent *
+                                runs.back().size) {
+        width = runs.size();
+    } else {
+        size_t size = runs[0].size;
+        while (width < runs.size() &&
+               runs[width].size * 100 <=
+                   size * (100 + options_.universal_size_ratio)) {
+            size += runs[width].size;
+            ++width;
+        }
+        if (width < 2) {
+            width = runs.size() - trigger + 2;
+        }
+    }
 
-            // interpret buf.data() as arena‐sequence
-            auto *ptr =
-                reinterpret_cast<memtable::KVStore::ptr_type>(buf.data());
-            // extract key and value spans
-            auto key_span = memtable::KVStore::get_key(ptr);
-            auto val_span = memtable::KVStore::get_value(ptr);
-            auto *raw_b = val_span.data();  // std::byte*
-            auto raw_n = val_span.size();   // size_t
+    // The outputs replace the oldest run merged. When that is a level 0
+    // table, they stay in level 0 if older tables remain there, and otherwise
+    // become a new level right below it.
+    Compaction compaction{{}, 0};
+    for (const auto &run : runs | std::views::take(width)) {
+        compaction.inputs.insert(compaction.inputs.end(), run.tables.begin(),
+                                 run.tables.end());
+        compaction.output_level = run.level;
+    }
+    if (compaction.output_level == 0 && width == sstables_[0].size()) {
+        compaction.output_level = 1;
+        compaction.new_level = true;
+    }
+    return compaction;
+}
 
-            merged[std::string(reinterpret_cast<const char *>(key_span.data()),
-                               key_span.size())] =
-                std::vector<char>(
-                    reinterpret_cast<const char *>(raw_b),
-                    reinterpret_cast<const char *>(raw_b) + raw_n);
+auto Database::compact(const Compaction &compaction) -> void {
+    size_t output_level = compaction.output_level;
+    auto is_input = [&](const TableMeta &meta) {
+        return std::ranges::any_of(compaction.inputs,
+                                   [&](const TableMeta &input) {
+                                       return input.id == meta.id;
+                                   });
+    };
+    // only leveled compaction moves through a level by its pointer
+    auto advance_pointer = [&]() {
+        if (options_.compaction_style == CompactionStyle::leveled &&
+            output_level > 0) {
+            compact_pointers_[output_level - 1] =
+                compaction.inputs.front().largest;
         }
+    };
 
-        fclose(in);
+    if (compaction.inputs.size() == 1 && !compaction.new_level) {
+        // moves the table down a level without rewriting it
+        std::scoped_lock lock(manifest_mutex_);
+        auto levels = sstables_;
+        std::erase_if(levels[output_level - 1], is_input);
+        levels[output_level].push_back(compaction.inputs.front());
+        std::ranges::sort(levels[output_level], {}, &TableMeta::smallest);
+        install(std::move(levels));
+        advance_pointer();
+        return;
     }
 
+    std::vector<std::shared_ptr<sstable::SSTable>> inputs;
+    std::vector<std::string_view> boundaries;
+    size_t input_count = 0;
+    size_t input_size = 0;
+    for (const auto &meta : compaction.inputs) {
+        auto input = table_cache_.get(meta.id);
+        input->advise(sstable::Access::sequential);
+        input_count += input->size();
+        input_size += input->file_size();
+        std::ranges::copy(input->boundaries(), std::back_inserter(boundaries));
+        inputs.push_back(std::move(input));
+    }
+    size_t expected_count =
+        std::min(input_count, input_count * options_.target_file_size /
+                                      std::max(input_size, size_t{1}) +
+                                  1);
+    std::vector<hlc::HLC> snapshots;
     {
-        std::scoped_lock write_lk(sstables_mutex_, filters_mutex_);
-        for (size_t id : level_ssts) {
-            fs::remove(data_path_ / std::format("{}.sst", id));
-            filters_.erase(id);
+        std::scoped_lock lock(snapshots_mutex_);
+        snapshots.assign(snapshots_.begin(), snapshots_.end());
+    }
+    std::optional<uint64_t> tombstone_horizon;
+    {
+        std::shared_lock lock(sstables_mutex_);
+        if (is_bottommost(compaction)) {
+            auto now = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::system_clock::now().time_since_epoch());
+            tombstone_horizon = (now - options_.tombstone_grace_period).count();
         }
-        level_ssts.clear();
     }
 
-    auto temp_mt = std::make_shared<memtable::MemTable<memtable::KVSkipList>>();
-    for (auto &[key, val_bytes] : merged) {
-        temp_mt->insert(key,
-                        std::string_view(val_bytes.data(), val_bytes.size()));
+    // Splits the inputs at block boundaries into ranges of about equal size,
+    // each worth at least one output, and merges them in parallel. The caller
+    // merges ranges too, so the compaction finishes even if every worker is
+    // busy, and workers that start after every range is taken do nothing.
+    std::ranges::sort(boundaries);
+    auto [last, end] = std::ranges::unique(boundaries);
+    boundaries.erase(last, end);
+    size_t num_ranges = std::clamp(
+        std::min(input_size / std::max(options_.target_file_size, size_t{1}),
+                 boundaries.size()),
+        size_t{1}, std::max(options_.max_subcompactions, size_t{1}));
+    std::vector<std::string> splits;
+    for (size_t i = 1; i < num_ranges; ++i) {
+        splits.emplace_back(boundaries[i * boundaries.size() / num_ranges]);
     }
+    // compactions run one at a time, under compaction_mutex_
+    ++compactions_;
+    subcompactions_ += num_ranges;
+    max_subcompactions_ = std::max(max_subcompactions_.load(), num_ranges);
 
-    size_t new_id = unused_sst_id_++;
-    fs::path out_path = data_path_ / std::format("{}.sst", new_id);
-    FILE *out = fopen(out_path.c_str(), "wb");
-    if (!out) throw std::runtime_error("Failed to create compacted SSTable");
-
-    // build bloom & offsets as in process_memtable()
-    auto bf = std::make_shared<filter::BloomFilter>(temp_mt->size() * 2, 3);
-    std::vector<size_t> new_offsets;
-    size_t cursor = 0;
+    struct Subcompactions {
+        std::function<void(size_t)> run;
+        std::atomic<size_t> next = 0;
+        std::vector<std::vector<TableMeta>> outputs;
+        std::exception_ptr error;
+        size_t done = 0;
+        std::mutex mutex;
+        std::condition_variable cv;
+    };
+    auto subcompactions = std::make_shared<Subcompactions>();
+    subcompactions->outputs.resize(num_ranges);
+    subcompactions->run = [&](size_t i) {
+        std::optional<std::string_view> lower;
+        std::optional<std::string_view> upper;
+        if (i > 0) {
+            lower = splits[i - 1];
+        }
+        if (i < splits.size()) {
+            upper = splits[i];
+        }
+        subcompactions->outputs[i] =
+            compact_range(inputs, output_level, lower, upper, expected_count,
+                          tombstone_horizon, snapshots);
+    };
+    auto work = [num_ranges](const std::shared_ptr<Subcompactions> &state) {
+        for (size_t i; (i = state->next++) < num_ranges;) {
+            std::exception_ptr error;
+            try {
+                state->run(i);
+            } catch (...) {
+                error = std::current_exception();
+            }
+            std::scoped_lock lock(state->mutex);
+            if (error && !state->error) {
+                state->error = error;
+            }
+            ++state->done;
+            state->cv.notify_all();
+        }
+    };
+    for (size_t i = 1; i < num_ranges; ++i) {
+        queue_.submit([work, subcompactions]() { work(subcompactions); });
+    }
+    work(subcompactions);
+    {
+        std::unique_lock lock(subcompactions->mutex);
+        subcompactions->cv.wait(
+            lock, [&]() { return subcompactions->done == num_ranges; });
+    }
+    std::vector<TableMeta> outputs;
+    for (const auto &range_outputs : subcompactions->outputs) {
+        outputs.insert(outputs.end(), range_outputs.begin(),
+                       range_outputs.end());
+    }
+    if (subcompactions->error) {
+        for (const auto &meta : outputs) {
+            table_cache_.evict(meta.id);
+            fs::remove(table_cache_.path(meta.id));
+        }
+        std::rethrow_exception(subcompactions->error);
+    }
 
-    for (auto ptr : *temp_mt) {
-        // ptr is a KVStore::ptr_type pointing to the raw sequence
-        size_t seq_sz = memtable::KVStore::get_size(ptr);
-        // write raw sequence bytes exactly
-        auto *data_ptr = reinterpret_cast<const char *>(ptr);
-        fwrite(data_ptr, 1, seq_sz, out);
+    // installs the outputs before dropping the inputs so that no key is ever
+    // missing from reads
+    try {
+        std::scoped_lock lock(manifest_mutex_);
+        auto levels = sstables_;
+        for (auto &level : levels) {
+            std::erase_if(level, is_input);
+        }
+        if (compaction.new_level) {
+            levels.insert(levels.begin() + output_level, outputs);
+        } else {
+            auto &level = levels[output_level];
+            level.insert(level.end(), outputs.begin(), outputs.end());
+            if (output_level > 0) {
+                std::ranges::sort(level, {}, &TableMeta::smallest);
+            }
+        }
+        if (options_.compaction_style == CompactionStyle::universal) {
+            // drops the levels of runs that were merged into older ones
+            auto empty = std::ranges::remove_if(
+                levels | std::views::drop(1),
+                [](const auto &level) { return level.empty(); });
+            levels.erase(empty.begin(), empty.end());
+        }
+        install(std::move(levels));
+    } catch (...) {
+        for (const auto &meta : outputs) {
+            table_cache_.evict(meta.id);
+            fs::remove(table_cache_.path(meta.id));
+        }
+        throw;
+    }
+    advance_pointer();
+}
 
-        // update bloom + offsets
-        auto key_span = memtable::KVStore::get_key(ptr);
-        bf->add(std::string_view(
-            reinterpret_cast<const char *>(key_span.data()), key_span.size()));
-        new_offsets.push_back(cursor);
-        cursor += seq_sz;
+auto Database::compact_range(
+    const std::vector<std::shared_ptr<sstable::SSTable>> &inputs,
+    size_t output_level, std::optional<std::string_view> lower,
+    std::optional<std::string_view> upper, size_t expected_count,
+    std::optional<uint64_t> tombstone_horizon,
+    std::span<const hlc::HLC> snapshots) -> std::vector<TableMeta> {
+    // Streams a merge of the inputs into outputs of about target_file_size
+    // each, so memory is bounded by the blocks being read and the filter of
+    // the output being built. Only the versions of each key that reads would
+    // resolve to, now or through a snapshot, are written, so the outputs do
+    // not overlap.
+    std::vector<std::unique_ptr<iterator::Iterator>> children;
+    for (const auto &input : inputs) {
+        children.push_back(std::make_unique<iterator::TableIterator>(input));
+    }
+    iterator::MergingIterator merged(std::move(children));
+    if (lower.has_value()) {
+        merged.seek(*lower);
+        while (merged.valid() && merged.key() == *lower) {
+            merged.next();
+        }
+    } else {
+        merged.seek_to_first();
     }
 
-    size_t bf_size = bf->save(out);
-    fwrite(&bf_size, sizeof(size_t), 1, out);
+    struct Item {
+        std::string_view value;
+        hlc::HLC clock;
+    };
 
-    size_t cnt = new_offsets.size();
-    fwrite(new_offsets.data(), sizeof(size_t), cnt, out);
-    fwrite(&cnt, sizeof(size_t), 1, out);
+    std::vector<TableMeta> outputs;
+    std::optional<sstable::SSTableBuilder> builder;
+    size_t builder_id = 0;
+    auto finish_output = [&]() {
+        builder->finish();
+        builder.reset();
+        outputs.push_back(table_meta(*table_cache_.get(builder_id)));
+    };
+    std::string key;
+    std::vector<Item> versions;
+    std::vector<bool> keep;
+    while (merged.valid() && (!upper.has_value() || merged.key() <= *upper)) {
+        key = merged.key();
+        versions.clear();
+        for (; merged.valid() && merged.key() == key; merged.next()) {
+            versions.push_back({merged.value(), decode_clock(merged.value())});
+        }
+        // Shadowed versions can never be read again unless a snapshot sees
+        // them, and nothing is left for a tombstone to hide once it is in the
+        // bottommost level and past the horizon, after which no replica
+        // should still send older versions.
+        auto latest = hlc::lww_select(versions.begin(), versions.end());
+        keep.assign(versions.size(), false);
+        keep[latest - versions.begin()] = true;
+        size_t num_kept = 1;
+        for (const auto &snapshot : snapshots) {
+            size_t visible = versions.size();
+            for (size_t i = 0; i < versions.size(); ++i) {
+                if (versions[i].clock <= snapshot &&
+                    (visible == versions.size() ||
+                     versions[visible].clock < versions[i].clock)) {
+                    visible = i;
+                }
+            }
+            if (visible < versions.size() && !keep[visible]) {
+                keep[visible] = true;
+                ++num_kept;
+            }
+        }
+        if (num_kept == 1 && latest->value.size() <= CLOCK_SIZE &&
+            tombstone_horizon.has_value() &&
+            latest->clock.physical_us < *tombstone_horizon) {
+            continue;
+        }
+        if (builder.has_value() &&
+            builder->file_size() >= options_.target_file_size) {
+            finish_output();
+        }
+        if (!builder.has_value()) {
+            builder_id = unused_sst_id_++;
+            builder.emplace(table_cache_.path(builder_id), expected_count,
+                            options_.block_size, filter_policy(output_level));
+        }
+        for (size_t i = 0; i < versions.size(); ++i) {
+            if (keep[i]) {
+                builder->add(key, versions[i].value);
+            }
+        }
+    }
+    if (builder.has_value()) {
+        finish_output();
+    }
+    return outputs;
+}
 
-    fclose(out);
+auto Database::is_bottommost(const Compaction &compaction) const -> bool {
+    std::string_view smallest = compaction.inputs.front().smallest;
+    std::string_view largest = compaction.inputs.front().largest;
+    for (const auto &input : compaction.inputs) {
+        smallest = std::min<std::string_view>(smallest, input.smallest);
+        largest = std::max<std::string_view>(largest, input.largest);
+    }
+    // Tables older than the outputs are in deeper levels, and in level 0,
+    // before the outputs, which only universal compaction leaves there. A
+    // new level goes above the level at output_level.
+    size_t deeper = compaction.new_level ? compaction.output_level
+                                         : compaction.output_level + 1;
+    for (size_t level = 0; level < sstables_.size(); ++level) {
+        if (level > 0 && level < deeper) {
+            continue;
+        }
+        if (level == 0 && compaction.output_level > 0) {
+            continue;
+        }
+        for (const auto &meta : sstables_[level]) {
+            bool is_input = std::ranges::any_of(
+                compaction.inputs,
+                [&](const TableMeta &input) { return input.id == meta.id; });
+            if (!is_input && overlaps(meta, smallest, largest)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
 
+auto Database::install(std::vector<std::vector<TableMeta>> levels) -> void {
+    // only installs change the levels, so they can be read without the
+    // sstables mutex
+    manifest::VersionEdit edit = diff(sstables_, levels);
+    edit.next_table_id = unused_sst_id_;
+    edit.last_sequence = operation_id_;
+    manifest_->apply(edit);
     {
-        std::scoped_lock write_lk(sstables_mutex_, filters_mutex_);
-        if (next_it == sstables_.end()) {
-            sstables_.emplace_back();
-            next_it = std::prev(sstables_.end());
+        std::unique_lock lock(sstables_mutex_);
+        sstables_ = std::move(levels);
+        for (uint64_t id : edit.removed) {
+            auto it = table_files_.find(id);
+            if (it != table_files_.end()) {
+                it->second->obsolete = true;
+                table_files_.erase(it);
+            }
         }
-        next_it->push_back(new_id);
-        filters_[new_id] = bf;
+        for (const auto &table : edit.added) {
+            table_files_.emplace(
+                table.id, std::make_shared<TableFile>(table.id, table_cache_));
+        }
+    }
+    publish_super_version();
+}
+
+auto Database::compaction_score(size_t level) const -> double {
+    const auto &tables = sstables_[level];
+    if (level == 0) {
+        return static_cast<double>(tables.size()) /
+               std::max(options_.level0_compaction_trigger, size_t{1});
+    }
+    size_t size = 0;
+    for (const auto &meta : tables) {
+        size += meta.file_size;
     }
+    return static_cast<double>(size) / level_target(level);
+}
+
+auto Database::level_target(size_t level) const -> size_t {
+    size_t target = std::max(options_.max_bytes_for_level_base, size_t{1});
+    for (size_t i = 1; i < level; ++i) {
+        target *= options_.level_size_multiplier;
+    }
+    return target;
+}
+
+auto Database::filter_policy(size_t level) const
+    -> std::shared_ptr<const filter::FilterPolicy> {
+    const auto &policies = options_.filter_policies;
+    if (policies.empty()) {
+        return std::make_shared<filter::BloomFilterPolicy>(
+            sstable::SSTABLE_BITS_PER_KEY);
+    }
+    return policies[std::min(level, policies.size() - 1)];
 }
 
 Database::Queue::Queue(const std::filesystem::path &data_path,
@@ -494,21 +1324,34 @@ Database::Queue::Queue(const std::filesystem::path &data_path,
             for (;;) {
                 std::shared_ptr<memtable::MemTable<memtable::KVSkipList>>
                     memtable;
-                std::deque<std::shared_ptr<
-                    memtable::MemTable<memtable::KVSkipList>>>::iterator it;
+                std::function<void()> task;
                 {
                     std::unique_lock<std::mutex> lock(queue_mutex_);
-                    queue_cv_.wait(
-                        lock, [&]() { return stop_flag_ || !queue_.empty(); });
-                    if (stop_flag_ && queue_.empty()) {
+                    queue_cv_.wait(lock, [&]() {
+                        return stop_flag_ || !queue_.empty() || !tasks_.empty();
+                    });
+                    if (!tasks_.empty()) {
+                        task = std::move(tasks_.front());
+                        tasks_.pop_front();
+                    } else if (stop_flag_ && queue_.empty()) {
                         return;
+                    } else {
+                        memtable = std::move(queue_.front());
+                        queue_.pop_front();
+                        working_.emplace_back(memtable);
+                        ++active_;
                     }
-                    memtable = std::move(queue_.front());
-                    queue_.pop_front();
-                    working_.emplace_back(memtable);
-                    it = std::prev(working_.end());
                 }
-                process_memtable(it);
+                if (task) {
+                    task();
+                    continue;
+                }
+                process_memtable(std::move(memtable));
+                {
+                    std::scoped_lock<std::mutex> lock(queue_mutex_);
+                    --active_;
+                }
+                idle_cv_.notify_all();
             }
         });
     }
@@ -534,84 +1377,212 @@ auto Database::Queue::enqueue_memtable(
     queue_cv_.notify_one();
 }
 
-auto Database::Queue::find(std::string_view key,
-                           std::vector<std::string_view> &values) -> void {
-    std::unique_lock lock(queue_mutex_);
-    for (const auto &memtable : std::views::reverse(queue_)) {
-        auto res = memtable->find(key);
-        if (!res.empty()) {
-            values.insert(values.end(), res.begin(), res.end());
-        }
-    }
-    for (const auto &memtable : std::views::reverse(working_)) {
-        auto res = memtable->find(key);
-        if (!res.empty()) {
-            values.insert(values.end(), res.begin(), res.end());
-        }
+auto Database::Queue::wait() -> void {
+    std::unique_lock<std::mutex> lock(queue_mutex_);
+    idle_cv_.wait(lock, [&]() { return queue_.empty() && active_ == 0; });
+}
+
+auto Database::Queue::submit(std::function<void()> task) -> void {
+    {
+        std::scoped_lock<std::mutex> lock(queue_mutex_);
+        tasks_.emplace_back(std::move(task));
     }
+    queue_cv_.notify_one();
 }
 
-auto Database::Queue::set_unused_sst_id(size_t id) -> void {
-    unused_sst_id_ = id;
+auto Database::Queue::memtables() -> std::vector<
+    std::shared_ptr<memtable::MemTable<memtable::KVSkipList>>> {
+    std::scoped_lock lock(queue_mutex_);
+    std::vector<std::shared_ptr<memtable::MemTable<memtable::KVSkipList>>>
+        memtables(queue_.begin(), queue_.end());
+    memtables.insert(memtables.end(), working_.begin(), working_.end());
+    return memtables;
 }
 
 auto Database::Queue::process_memtable(
-    std::deque<
-        std::shared_ptr<memtable::MemTable<memtable::KVSkipList>>>::iterator it)
+    std::shared_ptr<memtable::MemTable<memtable::KVSkipList>> memtable)
     -> void {
-    auto memtable = *it;
-    size_t id = unused_sst_id_++;
-
-    std::cout << "Processing memtable with " << memtable->size() << "entries."
-              << std::endl;
-    FILE *fp = fopen((data_path_ / std::format("{}.sst", id)).c_str(), "w");
-    std::ignore = fp;
-    // data
-    // bloom filter
-    // size of bloom filter
-    // indexes
-    // size of indexes
-    const auto memtable_size = memtable->size();
-    std::vector<size_t> indexes(memtable_size);
-    size_t index = 0;
-    std::shared_ptr<filter::BloomFilter> bf =
-        std::make_shared<filter::BloomFilter>(memtable_size * 2, 3);
-    for (auto &seq : *memtable) {
-        size_t seq_size = memtable::KVStore::get_size(seq);
-        fwrite(&seq, 1, seq_size, fp);
-        auto key = memtable::KVStore::get_key(seq);
-        std::string_view str(reinterpret_cast<const char *>(key.data()),
-                             key.size());
-        bf->add(str);
-        indexes.push_back(index);
-        index += seq_size;
-    }
-    std::cout << "Writing bloom filter" << std::endl;
+    size_t id = db_.unused_sst_id_++;
+
+    sstable::SSTableBuilder builder(db_.table_cache_.path(id),
+                                    memtable->size(), db_.options_.block_size,
+                                    db_.filter_policy(0));
+    for (auto seq : *memtable) {
+        auto [key, value] = memtable::KVStore::get(seq);
+        builder.add(
+            std::string_view(reinterpret_cast<const char *>(key.data()),
+                             key.size()),
+            std::string_view(reinterpret_cast<const char *>(value.data()),
+                             value.size()));
+    }
+    builder.finish();
+
+    // the memtable stays readable until its table is installed
+    auto table = db_.table_cache_.get(id);
     {
-        size_t bf_size = bf->save(fp);
-        fwrite(&bf_size, sizeof(size_t), 1, fp);
-        {
-            std::scoped_lock lock(db_.filters_mutex_);
-            db_.filters_[id] = bf;
+        std::scoped_lock lock(db_.manifest_mutex_);
+        auto levels = db_.sstables_;
+        levels[0].push_back(table_meta(*table));
+        db_.install(std::move(levels));
+    }
+    db_.release_segments(memtable.get());
+    {
+        std::scoped_lock<std::mutex> lock(queue_mutex_);
+        working_.erase(std::ranges::find(working_, memtable));
+    }
+    // reads go to the table from now on
+    db_.publish_super_version();
+    db_.maybe_compact();
+}
+
+Database::Snapshot::Snapshot(Database &db,
+                             std::multiset<hlc::HLC>::iterator it)
+    : db_(&db), it_(it) {
+}
+
+Database::Snapshot::Snapshot(Snapshot &&other) noexcept
+    : db_(std::exchange(other.db_, nullptr)), it_(other.it_) {
+}
+
+Database::Snapshot::~Snapshot() {
+    if (db_ == nullptr) {
+        return;
+    }
+    std::scoped_lock lock(db_->snapshots_mutex_);
+    db_->snapshots_.erase(it_);
+}
+
+auto Database::Snapshot::clock() const -> hlc::HLC {
+    return *it_;
+}
+
+auto Database::Snapshot::find(std::string_view key) const
+    -> std::optional<std::string_view> {
+    return db_->find_at(key, *it_);
+}
+
+Database::Iterator::Iterator(
+    std::vector<std::unique_ptr<iterator::Iterator>> children)
+    : children_(std::move(children)) {
+}
+
+auto Database::Iterator::valid() const -> bool {
+    return valid_;
+}
+
+auto Database::Iterator::seek_to_first() -> void {
+    for (auto &child : children_) {
+        child->seek_to_first();
+    }
+    direction_ = Direction::forward;
+    build_heap();
+    find();
+}
+
+auto Database::Iterator::seek_to_last() -> void {
+    for (auto &child : children_) {
+        child->seek_to_last();
+    }
+    direction_ = Direction::reverse;
+    build_heap();
+    find();
+}
+
+auto Database::Iterator::seek(std::string_view key) -> void {
+    for (auto &child : children_) {
+        child->seek(key);
+    }
+    direction_ = Direction::forward;
+    build_heap();
+    find();
+}
+
+auto Database::Iterator::next() -> void {
+    if (direction_ == Direction::reverse) {
+        for (auto &child : children_) {
+            child->seek(key_);
+            while (child->valid() && child->key() == key_) {
+                child->next();
+            }
         }
-        {
-            std::scoped_lock lock(db_.sstables_mutex_);
-            if (db_.sstables_[0].size() >= 4) {
-                db_.compact(db_.sstables_[0]);
-                db_.sstables_.push_front({});
-                db_.sstables_[0].push_back(id);
+        direction_ = Direction::forward;
+        build_heap();
+    }
+    find();
+}
+
+auto Database::Iterator::prev() -> void {
+    if (direction_ == Direction::forward) {
+        for (auto &child : children_) {
+            child->seek(key_);
+            if (child->valid()) {
+                child->prev();
             } else {
-                db_.sstables_[0].push_back(id);
+                child->seek_to_last();
             }
         }
+        direction_ = Direction::reverse;
+        build_heap();
     }
-    std::cout << indexes.size() << " versus " << memtable_size << std::endl;
-    fwrite(indexes.data(), sizeof(size_t), memtable_size, fp);
-    fwrite(&memtable_size, sizeof(size_t), 1, fp);
-    {
-        std::scoped_lock<std::mutex> lock(queue_mutex_);
-        working_.erase(it);
+    find();
+}
+
+auto Database::Iterator::key() const -> std::string_view {
+    return key_;
+}
+
+auto Database::Iterator::value() const -> std::string_view {
+    return value_;
+}
+
+auto Database::Iterator::build_heap() -> void {
+    heap_.clear();
+    for (size_t i = 0; i < children_.size(); ++i) {
+        if (children_[i]->valid()) {
+            heap_.push_back(i);
+        }
+    }
+    std::ranges::make_heap(heap_,
+                           [this](size_t a, size_t b) { return after(a, b); });
+}
+
+auto Database::Iterator::after(size_t a, size_t b) const -> bool {
+    auto key_a = children_[a]->key();
+    auto key_b = children_[b]->key();
+    return direction_ == Direction::forward ? key_a > key_b : key_a < key_b;
+}
+
+auto Database::Iterator::find() -> void {
+    auto after = [this](size_t a, size_t b) { return this->after(a, b); };
+    while (!heap_.empty()) {
+        // takes every version of the nearest key, so that it is resolved
+        // across all children
+        key_ = children_[heap_.front()]->key();
+        values_.clear();
+        while (!heap_.empty() && children_[heap_.front()]->key() == key_) {
+            std::ranges::pop_heap(heap_, after);
+            auto &child = children_[heap_.back()];
+            while (child->valid() && child->key() == key_) {
+                values_.push_back(child->value());
+                if (direction_ == Direction::forward) {
+                    child->next();
+                } else {
+                    child->prev();
+                }
+            }
+            if (child->valid()) {
+                std::ranges::push_heap(heap_, after);
+            } else {
+                heap_.pop_back();
+            }
+        }
+        if (auto value = resolve(values_)) {
+            valid_ = true;
+            value_ = *value;
+            return;
+        }
     }
+    valid_ = false;
 }
 
 }  // namespace database
@@ -1,11 +1,54 @@
 #include "mousedb/database/core.hpp"
 
+#include <fcntl.h>
 #include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <compare>
+#include <cstring>
+#include <format>
+#include <fstream>
+#include <iterator>
+#include <thread>
 
 #include "hlce.hpp"
+#include "sstable.hpp"
+#include "wal.hpp"
 
 using namespace mousedb::database;
 using mousedb::hlc::HLC;
+using mousedb::write_batch::WriteBatch;
+
+// Returns a root under /tmp, with whatever an earlier run left there removed.
+static auto fresh_root(std::string_view name) -> std::filesystem::path {
+    auto root = std::filesystem::path("/tmp") / name;
+    std::filesystem::remove_all(root);
+    return root;
+}
+
+// Returns the key of i, zero padded to width digits so that keys sort by i.
+static auto key(uint64_t i, int width = 1) -> std::string {
+    return std::format("key{:0{}}", i, width);
+}
+
+// Inserts value{i} under key(i, width) at HLC{i, 0, 0} for each i below
+// count.
+static auto fill(Database &db, uint64_t count, int width = 1) -> void {
+    for (uint64_t i = 0; i < count; ++i) {
+        db.insert(key(i, width), std::format("value{}", i), HLC{i, 0, 0});
+    }
+}
+
+// Expects each key that fill inserted to be found with its value.
+static auto expect_filled(Database &db, uint64_t count, int width = 1)
+    -> void {
+    for (uint64_t i = 0; i < count; ++i) {
+        EXPECT_EQ(db.find(key(i, width)), std::format("value{}", i)) << i;
+    }
+}
 
 TEST(core, BasicOperations) {
     Options options = {
@@ -77,3 +120,742 @@ TEST(core, Flush) {
     value = db.find("key");
     ASSERT_EQ(value, std::nullopt);
 }
+
+TEST(core, FindAfterFlushAndCompaction) {
+    Options options = {
+        .fresh = true,
+        .flush_threshold = 0,
+    };
+    Database db("/tmp/mousedb_test", options);
+    fill(db, 64);
+    for (uint64_t i = 0; i < 64; i += 2) {
+        db.insert(std::format("key{}", i), std::format("new{}", i),
+                  HLC{100 + i, 0, 0});
+    }
+    for (uint64_t i = 0; i < 64; i += 4) {
+        db.erase(std::format("key{}", i), HLC{200 + i, 0, 0});
+    }
+    db.wait_for_background_work();
+    for (uint64_t i = 0; i < 64; ++i) {
+        auto value = db.find(std::format("key{}", i));
+        if (i % 4 == 0) {
+            EXPECT_EQ(value, std::nullopt) << i;
+        } else if (i % 2 == 0) {
+            EXPECT_EQ(value, std::format("new{}", i)) << i;
+        } else {
+            EXPECT_EQ(value, std::format("value{}", i)) << i;
+        }
+    }
+}
+
+TEST(core, ReadsResolveVersionsAcrossLevelsByHLC) {
+    Options options = {
+        .fresh = true,
+        .flush_threshold = 1,
+        .level0_compaction_trigger = 2,
+    };
+    Database db("/tmp/mousedb_test", options);
+    db.insert("a", "new", HLC{10, 0, 0});
+    db.erase("b", HLC{10, 0, 0});
+    db.insert("c", "new", HLC{10, 0, 0});
+    db.insert("d", "new", HLC{10, 0, 0});
+    db.wait_for_background_work();
+    ASSERT_TRUE(db.tables(0).empty());
+    ASSERT_FALSE(db.tables(1).empty());
+
+    // older versions written late land in level 0 and the memtable, above
+    // the newer ones
+    db.insert("a", "old", HLC{1, 0, 0});
+    db.insert("b", "old", HLC{1, 0, 0});
+    db.wait_for_background_work();
+    ASSERT_EQ(db.tables(0).size(), 1u);
+    db.insert("c", "old", HLC{1, 0, 0});
+
+    EXPECT_EQ(db.find("a"), "new");
+    EXPECT_EQ(db.find("b"), std::nullopt);
+    EXPECT_EQ(db.find("c"), "new");
+    EXPECT_EQ(db.find_at("c", HLC{5, 0, 0}), "old");
+    std::vector<std::string_view> keys = {"a", "b", "c", "d"};
+    auto values = db.multi_get(keys);
+    ASSERT_EQ(values.size(), keys.size());
+    EXPECT_EQ(values[0], "new");
+    EXPECT_EQ(values[1], std::nullopt);
+    EXPECT_EQ(values[2], "new");
+    EXPECT_EQ(values[3], "new");
+}
+
+TEST(core, ReadsSeeEveryWriteAcrossFlushes) {
+    Options options = {
+        .fresh = true,
+        .flush_threshold = 16,
+    };
+    Database db("/tmp/mousedb_test", options);
+    constexpr uint64_t num_keys = 512;
+    std::atomic<uint64_t> written = 0;
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 4; ++t) {
+        readers.emplace_back([&]() {
+            // every key written before a read starts is found, whether it is
+            // in a memtable, being flushed or in a table by then
+            for (uint64_t i = 0; i < num_keys; ++i) {
+                while (written.load() <= i) {
+                    std::this_thread::yield();
+                }
+                auto key = std::format("key{:03}", i);
+                EXPECT_EQ(db.find(key), std::format("value{}", i)) << key;
+            }
+        });
+    }
+    for (uint64_t i = 0; i < num_keys; ++i) {
+        db.insert(std::format("key{:03}", i), std::format("value{}", i),
+                  HLC{i, 0, 0});
+        written = i + 1;
+    }
+    for (auto &reader : readers) {
+        reader.join();
+    }
+    expect_filled(db, num_keys, 3);
+}
+
+TEST(core, BlockCacheServesRepeatedFinds) {
+    Options options = {
+        .fresh = true,
+        .flush_threshold = 0,
+    };
+    Database db("/tmp/mousedb_test", options);
+    fill(db, 16);
+    db.wait_for_background_work();
+    ASSERT_NE(db.block_cache(), nullptr);
+    for (int round = 0; round < 2; ++round) {
+        expect_filled(db, 16);
+    }
+    EXPECT_GE(db.block_cache()->hits(), 16u);
+}
+
+TEST(core, PinnedValuesOutliveFlushAndCompaction) {
+    Options options = {
+        .fresh = true,
+        .flush_threshold = 4,
+        .block_cache_capacity = 0,
+        .level0_compaction_trigger = 2,
+    };
+    Database db("/tmp/mousedb_test", options);
+    db.insert("a", "in memtable", HLC{1, 2, 3});
+    auto pinned = db.find_pinned("a");
+    ASSERT_TRUE(pinned.has_value());
+    EXPECT_EQ(pinned->value(), "in memtable");
+    EXPECT_TRUE(std::is_eq(pinned->clock() <=> HLC{1, 2, 3}));
+
+    fill(db, 64);
+    db.wait_for_background_work();
+    auto from_table = db.find_pinned("key1");
+    ASSERT_TRUE(from_table.has_value());
+    db.insert("key1", "newer", HLC{100, 0, 0});
+    for (uint64_t i = 0; i < 64; ++i) {
+        db.insert(std::format("key{}", i), std::format("again{}", i),
+                  HLC{200 + i, 0, 0});
+    }
+    db.wait_for_background_work();
+    EXPECT_EQ(pinned->value(), "in memtable");
+    EXPECT_EQ(from_table->value(), "value1");
+    EXPECT_FALSE(db.find_pinned("missing").has_value());
+}
+
+TEST(core, FindWithFilterPolicyPerLevel) {
+    Options options = {
+        .fresh = true,
+        .flush_threshold = 0,
+        .filter_policies =
+            {std::make_shared<mousedb::filter::BloomFilterPolicy>(10),
+             std::make_shared<mousedb::filter::BinaryFuseFilterPolicy>()},
+    };
+    Database db("/tmp/mousedb_test", options);
+    fill(db, 32);
+    db.wait_for_background_work();
+    expect_filled(db, 32);
+    EXPECT_EQ(db.find("key32"), std::nullopt);
+}
+
+TEST(core, ScanMergesMemtablesAndTables) {
+    Options options = {
+        .fresh = true,
+        .flush_threshold = 0,
+    };
+    Database db("/tmp/mousedb_test", options);
+    fill(db, 32, 2);
+    db.wait_for_background_work();
+    for (uint64_t i = 0; i < 32; i += 2) {
+        db.insert(std::format("key{:02}", i), std::format("new{}", i),
+                  HLC{100 + i, 0, 0});
+    }
+    for (uint64_t i = 0; i < 32; i += 4) {
+        db.erase(std::format("key{:02}", i), HLC{200 + i, 0, 0});
+    }
+    // an older erase loses to the value it would have erased
+    db.erase("key01", HLC{0, 0, 0});
+
+    auto pairs = db.scan("key05", "key20");
+    std::vector<std::pair<std::string, std::string>> expected;
+    for (uint64_t i = 5; i < 20; ++i) {
+        if (i % 4 == 0) {
+            continue;
+        }
+        expected.emplace_back(std::format("key{:02}", i),
+                              i % 2 == 0 ? std::format("new{}", i)
+                                         : std::format("value{}", i));
+    }
+    EXPECT_EQ(pairs, expected);
+    EXPECT_EQ(db.scan("key01", "key02").size(), 1u);
+    EXPECT_TRUE(db.scan("key32", "key99").empty());
+}
+
+TEST(core, IteratorMovesBothWays) {
+    Options options = {
+        .fresh = true,
+        .flush_threshold = 4,
+    };
+    Database db("/tmp/mousedb_test", options);
+    for (uint64_t i = 0; i < 20; ++i) {
+        db.insert(std::format("key{:02}", i), std::format("value{}", i),
+                  HLC{i, 0, 0});
+        db.insert(std::format("key{:02}", i), std::format("new{}", i),
+                  HLC{100 + i, 0, 0});
+    }
+    db.erase("key10", HLC{300, 0, 0});
+    db.wait_for_background_work();
+
+    auto it = db.new_iterator();
+    int count = 0;
+    for (it.seek_to_last(); it.valid(); it.prev()) {
+        ++count;
+    }
+    EXPECT_EQ(count, 19);
+
+    it.seek("key09");
+    ASSERT_TRUE(it.valid());
+    EXPECT_EQ(it.key(), "key09");
+    EXPECT_EQ(it.value(), "new9");
+    it.next();
+    ASSERT_TRUE(it.valid());
+    EXPECT_EQ(it.key(), "key11");
+    it.prev();
+    ASSERT_TRUE(it.valid());
+    EXPECT_EQ(it.key(), "key09");
+    it.prev();
+    ASSERT_TRUE(it.valid());
+    EXPECT_EQ(it.key(), "key08");
+    it.next();
+    it.next();
+    ASSERT_TRUE(it.valid());
+    EXPECT_EQ(it.key(), "key11");
+    EXPECT_EQ(it.value(), "new11");
+}
+
+TEST(core, IteratorReadsTablesCompactedAfterItWasMade) {
+    auto root = fresh_root("mousedb_test_held");
+    Options options = {
+        .fresh = true,
+        .flush_threshold = 4,
+        .block_cache_capacity = 0,
+        .level0_compaction_trigger = 2,
+    };
+    Database db(root, options);
+    fill(db, 64, 2);
+    db.wait_for_background_work();
+    auto before = db.tables(1);
+    ASSERT_FALSE(before.empty());
+
+    // the iterator opens the tables of level 1 only once it reaches them,
+    // which is after they are compacted away
+    auto it = db.new_iterator();
+    for (uint64_t i = 0; i < 64; ++i) {
+        db.insert(key(i, 2), std::format("again{}", i), HLC{100 + i, 0, 0});
+    }
+    db.wait_for_background_work();
+    auto dropped = std::ranges::find_if(before, [&](const TableMeta &meta) {
+        return std::ranges::none_of(db.tables(1), [&](const TableMeta &after) {
+            return after.id == meta.id;
+        });
+    });
+    ASSERT_NE(dropped, before.end());
+    auto path = root / "data" / std::format("{}.sst", dropped->id);
+    EXPECT_TRUE(std::filesystem::exists(path));
+
+    uint64_t i = 0;
+    for (it.seek_to_first(); it.valid(); it.next(), ++i) {
+        EXPECT_EQ(it.key(), key(i, 2));
+        // the inserts that went into the active memtable may be seen
+        EXPECT_TRUE(it.value() == std::format("value{}", i) ||
+                    it.value() == std::format("again{}", i))
+            << i;
+    }
+    EXPECT_EQ(i, 64u);
+    it = db.new_iterator();
+    EXPECT_FALSE(std::filesystem::exists(path));
+}
+
+TEST(core, CompactionRollsOutputFiles) {
+    auto root = fresh_root("mousedb_test_roll");
+    Options options = {
+        .fresh = true,
+        .flush_threshold = 64,
+        .block_size = 256,
+        .target_file_size = 1024,
+    };
+    {
+        Database db(root, options);
+        for (uint64_t i = 0; i < 4 * 65; ++i) {
+            db.insert(std::format("key{:03}", i), std::string(32, 'v'),
+                      HLC{i, 0, 0});
+        }
+        db.wait_for_background_work();
+        for (uint64_t i = 0; i < 4 * 65; ++i) {
+            EXPECT_EQ(db.find(std::format("key{:03}", i)), std::string(32, 'v'))
+                << i;
+        }
+    }
+    size_t num_tables = 0;
+    for (const auto &entry :
+         std::filesystem::directory_iterator(root / "data")) {
+        num_tables += entry.path().extension() == ".sst";
+    }
+    // one table per 1 KiB of about 13 KiB of pairs
+    EXPECT_GE(num_tables, 8u);
+}
+
+TEST(core, LeveledCompactionKeepsLevelsDisjoint) {
+    auto root = fresh_root("mousedb_test_leveled");
+    Options options = {
+        .fresh = true,
+        .flush_threshold = 16,
+        .block_size = 256,
+        .target_file_size = 1024,
+        .level0_compaction_trigger = 2,
+        .max_bytes_for_level_base = 4096,
+        .level_size_multiplier = 4,
+    };
+    Database db(root, options);
+    constexpr uint64_t num_keys = 2000;
+    for (uint64_t i = 0; i < num_keys; ++i) {
+        uint64_t k = i * 7919 % num_keys;
+        db.insert(std::format("key{:04}", k), std::format("{:032}", k),
+                  HLC{i, 0, 0});
+    }
+    for (uint64_t k = 0; k < num_keys; k += 3) {
+        db.insert(std::format("key{:04}", k), "new", HLC{num_keys + k, 0, 0});
+    }
+    db.wait_for_background_work();
+
+    size_t deepest = 0;
+    for (size_t level = 1; level < options.num_levels; ++level) {
+        auto tables = db.tables(level);
+        if (!tables.empty()) {
+            deepest = level;
+        }
+        for (size_t i = 1; i < tables.size(); ++i) {
+            EXPECT_LT(tables[i - 1].largest, tables[i].smallest) << level;
+        }
+    }
+    EXPECT_GE(deepest, 2u);
+    for (uint64_t k = 0; k < num_keys; ++k) {
+        EXPECT_EQ(db.find(std::format("key{:04}", k)),
+                  k % 3 == 0 ? "new" : std::format("{:032}", k))
+            << k;
+    }
+}
+
+TEST(core, UniversalCompactionCapsSortedRuns) {
+    auto root = fresh_root("mousedb_test_universal");
+    Options options = {
+        .fresh = true,
+        .flush_threshold = 16,
+        .block_size = 256,
+        .target_file_size = 1024,
+        .compaction_style = CompactionStyle::universal,
+    };
+    Database db(root, options);
+    constexpr uint64_t num_keys = 1000;
+    for (uint64_t i = 0; i < num_keys; ++i) {
+        uint64_t k = i * 7919 % num_keys;
+        db.insert(std::format("key{:04}", k), std::format("{:032}", k),
+                  HLC{i, 0, 0});
+    }
+    for (uint64_t k = 0; k < num_keys; k += 3) {
+        db.insert(std::format("key{:04}", k), "new", HLC{num_keys + k, 0, 0});
+    }
+    db.wait_for_background_work();
+
+    size_t num_runs = db.tables(0).size();
+    for (size_t level = 1; !db.tables(level).empty(); ++level) {
+        auto tables = db.tables(level);
+        for (size_t i = 1; i < tables.size(); ++i) {
+            EXPECT_LT(tables[i - 1].largest, tables[i].smallest) << level;
+        }
+        ++num_runs;
+    }
+    EXPECT_GE(num_runs, 1u);
+    EXPECT_LT(num_runs, options.level0_compaction_trigger);
+    for (uint64_t k = 0; k < num_keys; ++k) {
+        EXPECT_EQ(db.find(std::format("key{:04}", k)),
+                  k % 3 == 0 ? "new" : std::format("{:032}", k))
+            << k;
+    }
+}
+
+TEST(core, SubcompactionsSplitByKeyRange) {
+    auto root = fresh_root("mousedb_test_subcompactions");
+    Options options = {
+        .fresh = true,
+        .flush_threshold = 256,
+        .block_size = 256,
+        .target_file_size = 1024,
+        .max_subcompactions = 4,
+    };
+    Database db(root, options);
+    constexpr uint64_t num_keys = 1100;
+    for (uint64_t i = 0; i < num_keys; ++i) {
+        uint64_t k = i * 7919 % num_keys;
+        db.insert(std::format("key{:04}", k), std::format("{:032}", k),
+                  HLC{i, 0, 0});
+    }
+    db.wait_for_background_work();
+
+    // level 0 is compacted as one input of many block boundaries, which is
+    // split into as many ranges as allowed
+    auto stats = db.compaction_stats();
+    EXPECT_GE(stats.compactions, 1u);
+    EXPECT_EQ(stats.max_subcompactions, options.max_subcompactions);
+    auto tables = db.tables(1);
+    EXPECT_GE(tables.size(), options.max_subcompactions);
+    for (size_t i = 1; i < tables.size(); ++i) {
+        EXPECT_LT(tables[i - 1].largest, tables[i].smallest);
+    }
+    for (uint64_t k = 0; k < num_keys; ++k) {
+        EXPECT_EQ(db.find(std::format("key{:04}", k)), std::format("{:032}", k))
+            << k;
+    }
+    EXPECT_EQ(db.scan("", "key9999").size(), num_keys);
+}
+
+TEST(core, CompactionDropsShadowedVersionsAndOldTombstones) {
+    auto root = fresh_root("mousedb_test_gc");
+    Options options = {
+        .fresh = true,
+        .flush_threshold = 0,
+        .num_levels = 2,
+        .level0_compaction_trigger = 2,
+    };
+    Database db(root, options);
+    uint64_t now = std::chrono::duration_cast<std::chrono::microseconds>(
+                       std::chrono::system_clock::now().time_since_epoch())
+                       .count();
+    db.insert("a", "1", HLC{1, 0, 0});
+    db.insert("a", "2", HLC{2, 0, 0});
+    db.erase("a", HLC{3, 0, 0});
+    db.insert("c", "1", HLC{1, 0, 0});
+    // within the grace period, so it must still hide older versions
+    db.erase("c", HLC{now, 0, 0});
+    db.insert("b", "1", HLC{1, 0, 0});
+    db.insert("b", "5", HLC{5, 0, 0});
+    db.insert("b", "2", HLC{2, 0, 0});
+    db.wait_for_background_work();
+
+    EXPECT_TRUE(db.tables(0).empty());
+    size_t num_entries = 0;
+    for (const auto &meta : db.tables(1)) {
+        mousedb::sstable::SSTable table(
+            root / "data" / std::format("{}.sst", meta.id));
+        num_entries += table.size();
+    }
+    EXPECT_EQ(num_entries, 2u);
+    EXPECT_EQ(db.find("a"), std::nullopt);
+    EXPECT_EQ(db.find("b"), "5");
+    EXPECT_EQ(db.find("c"), std::nullopt);
+}
+
+TEST(core, CompactionKeepsVersionsSeenBySnapshots) {
+    auto root = fresh_root("mousedb_test_snapshot");
+    Options options = {
+        .fresh = true,
+        .flush_threshold = 0,
+        .num_levels = 2,
+        .level0_compaction_trigger = 2,
+    };
+    Database db(root, options);
+    db.insert("a", "1", HLC{1, 0, 0});
+    auto snapshot = db.get_snapshot(HLC{2, 0, 0});
+    db.insert("a", "3", HLC{3, 0, 0});
+    db.insert("b", "1", HLC{1, 0, 0});
+    db.erase("b", HLC{3, 0, 0});
+    db.insert("c", "4", HLC{4, 0, 0});
+    {
+        // released before compaction, so nothing is kept for it
+        auto released = db.get_snapshot(HLC{1, 0, 0});
+        EXPECT_EQ(released.find("c"), std::nullopt);
+    }
+    db.wait_for_background_work();
+
+    EXPECT_TRUE(db.tables(0).empty());
+    size_t num_entries = 0;
+    for (const auto &meta : db.tables(1)) {
+        mousedb::sstable::SSTable table(
+            root / "data" / std::format("{}.sst", meta.id));
+        num_entries += table.size();
+    }
+    // both versions of a and b, which the snapshot still sees, and c
+    EXPECT_EQ(num_entries, 5u);
+    EXPECT_EQ(db.find("a"), "3");
+    EXPECT_EQ(db.find("b"), std::nullopt);
+    EXPECT_EQ(snapshot.find("a"), "1");
+    EXPECT_EQ(snapshot.find("b"), "1");
+    EXPECT_EQ(snapshot.find("c"), std::nullopt);
+    EXPECT_EQ(db.find_at("a", HLC{3, 0, 0}), "3");
+    EXPECT_EQ(db.find_at("a", HLC{0, 0, 0}), std::nullopt);
+    EXPECT_EQ(db.get_snapshot().find("c"), "4");
+}
+
+TEST(core, ReopenRestoresTablesFromManifest) {
+    auto root = fresh_root("mousedb_test_manifest");
+    Options options = {
+        .fresh = true,
+        .flush_threshold = 16,
+        .block_size = 256,
+        .target_file_size = 1024,
+        .level0_compaction_trigger = 2,
+        .max_bytes_for_level_base = 4096,
+    };
+    constexpr uint64_t num_keys = 500;
+    std::vector<std::vector<uint64_t>> ids(options.num_levels);
+    auto table_ids = [&](Database &db, size_t level) {
+        std::vector<uint64_t> level_ids;
+        for (const auto &meta : db.tables(level)) {
+            level_ids.push_back(meta.id);
+        }
+        return level_ids;
+    };
+    {
+        Database db(root, options);
+        for (uint64_t i = 0; i < num_keys; ++i) {
+            uint64_t k = i * 7919 % num_keys;
+            db.insert(std::format("key{:04}", k), std::format("{:032}", k),
+                      HLC{i, 0, 0});
+        }
+        db.wait_for_background_work();
+        for (size_t level = 0; level < options.num_levels; ++level) {
+            ids[level] = table_ids(db, level);
+        }
+    }
+    // only the tables are left to recover from
+    for (const auto &entry :
+         std::filesystem::directory_iterator(root / "data")) {
+        if (entry.path().extension() == ".wal") {
+            std::filesystem::remove(entry.path());
+        }
+    }
+
+    options.fresh = false;
+    Database db(root, options);
+    for (size_t level = 0; level < options.num_levels; ++level) {
+        EXPECT_EQ(table_ids(db, level), ids[level]) << level;
+    }
+    EXPECT_FALSE(db.tables(1).empty());
+    size_t found = 0;
+    for (uint64_t k = 0; k < num_keys; ++k) {
+        found += db.find(std::format("key{:04}", k)) ==
+                 std::format("{:032}", k);
+    }
+    // keys still in the memtable when the database closed are lost
+    EXPECT_GE(found, num_keys - options.flush_threshold - 1);
+}
+
+TEST(core, RecoveryFlushesReplayedWals) {
+    auto root = fresh_root("mousedb_test_recovery");
+    Options options = {
+        .fresh = true,
+        .flush_threshold = 1 << 20,
+    };
+    constexpr uint64_t num_keys = 300;
+    {
+        Database db(root, options);
+        fill(db, num_keys, 3);
+        for (uint64_t i = 0; i < num_keys; i += 2) {
+            db.insert(std::format("key{:03}", i), std::format("new{}", i),
+                      HLC{num_keys + i, 0, 0});
+        }
+    }
+    // a record cut short by a crash, right after the last whole one in each
+    // segment. The segments are preallocated with zeros, and every record
+    // ends with a value that is not, so the records end after the last byte
+    // that is not zero.
+    size_t num_torn = 0;
+    for (const auto &entry :
+         std::filesystem::directory_iterator(root / "data")) {
+        if (entry.path().extension() != ".wal") {
+            continue;
+        }
+        std::ifstream in(entry.path(), std::ios::binary);
+        std::string data((std::istreambuf_iterator<char>(in)),
+                         std::istreambuf_iterator<char>());
+        size_t end = data.find_last_not_of('\0');
+        if (end == std::string::npos) {
+            continue;
+        }
+        ++end;
+        ASSERT_GE(mousedb::wal::WAL_BLOCK_SIZE -
+                      end % mousedb::wal::WAL_BLOCK_SIZE,
+                  mousedb::wal::WAL_HEADER_SIZE + 4);
+        // a header for 100 bytes of payload, of which only 4 were written
+        std::string torn(mousedb::wal::WAL_HEADER_SIZE, '\0');
+        uint16_t size = 100;
+        auto type = mousedb::wal::FragmentType::full;
+        auto number = static_cast<uint32_t>(std::stoul(entry.path().stem().string()));
+        std::memcpy(torn.data() + 4, &size, sizeof(size));
+        std::memcpy(torn.data() + 6, &type, sizeof(type));
+        std::memcpy(torn.data() + 7, &number, sizeof(number));
+        torn += "torn";
+        int fd = open(entry.path().c_str(), O_WRONLY);
+        ASSERT_GE(fd, 0);
+        EXPECT_EQ(pwrite(fd, torn.data(), torn.size(), end),
+                  static_cast<ssize_t>(torn.size()));
+        close(fd);
+        ++num_torn;
+    }
+    ASSERT_GE(num_torn, 1u);
+
+    options.fresh = false;
+    options.flush_threshold = 64;
+    Database db(root, options);
+    size_t num_tables = 0;
+    for (size_t level = 0; level < options.num_levels; ++level) {
+        num_tables += db.tables(level).size();
+    }
+    EXPECT_GE(num_tables, 1u);
+    for (uint64_t i = 0; i < num_keys; ++i) {
+        EXPECT_EQ(db.find(std::format("key{:03}", i)),
+                  std::format("{}{}", i % 2 == 0 ? "new" : "value", i))
+            << i;
+    }
+}
+
+TEST(core, RecoveryReplaysRecordsSpanningBlocks) {
+    auto root = fresh_root("mousedb_test_recovery_large");
+    Options options = {
+        .fresh = true,
+        .flush_threshold = 1 << 20,
+    };
+    // bigger than a block, so the first record of the segment is reassembled
+    // from fragments
+    std::string large(100 << 10, 'x');
+    for (size_t i = 0; i < large.size(); i += 997) {
+        large[i] = static_cast<char>('a' + i % 26);
+    }
+    {
+        Database db(root, options);
+        db.insert("large", large, HLC{1, 0, 0});
+        db.insert("small", "value", HLC{2, 0, 0});
+    }
+
+    options.fresh = false;
+    Database db(root, options);
+    EXPECT_EQ(db.find("large"), large);
+    EXPECT_EQ(db.find("small"), "value");
+}
+
+TEST(core, RecyclesWalSegmentsAfterFlush) {
+    auto root = fresh_root("mousedb_test_segments");
+    Options options = {
+        .fresh = true,
+        .flush_threshold = 16,
+        .wal_segment_size = 64 << 10,
+        .max_free_wal_segments = 2,
+    };
+    constexpr uint64_t num_keys = 500;
+    auto count_files = [&](std::string_view extension) {
+        size_t count = 0;
+        for (const auto &entry :
+             std::filesystem::directory_iterator(root / "data")) {
+            count += entry.path().extension() == extension;
+        }
+        return count;
+    };
+    {
+        Database db(root, options);
+        fill(db, num_keys, 3);
+    }
+    // flushed segments are recycled, so only the unflushed ones stay live
+    EXPECT_EQ(count_files(".free"), 2u);
+    EXPECT_LE(count_files(".wal"), std::thread::hardware_concurrency());
+
+    options.fresh = false;
+    Database db(root, options);
+    expect_filled(db, num_keys, 3);
+    EXPECT_EQ(count_files(".wal"), 0u);
+}
+
+TEST(core, WriteAppliesBatchAndRecoversIt) {
+    auto root = fresh_root("mousedb_test_batch");
+    Options options = {
+        .fresh = true,
+        .flush_threshold = 1 << 20,
+    };
+    constexpr uint64_t num_keys = 100;
+    {
+        Database db(root, options);
+        db.insert("gone", "value", HLC{1, 0, 0});
+        WriteBatch batch(HLC{10, 0, 0});
+        for (uint64_t i = 0; i < num_keys; ++i) {
+            batch.put(std::format("key{:03}", i), std::format("value{}", i));
+        }
+        batch.erase("gone");
+        batch.put("key000", "older", HLC{5, 0, 0});
+        db.write(batch);
+        db.write(WriteBatch());
+
+        EXPECT_EQ(db.find("key000"), "value0");
+        EXPECT_EQ(db.find(std::format("key{:03}", num_keys - 1)),
+                  std::format("value{}", num_keys - 1));
+        EXPECT_EQ(db.find("gone"), std::nullopt);
+        EXPECT_EQ(db.wal_stats().records, 2u);
+    }
+
+    // the batch is replayed from its one record
+    options.fresh = false;
+    Database db(root, options);
+    expect_filled(db, num_keys, 3);
+    EXPECT_EQ(db.find("gone"), std::nullopt);
+}
+
+TEST(core, MultiGetAcrossMemtablesAndTables) {
+    Options options = {
+        .fresh = true,
+        .flush_threshold = 8,
+    };
+    Database db("/tmp/mousedb_test", options);
+    fill(db, 64, 2);
+    for (uint64_t i = 0; i < 64; i += 4) {
+        db.erase(std::format("key{:02}", i), HLC{100 + i, 0, 0});
+    }
+    db.wait_for_background_work();
+    db.insert("key01", "new", HLC{200, 0, 0});
+
+    // unsorted, with a duplicate and a missing key
+    std::vector<std::string> owned = {"key01", "key64"};
+    for (uint64_t i = 64; i-- > 0;) {
+        owned.push_back(std::format("key{:02}", i));
+    }
+    std::vector<std::string_view> keys(owned.begin(), owned.end());
+    auto values = db.multi_get(keys);
+    ASSERT_EQ(values.size(), keys.size());
+    EXPECT_EQ(values[0], "new");
+    EXPECT_EQ(values[1], std::nullopt);
+    for (uint64_t i = 0; i < 64; ++i) {
+        auto value = values[65 - i];
+        if (i == 1) {
+            EXPECT_EQ(value, "new");
+        } else if (i % 4 == 0) {
+            EXPECT_EQ(value, std::nullopt) << i;
+        } else {
+            EXPECT_EQ(value, std::format("value{}", i)) << i;
+        }
+    }
+}
@@ -5,21 +5,20 @@
 namespace mousedb {
 namespace random {
 
-Random::Random(size_t seed) : seed_(seed) {
+Random::Random(size_t seed) : seed_(seed & M) {
+    // 0 and M are fixed points of the generator
+    if (seed_ == 0 || seed_ == M) {
+        seed_ = 1;
+    }
 }
 
 auto Random::instance() -> Random * {
-    static thread_local Random *instance;
-    Random *rv = instance;
-    if (rv == nullptr) [[unlikely]] {
-        size_t seed = std::hash<std::thread::id>{}(std::this_thread::get_id());
-        rv = new Random(seed);
-        instance = rv;
-    }
-    return rv;
+    static thread_local Random instance(
+        std::hash<std::thread::id>{}(std::this_thread::get_id()));
+    return &instance;
 }
 
-inline auto Random::next32() -> uint32_t {
+auto Random::next32() -> uint32_t {
     uint64_t product = seed_ * A;
     seed_ = static_cast<uint32_t>((product >> 31) + (product & M));
     if (seed_ > M) {
@@ -28,7 +27,7 @@ inline auto Random::next32() -> uint32_t {
     return seed_;
 }
 
-inline auto Random::next64() -> uint64_t {
+auto Random::next64() -> uint64_t {
     return (uint64_t{next32()} << 32) | next32();
 }
 }  // namespace random
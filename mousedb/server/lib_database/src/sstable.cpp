@@ -0,0 +1,454 @@
+#include "sstable.hpp"
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <format>
+#include <stdexcept>
+
+#include "coding.hpp"
+
+// filter offset, filter size, index offset, index size, count, filter type,
+// version, magic
+constexpr size_t SSTABLE_FOOTER_SIZE =
+    5 * sizeof(uint64_t) + 2 * sizeof(uint32_t) + sizeof(uint64_t);
+
+namespace mousedb {
+namespace sstable {
+
+SSTableBuilder::SSTableBuilder(const std::filesystem::path &path,
+                               size_t expected_count, size_t block_size,
+                               std::shared_ptr<const filter::FilterPolicy>
+                                   filter_policy)
+    : file_(fopen(path.c_str(), "wb")),
+      block_size_(block_size),
+      filter_policy_(std::move(filter_policy)),
+      data_block_(SSTABLE_RESTART_INTERVAL),
+      index_block_(1) {
+    if (!file_) {
+        throw std::runtime_error(
+            std::format("Failed to create SSTable {}", path.c_str()));
+    }
+    key_hashes_.reserve(expected_count);
+}
+
+SSTableBuilder::~SSTableBuilder() {
+    if (file_) {
+        fclose(file_);
+    }
+}
+
+auto SSTableBuilder::add(std::string_view key, std::string_view value)
+    -> void {
+    // versions of a key are added back to back, so each key is hashed once
+    uint64_t h = filter::hash(key);
+    if (key_hashes_.empty() || key_hashes_.back() != h) {
+        key_hashes_.push_back(h);
+    }
+    data_block_.add(key, value);
+    ++count_;
+    if (data_block_.size() >= block_size_) {
+        flush_data_block();
+    }
+}
+
+auto SSTableBuilder::finish() -> void {
+    flush_data_block();
+
+    // aligns the filter within the file, and so within a mapping
+    constexpr size_t alignment = filter::FILTER_ALIGNMENT;
+    write(std::vector<std::byte>((alignment - offset_ % alignment) %
+                                 alignment));
+    std::vector<std::byte> filter;
+    filter_policy_->build(key_hashes_, filter);
+    size_t filter_offset = offset_;
+    size_t filter_size = filter.size();
+    write(filter);
+
+    size_t index_offset = offset_;
+    auto index = index_block_.finish();
+    write(index);
+
+    std::vector<std::byte> footer;
+    coding::put_fixed<uint64_t>(footer, filter_offset);
+    coding::put_fixed<uint64_t>(footer, filter_size);
+    coding::put_fixed<uint64_t>(footer, index_offset);
+    coding::put_fixed<uint64_t>(footer, index.size());
+    coding::put_fixed<uint64_t>(footer, count_);
+    coding::put_fixed(footer, static_cast<uint32_t>(filter_policy_->type()));
+    coding::put_fixed(footer, SSTABLE_VERSION);
+    coding::put_fixed(footer, SSTABLE_MAGIC);
+    write(footer);
+
+    // the table must be durable before the WAL segments it replaces are
+    // recycled
+    if (fflush(file_) != 0 || fdatasync(fileno(file_)) != 0) {
+        fclose(file_);
+        file_ = nullptr;
+        throw std::runtime_error("Failed to sync SSTable");
+    }
+    if (fclose(file_) != 0) {
+        file_ = nullptr;
+        throw std::runtime_error("Failed to close SSTable");
+    }
+    file_ = nullptr;
+}
+
+auto SSTableBuilder::count() const -> size_t {
+    return count_;
+}
+
+auto SSTableBuilder::file_size() const -> size_t {
+    return offset_;
+}
+
+auto SSTableBuilder::write(std::span<const std::byte> data) -> void {
+    if (data.empty()) {
+        return;
+    }
+    if (fwrite(data.data(), 1, data.size(), file_) != data.size()) {
+        throw std::runtime_error("Failed to write SSTable");
+    }
+    offset_ += data.size();
+}
+
+auto SSTableBuilder::flush_data_block() -> void {
+    if (data_block_.empty()) {
+        return;
+    }
+    size_t offset = offset_;
+    auto data = data_block_.finish();
+    write(data);
+
+    std::vector<std::byte> handle;
+    coding::put_varint(handle, offset);
+    coding::put_varint(handle, data.size());
+    index_block_.add(
+        data_block_.last_key(),
+        {reinterpret_cast<const char *>(handle.data()), handle.size()});
+    data_block_.reset();
+}
+
+SSTable::SSTable(const std::filesystem::path &path, uint64_t id,
+                 std::shared_ptr<cache::BlockCache> cache)
+    : id_(id), cache_(std::move(cache)) {
+    FILE *file = fopen(path.c_str(), "rb");
+    if (!file) {
+        throw std::runtime_error(
+            std::format("Failed to open SSTable {}", path.c_str()));
+    }
+    try {
+        if (fseek(file, 0, SEEK_END) != 0) {
+            throw std::runtime_error(
+                std::format("Failed to seek in {}", path.c_str()));
+        }
+        file_size_ = ftell(file);
+        if (file_size_ < SSTABLE_FOOTER_SIZE) {
+            throw std::runtime_error(
+                std::format("{} is too small for an SSTable", path.c_str()));
+        }
+        void *data =
+            mmap(nullptr, file_size_, PROT_READ, MAP_SHARED, fileno(file), 0);
+        if (data == MAP_FAILED) {
+            throw std::runtime_error(
+                std::format("Failed to map {}", path.c_str()));
+        }
+        data_ = static_cast<const std::byte *>(data);
+        advise(Access::random);
+
+        const std::byte *p = data_ + file_size_ - SSTABLE_FOOTER_SIZE;
+        auto filter_offset = coding::decode_fixed<uint64_t>(p);
+        auto filter_size = coding::decode_fixed<uint64_t>(p + 8);
+        auto index_offset = coding::decode_fixed<uint64_t>(p + 16);
+        auto index_size = coding::decode_fixed<uint64_t>(p + 24);
+        count_ = coding::decode_fixed<uint64_t>(p + 32);
+        auto filter_type = coding::decode_fixed<uint32_t>(p + 40);
+        auto version = coding::decode_fixed<uint32_t>(p + 44);
+        auto magic = coding::decode_fixed<uint64_t>(p + 48);
+        if (magic != SSTABLE_MAGIC) {
+            throw std::runtime_error(
+                std::format("{} is not an SSTable", path.c_str()));
+        }
+        if (version != SSTABLE_VERSION) {
+            throw std::runtime_error(std::format(
+                "{} has unsupported version {}", path.c_str(), version));
+        }
+        if (filter_offset + filter_size > index_offset ||
+            index_offset + index_size > file_size_ - SSTABLE_FOOTER_SIZE) {
+            throw std::runtime_error(
+                std::format("{} has a corrupt footer", path.c_str()));
+        }
+
+        filter_ = filter::read(static_cast<filter::FilterType>(filter_type),
+                               std::span(data_ + filter_offset, filter_size));
+
+        block::Block index({data_ + index_offset, index_size});
+        for (auto it = index.begin(); it.valid(); it.next()) {
+            std::span<const std::byte> handle(
+                reinterpret_cast<const std::byte *>(it.value().data()),
+                it.value().size());
+            IndexEntry entry{std::string(it.key()), 0, 0};
+            size_t offset = coding::decode_varint(handle, entry.offset);
+            coding::decode_varint(handle.subspan(offset), entry.size);
+            if (entry.offset + entry.size > index_offset) {
+                throw std::runtime_error(
+                    std::format("{} has a corrupt index", path.c_str()));
+            }
+            index_.push_back(std::move(entry));
+        }
+        if (!index_.empty()) {
+            auto it = block::Block(block(0)).begin();
+            if (it.valid()) {
+                smallest_ = it.key();
+            }
+        }
+    } catch (...) {
+        if (data_ != nullptr) {
+            munmap(const_cast<std::byte *>(data_), file_size_);
+        }
+        fclose(file);
+        throw;
+    }
+    // the mapping outlives the descriptor
+    fclose(file);
+}
+
+SSTable::~SSTable() {
+    munmap(const_cast<std::byte *>(data_), file_size_);
+}
+
+auto SSTable::find(std::string_view key, std::vector<std::string_view> &values,
+                   std::vector<cache::BlockCache::Handle> &handles) const
+    -> bool {
+    if (!filter_->contains(key)) {
+        return false;
+    }
+
+    size_t found = values.size();
+    for (size_t i = find_block(key); i < index_.size(); ++i) {
+        block::Block::Iterator it(block::Block{cached_block(i, handles)});
+        for (it.seek(key); it.valid() && it.key() == key; it.next()) {
+            values.push_back(it.value());
+        }
+        // Versions of a key may continue into the next block.
+        if (it.valid() || index_[i].last_key != key) {
+            break;
+        }
+    }
+    return values.size() > found;
+}
+
+auto SSTable::find(std::span<const std::string_view> keys,
+                   std::span<std::vector<std::string_view>> values,
+                   std::vector<cache::BlockCache::Handle> &handles) const
+    -> bool {
+    auto may_contain = std::make_unique<bool[]>(keys.size());
+    filter_->contains(keys, {may_contain.get(), keys.size()});
+
+    // Sorted keys in the same block are next to each other, so the block
+    // loaded for one key is kept for the keys after it.
+    bool found = false;
+    size_t loaded = index_.size();
+    std::optional<block::Block::Iterator> it;
+    for (size_t k = 0; k < keys.size(); ++k) {
+        if (!may_contain[k]) {
+            continue;
+        }
+        auto key = keys[k];
+        for (size_t i = find_block(key); i < index_.size(); ++i) {
+            if (i != loaded) {
+                it.emplace(block::Block{cached_block(i, handles)});
+                loaded = i;
+            }
+            for (it->seek(key); it->valid() && it->key() == key; it->next()) {
+                values[k].push_back(it->value());
+                found = true;
+            }
+            if (it->valid() || index_[i].last_key != key) {
+                break;
+            }
+        }
+    }
+    return found;
+}
+
+auto SSTable::advise(Access access) const -> void {
+    // only a hint, so failures are ignored
+    madvise(const_cast<std::byte *>(data_), file_size_,
+            access == Access::random ? MADV_RANDOM : MADV_SEQUENTIAL);
+}
+
+auto SSTable::id() const -> uint64_t {
+    return id_;
+}
+
+auto SSTable::size() const -> size_t {
+    return count_;
+}
+
+auto SSTable::smallest() const -> std::string_view {
+    return smallest_;
+}
+
+auto SSTable::largest() const -> std::string_view {
+    return index_.empty() ? std::string_view() : index_.back().last_key;
+}
+
+auto SSTable::boundaries() const -> std::vector<std::string_view> {
+    std::vector<std::string_view> keys;
+    keys.reserve(index_.size());
+    for (const auto &entry : index_) {
+        keys.push_back(entry.last_key);
+    }
+    return keys;
+}
+
+auto SSTable::file_size() const -> size_t {
+    return file_size_;
+}
+
+auto SSTable::begin() const -> Iterator {
+    Iterator it(*this);
+    it.seek_to_first();
+    return it;
+}
+
+auto SSTable::find_block(std::string_view key) const -> size_t {
+    auto it = std::ranges::lower_bound(index_, key, {}, &IndexEntry::last_key);
+    return it - index_.begin();
+}
+
+auto SSTable::block(size_t index) const -> std::span<const std::byte> {
+    return {data_ + index_[index].offset, index_[index].size};
+}
+
+auto SSTable::cached_block(
+    size_t index, std::vector<cache::BlockCache::Handle> &handles) const
+    -> std::span<const std::byte> {
+    if (!cache_) {
+        return block(index);
+    }
+    auto handle = cache_->lookup(id_, index_[index].offset);
+    if (!handle) {
+        handle = cache_->insert(id_, index_[index].offset, block(index));
+    }
+    auto data = handle.data();
+    handles.push_back(std::move(handle));
+    return data;
+}
+
+auto SSTable::will_need(size_t offset, size_t size) const -> void {
+    // madvise takes page aligned addresses
+    static const size_t page_size = sysconf(_SC_PAGESIZE);
+    size_t begin = offset & ~(page_size - 1);
+    size_t end = std::min(offset + size, file_size_);
+    if (begin >= end) {
+        return;
+    }
+    // only a hint, so failures are ignored
+    madvise(const_cast<std::byte *>(data_) + begin, end - begin,
+            MADV_WILLNEED);
+}
+
+SSTable::Iterator::Iterator(const SSTable &table)
+    : table_(&table), block_index_(table.index_.size()) {
+}
+
+auto SSTable::Iterator::valid() const -> bool {
+    return block_it_.has_value() && block_it_->valid();
+}
+
+auto SSTable::Iterator::seek_to_first() -> void {
+    reset_readahead();
+    load_block(0);
+    skip_empty_blocks();
+}
+
+auto SSTable::Iterator::seek_to_last() -> void {
+    reset_readahead();
+    // wraps around to past the end for an empty table
+    load_block(table_->index_.size() - 1);
+    if (block_it_.has_value()) {
+        block_it_->seek_to_last();
+    }
+    skip_empty_blocks_backward();
+}
+
+auto SSTable::Iterator::seek(std::string_view key) -> void {
+    reset_readahead();
+    load_block(table_->find_block(key));
+    if (block_it_.has_value()) {
+        block_it_->seek(key);
+    }
+    skip_empty_blocks();
+}
+
+auto SSTable::Iterator::next() -> void {
+    block_it_->next();
+    skip_empty_blocks();
+}
+
+auto SSTable::Iterator::prev() -> void {
+    reset_readahead();
+    block_it_->prev();
+    skip_empty_blocks_backward();
+}
+
+auto SSTable::Iterator::key() const -> std::string_view {
+    return block_it_->key();
+}
+
+auto SSTable::Iterator::value() const -> std::string_view {
+    return block_it_->value();
+}
+
+auto SSTable::Iterator::load_block(size_t index) -> void {
+    block_index_ = index;
+    if (block_index_ >= table_->index_.size()) {
+        block_it_.reset();
+        return;
+    }
+    block_it_.emplace(block::Block{table_->block(block_index_)});
+    block_it_->seek_to_first();
+}
+
+auto SSTable::Iterator::skip_empty_blocks() -> void {
+    while (block_it_.has_value() && !block_it_->valid()) {
+        load_block(block_index_ + 1);
+        readahead();
+    }
+}
+
+auto SSTable::Iterator::skip_empty_blocks_backward() -> void {
+    while (block_it_.has_value() && !block_it_->valid()) {
+        if (block_index_ == 0) {
+            block_it_.reset();
+            return;
+        }
+        load_block(block_index_ - 1);
+        block_it_->seek_to_last();
+    }
+}
+
+auto SSTable::Iterator::readahead() -> void {
+    if (!block_it_.has_value()) {
+        return;
+    }
+    const auto &entry = table_->index_[block_index_];
+    if (entry.offset + entry.size <= readahead_end_) {
+        return;
+    }
+    readahead_size_ = std::clamp(readahead_size_ * 2, SSTABLE_MIN_READAHEAD,
+                                 SSTABLE_MAX_READAHEAD);
+    table_->will_need(entry.offset, readahead_size_);
+    readahead_end_ = entry.offset + readahead_size_;
+}
+
+auto SSTable::Iterator::reset_readahead() -> void {
+    readahead_size_ = 0;
+    readahead_end_ = 0;
+}
+
+}  // namespace sstable
+}  // namespace mousedb
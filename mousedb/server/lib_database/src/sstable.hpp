@@ -1,21 +1,188 @@
 #pragma once
 
+#include <stdio.h>
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "block.hpp"
+#include "cache.hpp"
+#include "filter.hpp"
+
 namespace mousedb {
-namespace database {
 namespace sstable {
+
+constexpr uint64_t SSTABLE_MAGIC = 0x2162646573756f6d;  // "mousedb!"
+constexpr uint32_t SSTABLE_VERSION = 4;
+constexpr size_t SSTABLE_RESTART_INTERVAL = 16;
+constexpr size_t SSTABLE_BITS_PER_KEY = 10;
+// In bytes, how far iterators read ahead of sequential reads, starting from
+// the smaller and doubling up to the larger.
+constexpr size_t SSTABLE_MIN_READAHEAD = 16 << 10;
+constexpr size_t SSTABLE_MAX_READAHEAD = 256 << 10;
+
+// Writes a table of KV pairs, which must be added in sorted order. The file
+// is laid out as
+//    [data blocks][filter][index block][footer]
+// where the index block maps the last key of each data block to its offset
+// and size, the filter is built by filter_policy from the distinct keys and
+// padded so that it can be read in place from a mapping, and the footer is
+//    [filter offset][filter size][index offset][index size][count]
+//    [filter type][version][magic]
+// Example:
+//    SSTableBuilder builder("data/1.sst", 2, 4096);
+//    builder.add("key1", "value1");
+//    builder.add("key2", "value2");
+//    builder.finish();
+class SSTableBuilder {
+   public:
+    SSTableBuilder(const std::filesystem::path &path, size_t expected_count,
+                   size_t block_size,
+                   std::shared_ptr<const filter::FilterPolicy> filter_policy =
+                       std::make_shared<filter::BloomFilterPolicy>(
+                           SSTABLE_BITS_PER_KEY));
+    ~SSTableBuilder();
+    SSTableBuilder(const SSTableBuilder &) = delete;
+    SSTableBuilder &operator=(const SSTableBuilder &) = delete;
+
+    auto add(std::string_view key, std::string_view value) -> void;
+    // Writes the filter, index and footer, and syncs the table.
+    auto finish() -> void;
+
+    auto count() const -> size_t;
+    // In bytes, the size of the file so far.
+    auto file_size() const -> size_t;
+
+   private:
+    FILE *file_;
+    const size_t block_size_;
+    const std::shared_ptr<const filter::FilterPolicy> filter_policy_;
+    block::BlockBuilder data_block_;
+    block::BlockBuilder index_block_;
+    // Sizes the filter once the number of distinct keys is known.
+    std::vector<uint64_t> key_hashes_;
+    size_t offset_ = 0;
+    size_t count_ = 0;
+
+    auto write(std::span<const std::byte> data) -> void;
+    auto flush_data_block() -> void;
+};
+
+enum class Access { random, sequential };
+
+// Reads a table written by SSTableBuilder through a read-only mapping of the
+// whole file. Blocks, keys and values are views into the mapping, so they stay
+// valid for as long as the table does. Lookups expect random access unless
+// told otherwise with advise. Given a block cache, lookups read data blocks
+// through it under the table's id instead, and the values they find stay
+// valid for as long as the returned handles do.
+// Example:
+//    SSTable table("data/1.sst");
+//    std::vector<std::string_view> values;
+//    std::vector<cache::BlockCache::Handle> handles;
+//    table.find("key", values, handles);
 class SSTable {
    public:
-    SSTable(const std::string &filename);
-    void add(const std::string &key, const std::string &value);
-    bool get(const std::string &key, std::string &value) const;
-    void remove(const std::string &key);
-    void flush();
+    class Iterator;
+
+    explicit SSTable(const std::filesystem::path &path, uint64_t id = 0,
+                     std::shared_ptr<cache::BlockCache> cache = nullptr);
+    ~SSTable();
+    SSTable(const SSTable &) = delete;
+    SSTable &operator=(const SSTable &) = delete;
+
+    // Appends every value stored for key and returns whether there was any.
+    // Handles to the cached blocks backing the values are appended too.
+    auto find(std::string_view key, std::vector<std::string_view> &values,
+              std::vector<cache::BlockCache::Handle> &handles) const -> bool;
+    // Appends every value stored for keys[i] to values[i] and returns whether
+    // there was any, where keys must be sorted. The filter is probed for the
+    // whole batch at once, and each data block is read once for every key in
+    // it.
+    auto find(std::span<const std::string_view> keys,
+              std::span<std::vector<std::string_view>> values,
+              std::vector<cache::BlockCache::Handle> &handles) const -> bool;
+    // Hints to the kernel how the table will be read from now on.
+    auto advise(Access access) const -> void;
+
+    auto id() const -> uint64_t;
+    auto size() const -> size_t;
+    // In bytes, the size of the file.
+    auto file_size() const -> size_t;
+    // The least and greatest keys in the table, which are empty if it is.
+    auto smallest() const -> std::string_view;
+    auto largest() const -> std::string_view;
+    // The last key of each data block, which split the table into ranges of
+    // about one block each.
+    auto boundaries() const -> std::vector<std::string_view>;
+
+    auto begin() const -> Iterator;
+
+   private:
+    struct IndexEntry {
+        std::string last_key;
+        uint64_t offset;
+        uint64_t size;
+    };
+
+    const uint64_t id_;
+    const std::shared_ptr<cache::BlockCache> cache_;
+    const std::byte *data_ = nullptr;
+    size_t file_size_ = 0;
+    std::unique_ptr<filter::Filter> filter_;
+    std::vector<IndexEntry> index_;
+    std::string smallest_;
+    size_t count_;
+
+    // Finds the first block whose last key is not less than key.
+    auto find_block(std::string_view key) const -> size_t;
+    auto block(size_t index) const -> std::span<const std::byte>;
+    // Reads a block through the cache if there is one.
+    auto cached_block(size_t index,
+                      std::vector<cache::BlockCache::Handle> &handles) const
+        -> std::span<const std::byte>;
+    // Asks the kernel to start reading size bytes from offset.
+    auto will_need(size_t offset, size_t size) const -> void;
+};
+
+// Iterates over a table in key order. While it moves forward from block to
+// block, it reads ahead of itself, doubling how far each time up to
+// SSTABLE_MAX_READAHEAD, and starts over whenever it is repositioned.
+class SSTable::Iterator {
+   public:
+    explicit Iterator(const SSTable &table);
+
+    auto valid() const -> bool;
+    auto seek_to_first() -> void;
+    auto seek_to_last() -> void;
+    // Moves to the first entry whose key is not less than key.
+    auto seek(std::string_view key) -> void;
+    auto next() -> void;
+    auto prev() -> void;
+
+    auto key() const -> std::string_view;
+    auto value() const -> std::string_view;
 
    private:
-    std::string filename;
-    // Other private members for managing the SSTable
+    const SSTable *table_;
+    size_t block_index_;
+    std::optional<block::Block::Iterator> block_it_;
+    size_t readahead_size_ = 0;
+    // The offset that has been read ahead up to.
+    size_t readahead_end_ = 0;
+
+    auto load_block(size_t index) -> void;
+    // Moves past exhausted blocks.
+    auto skip_empty_blocks() -> void;
+    auto skip_empty_blocks_backward() -> void;
+    auto readahead() -> void;
+    auto reset_readahead() -> void;
 };
 
 }  // namespace sstable
-}  // namespace database
 }  // namespace mousedb
@@ -0,0 +1,271 @@
+#include "sstable.hpp"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <format>
+#include <string>
+#include <vector>
+
+using namespace mousedb::sstable;
+
+namespace fs = std::filesystem;
+
+static auto temp_path(std::string_view name) -> fs::path {
+    return fs::temp_directory_path() / std::format("mousedb_{}.sst", name);
+}
+
+TEST(sstable_SSTable, FindSingleBlock) {
+    auto path = temp_path("single");
+    {
+        SSTableBuilder builder(path, 3, 4096);
+        builder.add("apple", "1");
+        builder.add("apricot", "2");
+        builder.add("banana", "3");
+        builder.finish();
+    }
+    SSTable table(path);
+    EXPECT_EQ(table.size(), 3u);
+    std::vector<std::string_view> values;
+    std::vector<mousedb::cache::BlockCache::Handle> handles;
+    EXPECT_TRUE(table.find("apricot", values, handles));
+    ASSERT_EQ(values.size(), 1u);
+    EXPECT_EQ(values[0], "2");
+    values.clear();
+    EXPECT_FALSE(table.find("apples", values, handles));
+    EXPECT_FALSE(table.find("cherry", values, handles));
+    EXPECT_TRUE(values.empty());
+    fs::remove(path);
+}
+
+TEST(sstable_SSTable, FindAcrossBlocks) {
+    auto path = temp_path("blocks");
+    {
+        SSTableBuilder builder(path, 10000, 256);
+        for (int i = 0; i < 10000; ++i) {
+            builder.add(std::format("key{:05}", i), std::format("value{}", i));
+        }
+        builder.finish();
+    }
+    SSTable table(path);
+    EXPECT_EQ(table.size(), 10000u);
+    EXPECT_EQ(table.smallest(), "key00000");
+    EXPECT_EQ(table.largest(), "key09999");
+    auto boundaries = table.boundaries();
+    EXPECT_GT(boundaries.size(), 1u);
+    EXPECT_TRUE(std::ranges::is_sorted(boundaries));
+    EXPECT_EQ(boundaries.back(), "key09999");
+    for (int i = 0; i < 10000; i += 7) {
+        std::vector<std::string_view> values;
+        std::vector<mousedb::cache::BlockCache::Handle> handles;
+        ASSERT_TRUE(table.find(std::format("key{:05}", i), values, handles))
+            << i;
+        ASSERT_EQ(values.size(), 1u);
+        EXPECT_EQ(values[0], std::format("value{}", i));
+    }
+    fs::remove(path);
+}
+
+TEST(sstable_SSTable, FindVersionsSpanningBlocks) {
+    auto path = temp_path("versions");
+    {
+        SSTableBuilder builder(path, 102, 64);
+        builder.add("a", "0");
+        for (int i = 0; i < 100; ++i) {
+            builder.add("b", std::format("{:03}", i));
+        }
+        builder.add("c", "0");
+        builder.finish();
+    }
+    SSTable table(path);
+    std::vector<std::string_view> values;
+    std::vector<mousedb::cache::BlockCache::Handle> handles;
+    EXPECT_TRUE(table.find("b", values, handles));
+    ASSERT_EQ(values.size(), 100u);
+    for (int i = 0; i < 100; ++i) {
+        EXPECT_EQ(values[i], std::format("{:03}", i));
+    }
+    fs::remove(path);
+}
+
+TEST(sstable_SSTable, IterateAndSeek) {
+    auto path = temp_path("iterate");
+    {
+        SSTableBuilder builder(path, 1000, 128);
+        for (int i = 0; i < 1000; i += 2) {
+            builder.add(std::format("key{:04}", i), std::string(i % 7, 'v'));
+        }
+        builder.finish();
+    }
+    SSTable table(path);
+    int i = 0;
+    for (auto it = table.begin(); it.valid(); it.next()) {
+        EXPECT_EQ(it.key(), std::format("key{:04}", i));
+        EXPECT_EQ(it.value(), std::string(i % 7, 'v'));
+        i += 2;
+    }
+    EXPECT_EQ(i, 1000);
+
+    SSTable::Iterator it(table);
+    it.seek("key0501");
+    ASSERT_TRUE(it.valid());
+    EXPECT_EQ(it.key(), "key0502");
+    it.seek("key0998");
+    ASSERT_TRUE(it.valid());
+    EXPECT_EQ(it.key(), "key0998");
+    it.seek("key0999");
+    EXPECT_FALSE(it.valid());
+    fs::remove(path);
+}
+
+TEST(sstable_SSTable, IterateBackward) {
+    auto path = temp_path("backward");
+    {
+        SSTableBuilder builder(path, 1000, 128);
+        for (int i = 0; i < 1000; i += 2) {
+            builder.add(std::format("key{:04}", i), std::string(i % 7, 'v'));
+        }
+        builder.finish();
+    }
+    SSTable table(path);
+    SSTable::Iterator it(table);
+    int i = 998;
+    for (it.seek_to_last(); it.valid(); it.prev()) {
+        EXPECT_EQ(it.key(), std::format("key{:04}", i));
+        EXPECT_EQ(it.value(), std::string(i % 7, 'v'));
+        i -= 2;
+    }
+    EXPECT_EQ(i, -2);
+
+    // switches direction across block boundaries
+    it.seek("key0501");
+    it.prev();
+    ASSERT_TRUE(it.valid());
+    EXPECT_EQ(it.key(), "key0500");
+    for (int j = 0; j < 100; ++j) {
+        it.prev();
+    }
+    ASSERT_TRUE(it.valid());
+    EXPECT_EQ(it.key(), "key0300");
+    it.next();
+    EXPECT_EQ(it.key(), "key0302");
+    fs::remove(path);
+}
+
+TEST(sstable_SSTable, RejectsForeignFile) {
+    auto path = temp_path("foreign");
+    FILE *fp = fopen(path.c_str(), "wb");
+    ASSERT_NE(fp, nullptr);
+    std::string junk(128, 'x');
+    fwrite(junk.data(), 1, junk.size(), fp);
+    fclose(fp);
+    EXPECT_THROW(SSTable table(path), std::runtime_error);
+    fs::remove(path);
+}
+
+TEST(sstable_SSTable, ViewsOutliveIterators) {
+    auto path = temp_path("views");
+    {
+        SSTableBuilder builder(path, 1000, 128);
+        for (int i = 0; i < 1000; ++i) {
+            builder.add(std::format("key{:04}", i), std::format("value{}", i));
+        }
+        builder.finish();
+    }
+    SSTable table(path);
+    std::vector<std::string_view> values;
+    for (auto it = table.begin(); it.valid(); it.next()) {
+        values.push_back(it.value());
+    }
+    table.advise(Access::sequential);
+    ASSERT_EQ(values.size(), 1000u);
+    for (int i = 0; i < 1000; ++i) {
+        EXPECT_EQ(values[i], std::format("value{}", i));
+    }
+    fs::remove(path);
+}
+
+TEST(sstable_SSTable, FindThroughBlockCache) {
+    auto path = temp_path("cached");
+    {
+        SSTableBuilder builder(path, 1000, 128);
+        for (int i = 0; i < 1000; ++i) {
+            builder.add(std::format("key{:04}", i), std::format("value{}", i));
+        }
+        builder.finish();
+    }
+    auto cache = std::make_shared<mousedb::cache::BlockCache>(1 << 20);
+    SSTable table(path, 1, cache);
+    for (int round = 0; round < 2; ++round) {
+        for (int i = 0; i < 1000; i += 10) {
+            std::vector<std::string_view> values;
+            std::vector<mousedb::cache::BlockCache::Handle> handles;
+            ASSERT_TRUE(
+                table.find(std::format("key{:04}", i), values, handles));
+            ASSERT_EQ(values.size(), 1u);
+            EXPECT_EQ(values[0], std::format("value{}", i));
+            EXPECT_EQ(handles.size(), 1u);
+        }
+    }
+    EXPECT_EQ(cache->hits() + cache->misses(), 200u);
+    EXPECT_GE(cache->hits(), 100u);
+    EXPECT_GT(cache->usage(), 0u);
+    fs::remove(path);
+}
+
+TEST(sstable_SSTable, FindBatchReadsEachBlockOnce) {
+    auto path = temp_path("batch");
+    {
+        SSTableBuilder builder(path, 500, 128);
+        for (int i = 0; i < 1000; i += 2) {
+            builder.add(std::format("key{:04}", i), std::format("value{}", i));
+        }
+        builder.finish();
+    }
+    auto cache = std::make_shared<mousedb::cache::BlockCache>(1 << 20);
+    SSTable table(path, 1, cache);
+    std::vector<std::string> owned;
+    for (int i = 0; i < 1000; ++i) {
+        owned.push_back(std::format("key{:04}", i));
+    }
+    std::vector<std::string_view> keys(owned.begin(), owned.end());
+    std::vector<std::vector<std::string_view>> values(keys.size());
+    std::vector<mousedb::cache::BlockCache::Handle> handles;
+    EXPECT_TRUE(table.find(keys, values, handles));
+    for (int i = 0; i < 1000; ++i) {
+        if (i % 2 == 0) {
+            ASSERT_EQ(values[i].size(), 1u) << i;
+            EXPECT_EQ(values[i][0], std::format("value{}", i));
+        } else {
+            EXPECT_TRUE(values[i].empty()) << i;
+        }
+    }
+    EXPECT_EQ(handles.size(), table.boundaries().size());
+    EXPECT_EQ(cache->misses(), table.boundaries().size());
+    fs::remove(path);
+}
+
+TEST(sstable_SSTable, FindWithBinaryFuseFilter) {
+    auto path = temp_path("fuse");
+    {
+        SSTableBuilder builder(
+            path, 1000, 128,
+            std::make_shared<mousedb::filter::BinaryFuseFilterPolicy>());
+        for (int i = 0; i < 1000; i += 2) {
+            builder.add(std::format("key{:04}", i), std::format("value{}", i));
+        }
+        builder.finish();
+    }
+    SSTable table(path);
+    for (int i = 0; i < 1000; ++i) {
+        std::vector<std::string_view> values;
+        std::vector<mousedb::cache::BlockCache::Handle> handles;
+        bool found = table.find(std::format("key{:04}", i), values, handles);
+        ASSERT_EQ(found, i % 2 == 0) << i;
+        if (found) {
+            EXPECT_EQ(values[0], std::format("value{}", i));
+        }
+    }
+    fs::remove(path);
+}
@@ -0,0 +1,84 @@
+#include "table_cache.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <format>
+#include <mutex>
+#include <thread>
+
+namespace mousedb {
+namespace table_cache {
+
+TableCache::TableCache(const std::filesystem::path &data_path,
+                       size_t capacity,
+                       std::shared_ptr<cache::BlockCache> block_cache)
+    : data_path_(data_path),
+      block_cache_(std::move(block_cache)),
+      shards_(std::bit_ceil(
+          std::max(std::thread::hardware_concurrency(), 1u))),
+      shard_capacity_(std::max(capacity / shards_.size(),
+                               static_cast<size_t>(1))) {
+}
+
+auto TableCache::get(uint64_t id) -> std::shared_ptr<sstable::SSTable> {
+    Shard &shard = get_shard(id);
+    {
+        std::scoped_lock lock(shard.mutex);
+        auto it = shard.tables.find(id);
+        if (it != shard.tables.end()) {
+            shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+            return *it->second;
+        }
+    }
+
+    // opens outside of the lock, so a racing get may open the table too
+    auto table = std::make_shared<sstable::SSTable>(path(id), id, block_cache_);
+    std::shared_ptr<sstable::SSTable> evicted;
+    std::scoped_lock lock(shard.mutex);
+    auto it = shard.tables.find(id);
+    if (it != shard.tables.end()) {
+        return *it->second;
+    }
+    shard.lru.push_front(table);
+    shard.tables.emplace(id, shard.lru.begin());
+    if (shard.tables.size() > shard_capacity_) {
+        // closes the table after unlocking
+        evicted = std::move(shard.lru.back());
+        shard.tables.erase(evicted->id());
+        shard.lru.pop_back();
+    }
+    return table;
+}
+
+auto TableCache::evict(uint64_t id) -> void {
+    std::shared_ptr<sstable::SSTable> evicted;
+    Shard &shard = get_shard(id);
+    std::scoped_lock lock(shard.mutex);
+    auto it = shard.tables.find(id);
+    if (it == shard.tables.end()) {
+        return;
+    }
+    evicted = std::move(*it->second);
+    shard.lru.erase(it->second);
+    shard.tables.erase(it);
+}
+
+auto TableCache::path(uint64_t id) const -> std::filesystem::path {
+    return data_path_ / std::format("{}.sst", id);
+}
+
+auto TableCache::size() const -> size_t {
+    size_t size = 0;
+    for (auto &shard : shards_) {
+        std::scoped_lock lock(const_cast<Shard &>(shard).mutex);
+        size += shard.tables.size();
+    }
+    return size;
+}
+
+inline auto TableCache::get_shard(uint64_t id) -> Shard & {
+    return shards_[id & (shards_.size() - 1)];
+}
+
+}  // namespace table_cache
+}  // namespace mousedb
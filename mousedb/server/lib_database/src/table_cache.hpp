@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "cache.hpp"
+#include "spin_mutex.hpp"
+#include "sstable.hpp"
+
+namespace mousedb {
+namespace table_cache {
+// Keeps up to capacity SSTables open, along with their parsed footers,
+// indexes and filters, so that reads and compactions share them instead of
+// opening the files again. The cache is split into shards by id, each
+// evicting its least recently used table once full. An evicted table stays
+// usable by whoever still holds it and is closed when they let go.
+// Example:
+//    TableCache tables("data", 1024, nullptr);
+//    auto table = tables.get(1);  // opens data/1.sst
+class TableCache {
+   public:
+    TableCache(const std::filesystem::path &data_path, size_t capacity,
+               std::shared_ptr<cache::BlockCache> block_cache);
+    TableCache(const TableCache &) = delete;
+    TableCache &operator=(const TableCache &) = delete;
+
+    // Opens the table if it is not cached. Throws if it cannot be opened.
+    auto get(uint64_t id) -> std::shared_ptr<sstable::SSTable>;
+    // Drops the table, such as before its file is removed.
+    auto evict(uint64_t id) -> void;
+    auto path(uint64_t id) const -> std::filesystem::path;
+
+    // The number of cached tables.
+    auto size() const -> size_t;
+
+   private:
+    struct alignas(64) Shard {
+        // From most to least recently used.
+        std::list<std::shared_ptr<sstable::SSTable>> lru;
+        std::unordered_map<
+            uint64_t, std::list<std::shared_ptr<sstable::SSTable>>::iterator>
+            tables;
+        spin_mutex::SpinMutex mutex;
+    };
+
+    const std::filesystem::path data_path_;
+    const std::shared_ptr<cache::BlockCache> block_cache_;
+    std::vector<Shard> shards_;
+    const size_t shard_capacity_;
+
+    inline auto get_shard(uint64_t id) -> Shard &;
+};
+
+}  // namespace table_cache
+}  // namespace mousedb
@@ -0,0 +1,72 @@
+#include "table_cache.hpp"
+
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <format>
+#include <string>
+#include <vector>
+
+using namespace mousedb::table_cache;
+
+namespace fs = std::filesystem;
+
+static auto make_tables(const fs::path &dir, size_t count) -> void {
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+    for (size_t id = 0; id < count; ++id) {
+        mousedb::sstable::SSTableBuilder builder(
+            dir / std::format("{}.sst", id), 1, 4096);
+        builder.add("key", std::format("value{}", id));
+        builder.finish();
+    }
+}
+
+TEST(table_cache_TableCache, SharesOpenTables) {
+    auto dir = fs::temp_directory_path() / "mousedb_table_cache_share";
+    make_tables(dir, 4);
+    TableCache tables(dir, 16, nullptr);
+    auto table = tables.get(2);
+    EXPECT_EQ(table->id(), 2u);
+    EXPECT_EQ(tables.get(2), table);
+    EXPECT_EQ(tables.size(), 1u);
+
+    std::vector<std::string_view> values;
+    std::vector<mousedb::cache::BlockCache::Handle> handles;
+    ASSERT_TRUE(table->find("key", values, handles));
+    EXPECT_EQ(values[0], "value2");
+    EXPECT_THROW(tables.get(7), std::runtime_error);
+    fs::remove_all(dir);
+}
+
+TEST(table_cache_TableCache, EvictsUnderLimit) {
+    auto dir = fs::temp_directory_path() / "mousedb_table_cache_limit";
+    make_tables(dir, 64);
+    TableCache tables(dir, 8, nullptr);
+    auto held = tables.get(0);
+    for (uint64_t id = 0; id < 64; ++id) {
+        EXPECT_EQ(tables.get(id)->id(), id);
+        EXPECT_LE(tables.size(), 8u);
+    }
+    // evicted tables stay usable by their holders
+    std::vector<std::string_view> values;
+    std::vector<mousedb::cache::BlockCache::Handle> handles;
+    ASSERT_TRUE(held->find("key", values, handles));
+    EXPECT_EQ(values[0], "value0");
+    fs::remove_all(dir);
+}
+
+TEST(table_cache_TableCache, EvictDropsTable) {
+    auto dir = fs::temp_directory_path() / "mousedb_table_cache_evict";
+    make_tables(dir, 2);
+    TableCache tables(dir, 16, nullptr);
+    tables.get(0);
+    tables.get(1);
+    tables.evict(0);
+    tables.evict(5);
+    EXPECT_EQ(tables.size(), 1u);
+    fs::remove(tables.path(0));
+    EXPECT_THROW(tables.get(0), std::runtime_error);
+    EXPECT_EQ(tables.get(1)->id(), 1u);
+    fs::remove_all(dir);
+}
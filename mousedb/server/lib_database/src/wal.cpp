@@ -0,0 +1,811 @@
+#include "wal.hpp"
+
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <format>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+
+#include "coding.hpp"
+#include "crc32c.hpp"
+
+namespace mousedb {
+namespace wal {
+
+namespace {
+auto encode(std::vector<std::byte> &buffer, Op op, size_t oid,
+            std::string_view key, std::string_view value) -> void {
+    coding::put_fixed(buffer, static_cast<size_t>(op));
+    coding::put_fixed(buffer, oid);
+    coding::put_fixed(buffer, key.size());
+    auto key_bytes = std::as_bytes(std::span(key));
+    buffer.insert(buffer.end(), key_bytes.begin(), key_bytes.end());
+    if (op != Op::erase) {
+        coding::put_fixed(buffer, value.size());
+        auto value_bytes = std::as_bytes(std::span(value));
+        buffer.insert(buffer.end(), value_bytes.begin(), value_bytes.end());
+    }
+}
+
+// Returns where a record of size bytes that starts at offset ends, once it
+// is split into fragments.
+auto record_end(size_t offset, size_t size) -> size_t {
+    do {
+        size_t block_left = WAL_BLOCK_SIZE - offset % WAL_BLOCK_SIZE;
+        if (block_left < WAL_HEADER_SIZE) {
+            offset += block_left;
+            block_left = WAL_BLOCK_SIZE;
+        }
+        size_t fragment_size = std::min(size, block_left - WAL_HEADER_SIZE);
+        offset += WAL_HEADER_SIZE + fragment_size;
+        size -= fragment_size;
+    } while (size > 0);
+    return offset;
+}
+
+// makes renames and new files in dir durable
+auto sync_dir(const std::filesystem::path &dir) -> void {
+    int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd < 0) {
+        throw std::runtime_error(std::format("Failed to open {}", dir.c_str()));
+    }
+    int result = fsync(fd);
+    close(fd);
+    if (result != 0) {
+        throw std::runtime_error(std::format("Failed to sync {}", dir.c_str()));
+    }
+}
+}  // namespace
+
+// A ring of two entries, which is enough for one write and the sync linked to
+// it. The rings are set up and driven through the system calls, as the kernel
+// documents, so that liburing is not needed.
+class Uring {
+   public:
+    struct Result {
+        // The bytes written, or a negative errno.
+        int64_t written = 0;
+        // Zero once synced, or a negative errno, which is -ECANCELED if the
+        // write fell short.
+        int synced = -ECANCELED;
+        // Whether the kernel may still be reading the data, because a
+        // submission failed and its submitted requests could not be waited
+        // for.
+        bool in_flight = false;
+    };
+
+    // Returns nullptr if io_uring is unavailable, as under seccomp filters
+    // or on kernels older than 5.6.
+    static auto create() -> std::unique_ptr<Uring> {
+        io_uring_params params{};
+        int fd = static_cast<int>(syscall(__NR_io_uring_setup, 2, &params));
+        if (fd < 0) {
+            return nullptr;
+        }
+        std::unique_ptr<Uring> uring(new Uring(fd));
+        if (!uring->map(params)) {
+            return nullptr;
+        }
+        return uring;
+    }
+
+    ~Uring() {
+        if (sqes_ != MAP_FAILED) {
+            munmap(sqes_, sqes_size_);
+        }
+        if (cq_ring_ != MAP_FAILED && cq_ring_ != sq_ring_) {
+            munmap(cq_ring_, cq_ring_size_);
+        }
+        if (sq_ring_ != MAP_FAILED) {
+            munmap(sq_ring_, sq_ring_size_);
+        }
+        close(fd_);
+    }
+
+    Uring(const Uring &) = delete;
+    Uring &operator=(const Uring &) = delete;
+
+    // Writes data at offset in fd and, if sync is set, then fdatasyncs fd,
+    // waiting for both. Only one thread may call it at a time.
+    auto write(int fd, std::span<const std::byte> data, uint64_t offset,
+               bool sync) -> Result {
+        // only this thread moves the tail of the submission ring, and only
+        // the kernel moves the tail of the completion ring
+        unsigned tail = *sq_tail_;
+        auto push = [&](uint8_t opcode, uint64_t user_data) -> io_uring_sqe & {
+            unsigned index = tail++ & *sq_mask_;
+            io_uring_sqe &sqe = static_cast<io_uring_sqe *>(sqes_)[index];
+            std::memset(&sqe, 0, sizeof(sqe));
+            sqe.opcode = opcode;
+            sqe.fd = fd;
+            sqe.user_data = user_data;
+            sq_array_[index] = index;
+            return sqe;
+        };
+        io_uring_sqe &write = push(IORING_OP_WRITE, 0);
+        write.addr = reinterpret_cast<uint64_t>(data.data());
+        write.len = static_cast<uint32_t>(
+            std::min(data.size(), size_t{std::numeric_limits<int>::max()}));
+        write.off = offset;
+        unsigned count = 1;
+        if (sync) {
+            // the sync only runs once the write completes in full
+            write.flags |= IOSQE_IO_LINK;
+            io_uring_sqe &fsync = push(IORING_OP_FSYNC, 1);
+            fsync.fsync_flags = IORING_FSYNC_DATASYNC;
+            ++count;
+        }
+        std::atomic_ref(*sq_tail_).store(tail, std::memory_order_release);
+
+        Result result;
+        unsigned submitted = 0;
+        unsigned completed = 0;
+        while (completed < count) {
+            long entered =
+                syscall(__NR_io_uring_enter, fd_, count - submitted,
+                        count - completed, IORING_ENTER_GETEVENTS, nullptr, 0);
+            if (entered < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                result.written = -errno;
+                // the requests already submitted still read data, so they
+                // are waited for before it can be reused
+                result.in_flight = !drain(submitted - completed);
+                return result;
+            }
+            submitted += static_cast<unsigned>(entered);
+            unsigned head = *cq_head_;
+            unsigned cq_tail =
+                std::atomic_ref(*cq_tail_).load(std::memory_order_acquire);
+            for (; head != cq_tail; ++head, ++completed) {
+                const io_uring_cqe &cqe = cqes_[head & *cq_mask_];
+                if (cqe.user_data == 0) {
+                    result.written = cqe.res;
+                } else {
+                    result.synced = cqe.res;
+                }
+            }
+            std::atomic_ref(*cq_head_).store(head, std::memory_order_release);
+        }
+        return result;
+    }
+
+   private:
+    int fd_;
+    void *sq_ring_ = MAP_FAILED;
+    size_t sq_ring_size_ = 0;
+    void *cq_ring_ = MAP_FAILED;
+    size_t cq_ring_size_ = 0;
+    void *sqes_ = MAP_FAILED;
+    size_t sqes_size_ = 0;
+    unsigned *sq_tail_ = nullptr;
+    unsigned *sq_mask_ = nullptr;
+    unsigned *sq_array_ = nullptr;
+    unsigned *cq_head_ = nullptr;
+    unsigned *cq_tail_ = nullptr;
+    unsigned *cq_mask_ = nullptr;
+    io_uring_cqe *cqes_ = nullptr;
+
+    explicit Uring(int fd) : fd_(fd) {
+    }
+
+    // Waits for count submitted requests to complete and drops their
+    // results. Returns false if they could not be waited for.
+    auto drain(unsigned count) -> bool {
+        while (count > 0) {
+            long entered = syscall(__NR_io_uring_enter, fd_, 0, count,
+                                   IORING_ENTER_GETEVENTS, nullptr, 0);
+            if (entered < 0 && errno != EINTR) {
+                return false;
+            }
+            unsigned head = *cq_head_;
+            unsigned cq_tail =
+                std::atomic_ref(*cq_tail_).load(std::memory_order_acquire);
+            for (; head != cq_tail && count > 0; ++head) {
+                --count;
+            }
+            std::atomic_ref(*cq_head_).store(head, std::memory_order_release);
+        }
+        return true;
+    }
+
+    auto map(const io_uring_params &params) -> bool {
+        sq_ring_size_ =
+            params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_ring_size_ =
+            params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single_mmap) {
+            sq_ring_size_ = cq_ring_size_ =
+                std::max(sq_ring_size_, cq_ring_size_);
+        }
+        sq_ring_ = mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+        if (sq_ring_ == MAP_FAILED) {
+            return false;
+        }
+        cq_ring_ = single_mmap ? sq_ring_
+                               : mmap(nullptr, cq_ring_size_,
+                                      PROT_READ | PROT_WRITE,
+                                      MAP_SHARED | MAP_POPULATE, fd_,
+                                      IORING_OFF_CQ_RING);
+        if (cq_ring_ == MAP_FAILED) {
+            return false;
+        }
+        sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+        sqes_ = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+        if (sqes_ == MAP_FAILED) {
+            return false;
+        }
+        auto *sq = static_cast<std::byte *>(sq_ring_);
+        auto *cq = static_cast<std::byte *>(cq_ring_);
+        sq_tail_ = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+        sq_mask_ = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+        sq_array_ = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+        cq_head_ = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+        cq_tail_ = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+        cq_mask_ = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+        return true;
+    }
+};
+
+Reader::Reader(const std::filesystem::path &path, uint64_t number)
+    : path_(path), number_(static_cast<uint32_t>(number)) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error(
+            std::format("Failed to open {}", path.c_str()));
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        throw std::runtime_error(
+            std::format("Failed to stat {}", path.c_str()));
+    }
+    size_t size = st.st_size;
+    if (size > 0) {
+        void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            close(fd);
+            throw std::runtime_error(
+                std::format("Failed to map {}", path.c_str()));
+        }
+        madvise(data, size, MADV_SEQUENTIAL);
+        data_ = {static_cast<const std::byte *>(data), size};
+    }
+    close(fd);
+}
+
+Reader::Reader(Reader &&other) noexcept
+    : op(other.op),
+      oid(other.oid),
+      key(other.key),
+      value(other.value),
+      path_(std::move(other.path_)),
+      number_(other.number_),
+      data_(std::exchange(other.data_, {})),
+      offset_(other.offset_),
+      scratch_(std::move(other.scratch_)) {
+}
+
+Reader::~Reader() {
+    if (!data_.empty()) {
+        munmap(const_cast<std::byte *>(data_.data()), data_.size());
+    }
+}
+
+auto Reader::path() const -> const std::filesystem::path & {
+    return path_;
+}
+
+auto Reader::next() -> bool {
+    scratch_.clear();
+    bool fragmented = false;
+    FragmentType type;
+    std::span<const std::byte> payload;
+    while (read_fragment(type, payload)) {
+        switch (type) {
+            case FragmentType::full:
+                if (fragmented || !parse(payload)) {
+                    break;
+                }
+                return true;
+            case FragmentType::first:
+                if (fragmented) {
+                    break;
+                }
+                scratch_.assign(payload.begin(), payload.end());
+                fragmented = true;
+                continue;
+            case FragmentType::middle:
+                if (!fragmented) {
+                    break;
+                }
+                scratch_.insert(scratch_.end(), payload.begin(), payload.end());
+                continue;
+            case FragmentType::last:
+                if (!fragmented) {
+                    break;
+                }
+                scratch_.insert(scratch_.end(), payload.begin(), payload.end());
+                if (!parse(scratch_)) {
+                    break;
+                }
+                return true;
+        }
+        break;
+    }
+    // nothing past damage is trusted
+    offset_ = data_.size();
+    return false;
+}
+
+auto Reader::read_fragment(FragmentType &type,
+                           std::span<const std::byte> &payload) -> bool {
+    size_t block_left = WAL_BLOCK_SIZE - offset_ % WAL_BLOCK_SIZE;
+    if (block_left < WAL_HEADER_SIZE) {
+        // skips the padding at the end of the block
+        offset_ += block_left;
+        block_left = WAL_BLOCK_SIZE;
+    }
+    if (offset_ >= data_.size() || data_.size() - offset_ < WAL_HEADER_SIZE) {
+        return false;
+    }
+    const std::byte *header = data_.data() + offset_;
+    auto crc = crc32c::unmask(coding::decode_fixed<uint32_t>(header));
+    auto size = coding::decode_fixed<uint16_t>(header + sizeof(uint32_t));
+    auto raw_type =
+        static_cast<uint8_t>(header[sizeof(uint32_t) + sizeof(uint16_t)]);
+    if (raw_type < static_cast<uint8_t>(FragmentType::full) ||
+        raw_type > static_cast<uint8_t>(FragmentType::last) ||
+        WAL_HEADER_SIZE + size > block_left ||
+        WAL_HEADER_SIZE + size > data_.size() - offset_) {
+        return false;
+    }
+    // the CRC covers the type, the segment number and the payload
+    constexpr size_t crc_offset = sizeof(uint32_t) + sizeof(uint16_t);
+    if (crc32c::value({header + crc_offset,
+                       WAL_HEADER_SIZE - crc_offset + size}) != crc ||
+        coding::decode_fixed<uint32_t>(header + crc_offset + 1) != number_) {
+        return false;
+    }
+    type = static_cast<FragmentType>(raw_type);
+    payload = {header + WAL_HEADER_SIZE, size};
+    offset_ += WAL_HEADER_SIZE + size;
+    return true;
+}
+
+auto Reader::parse(std::span<const std::byte> payload) -> bool {
+    size_t offset = 0;
+    auto read_size = [&](size_t &size) {
+        if (payload.size() - offset < sizeof(size_t)) {
+            return false;
+        }
+        size = coding::decode_fixed<size_t>(payload.data() + offset);
+        offset += sizeof(size_t);
+        return true;
+    };
+    auto read_bytes = [&](std::string_view &bytes) {
+        size_t size;
+        if (!read_size(size) || payload.size() - offset < size) {
+            return false;
+        }
+        bytes = {reinterpret_cast<const char *>(payload.data() + offset),
+                 size};
+        offset += size;
+        return true;
+    };
+
+    size_t raw_op;
+    if (!read_size(raw_op) || !read_size(oid) || !read_bytes(key)) {
+        return false;
+    }
+    op = static_cast<Op>(raw_op);
+    value = {};
+    switch (op) {
+        case Op::insert:
+        case Op::batch:
+            return read_bytes(value) && offset == payload.size();
+        case Op::erase:
+            return offset == payload.size();
+    }
+    return false;
+}
+
+SegmentPool::SegmentPool(const std::filesystem::path &dir,
+                         size_t segment_size, size_t max_free)
+    : dir_(dir), segment_size_(segment_size), max_free_(max_free) {
+    for (const auto &entry : std::filesystem::directory_iterator(dir_)) {
+        auto extension = entry.path().extension();
+        if (extension != WAL_EXTENSION && extension != WAL_FREE_EXTENSION) {
+            continue;
+        }
+        uint64_t number;
+        try {
+            number = std::stoull(entry.path().stem());
+        } catch (const std::exception &) {
+            continue;
+        }
+        next_number_ = std::max(next_number_, number + 1);
+        if (extension == WAL_EXTENSION) {
+            live_.push_back(number);
+        } else if (free_.size() < max_free_) {
+            free_.push_back(entry.path());
+        } else {
+            std::filesystem::remove(entry.path());
+        }
+    }
+    std::ranges::sort(live_);
+}
+
+auto SegmentPool::live() const -> const std::vector<uint64_t> & {
+    return live_;
+}
+
+auto SegmentPool::path(uint64_t number) const -> std::filesystem::path {
+    return dir_ / std::format("{}{}", number, WAL_EXTENSION);
+}
+
+auto SegmentPool::segment_size() const -> size_t {
+    return segment_size_;
+}
+
+auto SegmentPool::free_count() -> size_t {
+    std::scoped_lock lock(mutex_);
+    return free_.size();
+}
+
+auto SegmentPool::acquire() -> Segment {
+    Segment segment;
+    std::filesystem::path free;
+    {
+        std::scoped_lock lock(mutex_);
+        segment.number = next_number_++;
+        if (!free_.empty()) {
+            free = std::move(free_.back());
+            free_.pop_back();
+        }
+    }
+    auto path = this->path(segment.number);
+    if (!free.empty()) {
+        // the old records are written over, and the reader stops at the
+        // first one left, whose segment number is stale
+        std::filesystem::rename(free, path);
+        segment.fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+    } else {
+        segment.fd =
+            open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        // some file systems cannot preallocate, and only lose the head start
+        if (segment.fd >= 0) {
+            std::ignore = fallocate(segment.fd, 0, 0, segment_size_);
+        }
+    }
+    if (segment.fd < 0) {
+        throw std::runtime_error(
+            std::format("Failed to create {}", path.c_str()));
+    }
+    try {
+        sync_dir(dir_);
+    } catch (...) {
+        close(segment.fd);
+        throw;
+    }
+    return segment;
+}
+
+auto SegmentPool::release(std::span<const uint64_t> numbers) -> void {
+    if (numbers.empty()) {
+        return;
+    }
+    std::scoped_lock lock(mutex_);
+    for (uint64_t number : numbers) {
+        if (free_.size() < max_free_) {
+            auto free = dir_ / std::format("{}{}", number, WAL_FREE_EXTENSION);
+            std::filesystem::rename(path(number), free);
+            free_.push_back(std::move(free));
+        } else {
+            std::filesystem::remove(path(number));
+        }
+    }
+    // a segment that came back as live would be replayed over newer tables
+    sync_dir(dir_);
+}
+
+Writer::Writer(SegmentPool &segments, SyncMode sync_mode,
+               std::chrono::microseconds sync_interval, bool use_io_uring,
+               std::atomic<size_t> &operation_id)
+    : segments_(segments),
+      sync_mode_(sync_mode),
+      sync_interval_(sync_interval),
+      operation_id_(operation_id),
+      uring_(use_io_uring ? Uring::create() : nullptr),
+      last_sync_(std::chrono::steady_clock::now()) {
+    if (sync_mode_ == SyncMode::interval && sync_interval_.count() > 0) {
+        syncer_ = std::thread([this]() { run_syncer(); });
+    }
+}
+
+Writer::~Writer() {
+    if (syncer_.joinable()) {
+        {
+            std::scoped_lock lock(syncer_mutex_);
+            stopping_ = true;
+        }
+        syncer_cv_.notify_all();
+        syncer_.join();
+    }
+    if (segment_.fd < 0) {
+        return;
+    }
+    if (sync_mode_ != SyncMode::none) {
+        fdatasync(segment_.fd);
+    }
+    close(segment_.fd);
+}
+
+auto Writer::append(Op op, std::string_view key, std::string_view value)
+    -> void {
+    Request request{.op = op, .key = key, .value = value};
+    submit(request);
+}
+
+auto Writer::append_batch(std::span<const std::byte> batch, size_t count)
+    -> void {
+    Request request{
+        .op = Op::batch,
+        .count = count,
+        .value = {reinterpret_cast<const char *>(batch.data()), batch.size()},
+    };
+    submit(request);
+}
+
+auto Writer::submit(Request &request) -> void {
+    std::unique_lock lock(mutex_);
+    request.oid = operation_id_.fetch_add(request.count);
+    requests_.push_back(&request);
+    cv_.wait(lock,
+             [&]() { return request.done || requests_.front() == &request; });
+    if (request.done) {
+        if (request.error) {
+            std::rethrow_exception(request.error);
+        }
+        return;
+    }
+
+    // leads a group of every request queued so far, up to the size limit
+    group_.clear();
+    size_t group_size = 0;
+    size_t num_records = 0;
+    bool sync_only = false;
+    for (Request *queued : requests_) {
+        if (!group_.empty() && group_size >= WAL_MAX_GROUP_SIZE) {
+            break;
+        }
+        group_.push_back(queued);
+        group_size += queued->key.size() + queued->value.size();
+        num_records += queued->sync_only ? 0 : 1;
+        sync_only = sync_only || queued->sync_only;
+    }
+    lock.unlock();
+
+    auto now = std::chrono::steady_clock::now();
+    bool sync = sync_mode_ == SyncMode::sync ||
+                (sync_mode_ == SyncMode::interval &&
+                 (sync_only || now - last_sync_ >= sync_interval_));
+    std::exception_ptr error;
+    size_t write_offset = offset_;
+    try {
+        buffer_.clear();
+        for (const Request *queued : group_) {
+            if (queued->sync_only) {
+                continue;
+            }
+            record_.clear();
+            encode(record_, queued->op, queued->oid, queued->key,
+                   queued->value);
+            // a record that overflows the segment starts the next one,
+            // unless it is too big for any segment
+            if (segment_.fd >= 0 && offset_ > 0 &&
+                record_end(offset_, record_.size()) >
+                    segments_.segment_size()) {
+                write(buffer_, write_offset, false);
+                buffer_.clear();
+                close_segment();
+            }
+            if (segment_.fd < 0) {
+                segment_ = segments_.acquire();
+                offset_ = 0;
+            }
+            write_offset = offset_ - buffer_.size();
+            add_record(record_);
+        }
+        // a group of syncs alone has nothing to write, and nothing to sync
+        // unless an earlier group left the segment dirty
+        if (!buffer_.empty() || (sync && dirty_ && segment_.fd >= 0)) {
+            write(buffer_, write_offset, sync);
+            dirty_ = !sync;
+            if (sync) {
+                last_sync_ = std::chrono::steady_clock::now();
+            }
+        }
+    } catch (...) {
+        // the next group is written over whatever this one left
+        offset_ = write_offset;
+        error = std::current_exception();
+    }
+    if (num_records > 0) {
+        records_ += num_records;
+        ++groups_;
+        size_t max_group_size = max_group_size_;
+        while (max_group_size < num_records &&
+               !max_group_size_.compare_exchange_weak(max_group_size,
+                                                      num_records)) {
+        }
+    }
+
+    lock.lock();
+    for (size_t i = 0; i < group_.size(); ++i) {
+        Request *done = requests_.front();
+        requests_.pop_front();
+        done->error = error;
+        done->done = true;
+    }
+    cv_.notify_all();
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+auto Writer::roll() -> std::vector<uint64_t> {
+    std::unique_lock lock(mutex_);
+    // a background sync may be leading a group
+    cv_.wait(lock, [&]() { return requests_.empty(); });
+    if (segment_.fd >= 0 && offset_ > 0) {
+        close_segment();
+    }
+    return std::exchange(closed_, {});
+}
+
+auto Writer::stats() const -> Stats {
+    return {records_, groups_, max_group_size_, syncs_,
+            std::chrono::nanoseconds(sync_nanos_)};
+}
+
+auto Writer::add_record(std::span<const std::byte> record) -> void {
+    auto number = static_cast<uint32_t>(segment_.number);
+    bool first = true;
+    do {
+        size_t block_left = WAL_BLOCK_SIZE - offset_ % WAL_BLOCK_SIZE;
+        if (block_left < WAL_HEADER_SIZE) {
+            buffer_.insert(buffer_.end(), block_left, std::byte{0});
+            offset_ += block_left;
+            block_left = WAL_BLOCK_SIZE;
+        }
+        size_t size = std::min(record.size(), block_left - WAL_HEADER_SIZE);
+        bool last = size == record.size();
+        auto type = first && last ? FragmentType::full
+                    : first       ? FragmentType::first
+                    : last        ? FragmentType::last
+                                  : FragmentType::middle;
+        auto payload = record.first(size);
+        size_t start = buffer_.size();
+        coding::put_fixed<uint32_t>(buffer_, 0);
+        coding::put_fixed(buffer_, static_cast<uint16_t>(size));
+        buffer_.push_back(static_cast<std::byte>(type));
+        coding::put_fixed(buffer_, number);
+        buffer_.insert(buffer_.end(), payload.begin(), payload.end());
+        // the CRC covers the type, the segment number and the payload
+        constexpr size_t crc_offset = sizeof(uint32_t) + sizeof(uint16_t);
+        uint32_t crc = crc32c::mask(
+            crc32c::value(std::span(buffer_).subspan(start + crc_offset)));
+        std::memcpy(buffer_.data() + start, &crc, sizeof(crc));
+        offset_ += WAL_HEADER_SIZE + size;
+        record = record.subspan(size);
+        first = false;
+    } while (!record.empty());
+}
+
+auto Writer::write(std::span<const std::byte> data, size_t offset, bool sync)
+    -> void {
+    auto start = std::chrono::steady_clock::now();
+    bool synced = false;
+    if (uring_ != nullptr && !data.empty()) {
+        auto result = uring_->write(segment_.fd, data, offset, sync);
+        if (result.in_flight) {
+            // Neither the ring nor the buffer can be let go while the kernel
+            // may still read from it, so the buffer is set aside for as long
+            // as the writer lives and the group fails. The segment is left
+            // live rather than recycled, so a late write cannot land in a
+            // reused segment, and later groups go to a new one.
+            retired_buffers_.push_back(std::move(buffer_));
+            buffer_ = {};
+            int fd = std::exchange(segment_.fd, -1);
+            close(fd);
+            throw std::runtime_error(std::format(
+                "Failed to write {}", segments_.path(segment_.number).c_str()));
+        }
+        if (result.written < 0) {
+            // nothing is in flight, and pwrite either succeeds or reports the
+            // error itself
+            uring_.reset();
+        } else {
+            data = data.subspan(result.written);
+            offset += result.written;
+            // a short write cancels the sync, which is then run below, but a
+            // sync that failed is not retried, as it may have lost the data
+            if (sync && result.synced != -ECANCELED && result.synced != 0) {
+                throw std::runtime_error(
+                    std::format("Failed to sync {}",
+                                segments_.path(segment_.number).c_str()));
+            }
+            synced = sync && result.synced == 0;
+        }
+    }
+    while (!data.empty()) {
+        ssize_t written = pwrite(segment_.fd, data.data(), data.size(), offset);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::runtime_error(std::format(
+                "Failed to write {}", segments_.path(segment_.number).c_str()));
+        }
+        data = data.subspan(written);
+        offset += written;
+    }
+    if (!sync) {
+        return;
+    }
+    if (!synced && fdatasync(segment_.fd) != 0) {
+        throw std::runtime_error(std::format(
+            "Failed to sync {}", segments_.path(segment_.number).c_str()));
+    }
+    ++syncs_;
+    sync_nanos_ += (std::chrono::steady_clock::now() - start).count();
+}
+
+auto Writer::close_segment() -> void {
+    if (sync_mode_ != SyncMode::none) {
+        if (fdatasync(segment_.fd) != 0) {
+            throw std::runtime_error(std::format(
+                "Failed to sync {}", segments_.path(segment_.number).c_str()));
+        }
+        ++syncs_;
+    }
+    close(segment_.fd);
+    closed_.push_back(segment_.number);
+    segment_.fd = -1;
+    offset_ = 0;
+    dirty_ = false;
+}
+
+auto Writer::run_syncer() -> void {
+    std::unique_lock lock(syncer_mutex_);
+    while (!syncer_cv_.wait_for(lock, sync_interval_,
+                                [&]() { return stopping_; })) {
+        lock.unlock();
+        Request request{.op = Op::insert, .count = 0, .sync_only = true};
+        try {
+            submit(request);
+        } catch (...) {
+            // the writers whose records went unsynced have already returned,
+            // so the sync is tried again after the next interval
+        }
+        lock.lock();
+    }
+}
+
+}  // namespace wal
+}  // namespace mousedb
@@ -0,0 +1,269 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace mousedb {
+namespace wal {
+
+// In bytes, the most records a leader writes for its group, past the first.
+constexpr size_t WAL_MAX_GROUP_SIZE = 1 << 20;
+// In bytes, the size of the blocks that fragments never cross.
+constexpr size_t WAL_BLOCK_SIZE = 32 << 10;
+// In bytes, the masked CRC32C, payload size, type and segment number before
+// each fragment.
+constexpr size_t WAL_HEADER_SIZE =
+    sizeof(uint32_t) + sizeof(uint16_t) + 1 + sizeof(uint32_t);
+constexpr std::string_view WAL_EXTENSION = ".wal";
+// Marks a segment whose records are all in tables, kept to be reused.
+constexpr std::string_view WAL_FREE_EXTENSION = ".free";
+
+// How a fragment holds part of a record. Zero is left for the zero padding
+// at the end of a block or a file, which is never a valid fragment.
+enum class FragmentType : uint8_t { full = 1, first = 2, middle = 3, last = 4 };
+
+// A batch's key is empty and its value is an encoded write batch.
+enum class Op : size_t { insert = 0, erase = 1, batch = 2 };
+
+enum class SyncMode {
+    // Leaves written records to the OS, so they survive a process crash but
+    // not a machine crash.
+    none,
+    // Syncs every group before any of its writers return.
+    sync,
+    // Syncs a group if the last sync was at least the sync interval ago, and
+    // syncs what idle writers left every sync interval from a background
+    // thread, so at most that much is lost in a machine crash.
+    interval,
+};
+
+struct Stats {
+    uint64_t records = 0;
+    uint64_t groups = 0;
+    size_t max_group_size = 0;
+    uint64_t syncs = 0;
+    std::chrono::nanoseconds sync_time{0};
+};
+
+// Reads the records of a WAL segment through a read-only mapping. A segment
+// is a run of WAL_BLOCK_SIZE blocks of fragments, each being
+//    [masked CRC32C of the rest][payload size][type][segment number][payload]
+// where a record that does not fit in the rest of a block is split into a
+// first, any middle and a last fragment, and a block's last bytes are zero
+// if a header does not fit in them. A record is
+//    [op][oid][key size][key]([value size][value] unless op is erase)
+// where every number is a size_t, and a batch's oid is the first of the ones
+// its entries took. The first fragment that is cut short by a
+// crash, fails its CRC or is out of place ends the segment, so damage is
+// never replayed. So does the first one written for another segment number,
+// which is what a recycled segment holds past its new records. Records in
+// one fragment are read in place, and others are reassembled.
+// Example:
+//    Reader reader("data/7.wal", 7);
+//    while (reader.next()) {
+//        replay(reader.op, reader.key, reader.value);
+//    }
+class Reader {
+   public:
+    Reader(const std::filesystem::path &path, uint64_t number);
+    Reader(Reader &&other) noexcept;
+    Reader(const Reader &) = delete;
+    Reader &operator=(const Reader &) = delete;
+    Reader &operator=(Reader &&) = delete;
+    ~Reader();
+
+    auto path() const -> const std::filesystem::path &;
+    // Moves to the next record, or returns false if there is none.
+    auto next() -> bool;
+
+    // The current record, whose key and value stay valid until next.
+    Op op = Op::insert;
+    size_t oid = 0;
+    std::string_view key;
+    std::string_view value;
+
+   private:
+    std::filesystem::path path_;
+    uint32_t number_;
+    std::span<const std::byte> data_;
+    size_t offset_ = 0;
+    // Holds the current record if it was split into fragments.
+    std::vector<std::byte> scratch_;
+
+    // Reads the next fragment, or returns false at the end or at damage.
+    auto read_fragment(FragmentType &type, std::span<const std::byte> &payload)
+        -> bool;
+    // Points the current record into payload, unless it is malformed.
+    auto parse(std::span<const std::byte> payload) -> bool;
+};
+
+// A WAL segment open for writing.
+struct Segment {
+    uint64_t number = 0;
+    int fd = -1;
+};
+
+// Hands out the WAL segments in dir and takes them back once their records
+// are in tables. New segments are preallocated to segment_size, and up to
+// max_free released ones are kept as N.free files, which are renamed and
+// written over from their start when handed out again. Appends to a segment
+// so mostly neither allocate blocks nor grow its size, which leaves fdatasync
+// no metadata to write. Segments are numbered in the order they are handed
+// out, after every segment found in dir on construction.
+// Example:
+//    SegmentPool pool("data", 4 << 20, 4);
+//    auto segment = pool.acquire();  // data/N.wal
+//    ...
+//    close(segment.fd);
+//    pool.release({{segment.number}});  // data/N.free
+class SegmentPool {
+   public:
+    SegmentPool(const std::filesystem::path &dir, size_t segment_size,
+                size_t max_free);
+    SegmentPool(const SegmentPool &) = delete;
+    SegmentPool &operator=(const SegmentPool &) = delete;
+
+    // The numbers of the live segments found on construction, in order.
+    auto live() const -> const std::vector<uint64_t> &;
+    auto path(uint64_t number) const -> std::filesystem::path;
+    auto segment_size() const -> size_t;
+    auto free_count() -> size_t;
+
+    // Opens the next segment, reusing a free one if any. Throws if it cannot
+    // be created.
+    auto acquire() -> Segment;
+    // Recycles or removes closed segments.
+    auto release(std::span<const uint64_t> numbers) -> void;
+
+   private:
+    const std::filesystem::path dir_;
+    const size_t segment_size_;
+    const size_t max_free_;
+    std::vector<uint64_t> live_;
+
+    std::mutex mutex_;
+    uint64_t next_number_ = 0;
+    std::vector<std::filesystem::path> free_;
+};
+
+// An io_uring to write and sync segments through, defined in wal.cpp.
+class Uring;
+
+// Appends records to WAL segments with group commit. Concurrent writers queue
+// up, and the one at the front leads: it writes the records of every writer
+// queued behind it with one write, syncs them as the sync mode says, and
+// wakes them. Each record takes the next operation id as it is queued, so
+// the segments of a writer are in operation order. Writes go at explicit
+// offsets, and with use_io_uring, a write and the sync after it are submitted
+// together as linked io_uring operations. Where io_uring is unavailable or
+// fails, they fall back to pwrite and fdatasync.
+// Example:
+//    std::atomic<size_t> operation_id = 0;
+//    SegmentPool pool("data", 4 << 20, 4);
+//    Writer writer(pool, SyncMode::sync, {}, true, operation_id);
+//    writer.append(Op::insert, "key", "value");  // durable once it returns
+//    pool.release(writer.roll());  // once the records are in tables
+class Writer {
+   public:
+    Writer(SegmentPool &segments, SyncMode sync_mode,
+           std::chrono::microseconds sync_interval, bool use_io_uring,
+           std::atomic<size_t> &operation_id);
+    Writer(const Writer &) = delete;
+    Writer &operator=(const Writer &) = delete;
+    // Stops the background syncs and syncs what is left unless the sync mode
+    // is none. The segment being written is left live, to be replayed.
+    ~Writer();
+
+    // Returns once the record is written, and synced if its group was.
+    // Throws if its group could not be written.
+    auto append(Op op, std::string_view key, std::string_view value) -> void;
+    // Appends an encoded write batch of count entries as one record, which
+    // takes count operation ids at once.
+    auto append_batch(std::span<const std::byte> batch, size_t count)
+        -> void;
+    // Closes the segment being written, if it holds any records, so that
+    // later records go to a new one. Returns the segments closed since the
+    // last roll, which hold every record appended since then. Appends must
+    // not run at the same time.
+    auto roll() -> std::vector<uint64_t>;
+
+    auto stats() const -> Stats;
+
+   private:
+    struct Request {
+        Op op;
+        size_t count = 1;
+        size_t oid = 0;
+        std::string_view key = {};
+        std::string_view value = {};
+        // Holds no record, but makes its group sync what was written.
+        bool sync_only = false;
+        bool done = false;
+        std::exception_ptr error = nullptr;
+    };
+
+    SegmentPool &segments_;
+    const SyncMode sync_mode_;
+    const std::chrono::microseconds sync_interval_;
+    std::atomic<size_t> &operation_id_;
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    // Queued writers, where the front one leads the next group.
+    std::deque<Request *> requests_;
+    // Only used by the leader.
+    std::vector<Request *> group_;
+    std::vector<std::byte> buffer_;
+    std::vector<std::byte> record_;
+    // Buffers that a failed submission may have left the kernel reading,
+    // which are declared before the ring so that they outlive it.
+    std::vector<std::vector<std::byte>> retired_buffers_;
+    std::unique_ptr<Uring> uring_;
+    // The segment being written, if its fd is not -1, and in bytes, where its
+    // records end.
+    Segment segment_;
+    size_t offset_ = 0;
+    std::vector<uint64_t> closed_;
+    std::chrono::steady_clock::time_point last_sync_;
+    // Whether the segment holds records written since its last sync.
+    bool dirty_ = false;
+
+    std::atomic<uint64_t> records_ = 0;
+    std::atomic<uint64_t> groups_ = 0;
+    std::atomic<size_t> max_group_size_ = 0;
+    std::atomic<uint64_t> syncs_ = 0;
+    std::atomic<int64_t> sync_nanos_ = 0;
+
+    // With the interval sync mode and a nonzero interval, queues a sync every
+    // sync interval until stopping_ is set.
+    std::mutex syncer_mutex_;
+    std::condition_variable syncer_cv_;
+    bool stopping_ = false;
+    std::thread syncer_;
+
+    // Queues request and returns once its group is written.
+    auto submit(Request &request) -> void;
+    // Splits record into fragments at the end of the buffer.
+    auto add_record(std::span<const std::byte> record) -> void;
+    // Writes data at offset in the segment, and syncs it if sync is set.
+    auto write(std::span<const std::byte> data, size_t offset, bool sync)
+        -> void;
+    // Syncs the segment as the sync mode says and closes it.
+    auto close_segment() -> void;
+    auto run_syncer() -> void;
+};
+
+}  // namespace wal
+}  // namespace mousedb
@@ -0,0 +1,289 @@
+#include "wal.hpp"
+
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace mousedb::wal;
+
+namespace fs = std::filesystem;
+
+static auto make_dir(std::string_view name) -> fs::path {
+    auto dir = fs::temp_directory_path() / name;
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+    return dir;
+}
+
+// In bytes, the size of the fragment holding a record of a four byte key and
+// "value".
+constexpr size_t RECORD_SIZE =
+    WAL_HEADER_SIZE + 4 * sizeof(size_t) + 4 + std::string_view("value").size();
+
+// Writes records key0 to key{count - 1} into one segment and returns it.
+static auto write_records(SegmentPool &pool, size_t count) -> uint64_t {
+    std::atomic<size_t> operation_id = 0;
+    Writer writer(pool, SyncMode::none, {}, true, operation_id);
+    for (size_t i = 0; i < count; ++i) {
+        writer.append(Op::insert, std::format("key{}", i), "value");
+    }
+    return writer.roll().at(0);
+}
+
+TEST(wal_Writer, GroupsConcurrentAppends) {
+    constexpr size_t num_threads = 8;
+    constexpr size_t num_records = 200;
+    for (bool use_io_uring : {true, false}) {
+        auto dir = make_dir("mousedb_wal_group");
+        SegmentPool pool(dir, 4 << 20, 4);
+        std::atomic<size_t> operation_id = 100;
+        std::vector<uint64_t> segments;
+        {
+            Writer writer(pool, SyncMode::sync, {}, use_io_uring,
+                          operation_id);
+            std::vector<std::thread> threads;
+            for (size_t t = 0; t < num_threads; ++t) {
+                threads.emplace_back([&, t]() {
+                    for (size_t i = 0; i < num_records; ++i) {
+                        writer.append(Op::insert,
+                                      std::format("key{}-{}", t, i),
+                                      std::format("value{}", i));
+                    }
+                });
+            }
+            for (auto &thread : threads) {
+                thread.join();
+            }
+            writer.append(Op::erase, "gone", {});
+            auto stats = writer.stats();
+            EXPECT_EQ(stats.records, num_threads * num_records + 1);
+            EXPECT_LE(stats.groups, stats.records);
+            EXPECT_GE(stats.max_group_size, 1u);
+            EXPECT_EQ(stats.syncs, stats.groups);
+            segments = writer.roll();
+        }
+        ASSERT_EQ(segments.size(), 1u);
+
+        Reader reader(pool.path(segments[0]), segments[0]);
+        size_t count = 0;
+        size_t last_oid = 0;
+        while (reader.next()) {
+            if (count > 0) {
+                EXPECT_GT(reader.oid, last_oid);
+            }
+            last_oid = reader.oid;
+            ++count;
+        }
+        EXPECT_EQ(count, num_threads * num_records + 1);
+        EXPECT_EQ(reader.op, Op::erase);
+        EXPECT_EQ(reader.key, "gone");
+        EXPECT_EQ(operation_id, 100 + count);
+        fs::remove_all(dir);
+    }
+}
+
+TEST(wal_Writer, SyncsByInterval) {
+    auto dir = make_dir("mousedb_wal_interval");
+    SegmentPool pool(dir, 1 << 20, 0);
+    std::atomic<size_t> operation_id = 0;
+    {
+        Writer writer(pool, SyncMode::interval, std::chrono::hours(1), true,
+                      operation_id);
+        writer.append(Op::insert, "key", "value");
+        EXPECT_EQ(writer.stats().syncs, 0u);
+    }
+    {
+        Writer writer(pool, SyncMode::interval, {}, true, operation_id);
+        writer.append(Op::insert, "key", "value");
+        writer.append(Op::insert, "key", "value");
+        EXPECT_EQ(writer.stats().syncs, 2u);
+    }
+    {
+        Writer writer(pool, SyncMode::none, {}, true, operation_id);
+        writer.append(Op::insert, "key", "value");
+        EXPECT_EQ(writer.stats().syncs, 0u);
+        EXPECT_EQ(writer.stats().groups, 1u);
+    }
+    fs::remove_all(dir);
+}
+
+TEST(wal_Writer, SyncsIdleWriterByInterval) {
+    auto dir = make_dir("mousedb_wal_idle");
+    SegmentPool pool(dir, 1 << 20, 0);
+    std::atomic<size_t> operation_id = 0;
+    Writer writer(pool, SyncMode::interval, std::chrono::milliseconds(50),
+                  true, operation_id);
+    writer.append(Op::insert, "key", "value");
+    uint64_t syncs = writer.stats().syncs;
+    // no later group arrives, so only the background sync can run
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (writer.stats().syncs == syncs &&
+           std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    EXPECT_EQ(writer.stats().syncs, syncs + 1);
+    EXPECT_EQ(writer.stats().groups, 1u);
+    // a clean segment is not synced again
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    EXPECT_EQ(writer.stats().syncs, syncs + 1);
+    fs::remove_all(dir);
+}
+
+TEST(wal_Writer, RollsAndRecyclesSegments) {
+    auto dir = make_dir("mousedb_wal_segments");
+    constexpr size_t segment_size = 64 << 10;
+    SegmentPool pool(dir, segment_size, 1);
+    std::atomic<size_t> operation_id = 0;
+    Writer writer(pool, SyncMode::sync, {}, true, operation_id);
+    std::string value(1000, 'v');
+    for (size_t i = 0; i < 100; ++i) {
+        writer.append(Op::insert, std::format("key{}", i), value);
+    }
+    auto segments = writer.roll();
+    ASSERT_EQ(segments.size(), 2u);
+    EXPECT_TRUE(writer.roll().empty());
+    size_t count = 0;
+    for (uint64_t number : segments) {
+        // preallocated, so appends never grew the file
+        EXPECT_EQ(fs::file_size(pool.path(number)), segment_size);
+        Reader reader(pool.path(number), number);
+        while (reader.next()) {
+            EXPECT_EQ(reader.key, std::format("key{}", count));
+            EXPECT_EQ(reader.value, value);
+            ++count;
+        }
+    }
+    EXPECT_EQ(count, 100u);
+
+    pool.release(segments);
+    EXPECT_EQ(pool.free_count(), 1u);
+    EXPECT_FALSE(fs::exists(pool.path(segments[0])));
+    EXPECT_FALSE(fs::exists(pool.path(segments[1])));
+
+    // the recycled segment still holds old records past the new one
+    writer.append(Op::insert, "new", "value");
+    auto recycled = writer.roll();
+    ASSERT_EQ(recycled.size(), 1u);
+    EXPECT_GT(recycled[0], segments[1]);
+    EXPECT_EQ(pool.free_count(), 0u);
+    Reader reader(pool.path(recycled[0]), recycled[0]);
+    ASSERT_TRUE(reader.next());
+    EXPECT_EQ(reader.key, "new");
+    EXPECT_FALSE(reader.next());
+
+    SegmentPool reopened(dir, segment_size, 1);
+    EXPECT_EQ(reopened.live(), recycled);
+    auto segment = reopened.acquire();
+    EXPECT_EQ(segment.number, recycled[0] + 1);
+    close(segment.fd);
+    fs::remove_all(dir);
+}
+
+TEST(wal_Writer, AppendsBatchAsOneRecord) {
+    auto dir = make_dir("mousedb_wal_batch");
+    SegmentPool pool(dir, 1 << 20, 0);
+    std::atomic<size_t> operation_id = 0;
+    std::string batch = "encoded batch";
+    uint64_t number;
+    {
+        Writer writer(pool, SyncMode::none, {}, true, operation_id);
+        writer.append_batch(std::as_bytes(std::span(batch)), 5);
+        writer.append(Op::insert, "after", "value");
+        EXPECT_EQ(writer.stats().records, 2u);
+        number = writer.roll().at(0);
+    }
+    EXPECT_EQ(operation_id, 6u);
+
+    Reader reader(pool.path(number), number);
+    ASSERT_TRUE(reader.next());
+    EXPECT_EQ(reader.op, Op::batch);
+    EXPECT_EQ(reader.oid, 0u);
+    EXPECT_EQ(reader.value, batch);
+    ASSERT_TRUE(reader.next());
+    EXPECT_EQ(reader.oid, 5u);
+    EXPECT_EQ(reader.key, "after");
+    EXPECT_FALSE(reader.next());
+    fs::remove_all(dir);
+}
+
+TEST(wal_Reader, StopsAtTornRecord) {
+    auto dir = make_dir("mousedb_wal_torn");
+    SegmentPool pool(dir, 1 << 20, 0);
+    uint64_t number = write_records(pool, 3);
+    fs::resize_file(pool.path(number), 3 * RECORD_SIZE - 2);
+
+    Reader reader(pool.path(number), number);
+    ASSERT_TRUE(reader.next());
+    EXPECT_EQ(reader.key, "key0");
+    EXPECT_EQ(reader.value, "value");
+    ASSERT_TRUE(reader.next());
+    EXPECT_EQ(reader.key, "key1");
+    EXPECT_FALSE(reader.next());
+    fs::remove_all(dir);
+
+    auto empty = make_dir("mousedb_wal_empty");
+    std::ofstream(empty / "0.wal").close();
+    EXPECT_FALSE(Reader(empty / "0.wal", 0).next());
+    fs::remove_all(empty);
+}
+
+TEST(wal_Reader, ReassemblesRecordsAcrossBlocks) {
+    auto dir = make_dir("mousedb_wal_blocks");
+    SegmentPool pool(dir, 1 << 20, 0);
+    std::atomic<size_t> operation_id = 0;
+    std::string big(3 * WAL_BLOCK_SIZE + 100, 'x');
+    uint64_t number;
+    {
+        Writer writer(pool, SyncMode::none, {}, true, operation_id);
+        // varying sizes leave every amount of room at the ends of blocks
+        for (size_t i = 0; i < 2000; ++i) {
+            writer.append(Op::insert, std::format("key{}", i),
+                          std::string(i % 97, 'v'));
+        }
+        writer.append(Op::insert, "big", big);
+        writer.append(Op::erase, "after", {});
+        number = writer.roll().at(0);
+    }
+
+    Reader reader(pool.path(number), number);
+    for (size_t i = 0; i < 2000; ++i) {
+        ASSERT_TRUE(reader.next()) << i;
+        EXPECT_EQ(reader.key, std::format("key{}", i));
+        EXPECT_EQ(reader.value, std::string(i % 97, 'v'));
+    }
+    ASSERT_TRUE(reader.next());
+    EXPECT_EQ(reader.key, "big");
+    EXPECT_EQ(reader.value, big);
+    ASSERT_TRUE(reader.next());
+    EXPECT_EQ(reader.op, Op::erase);
+    EXPECT_EQ(reader.key, "after");
+    EXPECT_FALSE(reader.next());
+    fs::remove_all(dir);
+}
+
+TEST(wal_Reader, StopsAtCorruptRecord) {
+    auto dir = make_dir("mousedb_wal_corrupt");
+    SegmentPool pool(dir, 1 << 20, 0);
+    uint64_t number = write_records(pool, 3);
+    // flips a bit in the value of the second record
+    std::fstream file(pool.path(number),
+                      std::ios::in | std::ios::out | std::ios::binary);
+    file.seekg(2 * RECORD_SIZE - 1);
+    char byte = static_cast<char>(file.get());
+    file.seekp(2 * RECORD_SIZE - 1);
+    file.put(static_cast<char>(byte ^ 1));
+    file.close();
+
+    Reader reader(pool.path(number), number);
+    ASSERT_TRUE(reader.next());
+    EXPECT_EQ(reader.key, "key0");
+    EXPECT_FALSE(reader.next());
+    EXPECT_FALSE(reader.next());
+    fs::remove_all(dir);
+}
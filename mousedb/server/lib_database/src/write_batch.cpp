@@ -0,0 +1,80 @@
+#include "write_batch.hpp"
+
+#include <cstring>
+#include <format>
+#include <stdexcept>
+
+namespace mousedb {
+namespace write_batch {
+
+namespace {
+auto put_bytes(std::vector<std::byte> &buffer, std::string_view bytes)
+    -> void {
+    auto data = std::as_bytes(std::span(bytes));
+    buffer.insert(buffer.end(), data.begin(), data.end());
+}
+}  // namespace
+
+WriteBatch::WriteBatch() {
+    coding::put_fixed(rep_, size_t{0});
+}
+
+WriteBatch::WriteBatch(hlc::HLC ts) : WriteBatch() {
+    ts_ = ts;
+}
+
+auto WriteBatch::put(std::string_view key, std::string_view value) -> void {
+    if (!ts_.has_value()) {
+        throw std::runtime_error(
+            std::format("No HLC for {} in a batch without one", key));
+    }
+    put(key, value, *ts_);
+}
+
+auto WriteBatch::put(std::string_view key, std::string_view value,
+                     hlc::HLC ts) -> void {
+    // the value is laid out as the database stores it, behind its HLC
+    coding::put_fixed(rep_, key.size());
+    put_bytes(rep_, key);
+    coding::put_fixed(rep_, sizeof(ts.physical_us) + sizeof(ts.logical) +
+                                sizeof(ts.node_id) + value.size());
+    coding::put_fixed(rep_, ts.physical_us);
+    coding::put_fixed(rep_, ts.logical);
+    coding::put_fixed(rep_, ts.node_id);
+    put_bytes(rep_, value);
+    ++count_;
+    std::memcpy(rep_.data(), &count_, sizeof(count_));
+}
+
+auto WriteBatch::erase(std::string_view key) -> void {
+    put(key, {});
+}
+
+auto WriteBatch::erase(std::string_view key, hlc::HLC ts) -> void {
+    put(key, {}, ts);
+}
+
+auto WriteBatch::clear() -> void {
+    rep_.clear();
+    coding::put_fixed(rep_, size_t{0});
+    count_ = 0;
+}
+
+auto WriteBatch::count() const -> size_t {
+    return count_;
+}
+
+auto WriteBatch::empty() const -> bool {
+    return count_ == 0;
+}
+
+auto WriteBatch::data() const -> std::span<const std::byte> {
+    return rep_;
+}
+
+auto throw_malformed() -> void {
+    throw std::runtime_error("Malformed write batch");
+}
+
+}  // namespace write_batch
+}  // namespace mousedb
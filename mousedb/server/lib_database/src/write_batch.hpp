@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <vector>
+
+#include "coding.hpp"
+#include "hlce.hpp"
+
+namespace mousedb {
+namespace write_batch {
+
+// Puts and erases that a database logs as one WAL record, so that a crash
+// keeps all of them or none. They are atomic only for durability and
+// recovery: the entries go into the memtable one at a time, so concurrent
+// reads may see some of them before the rest. Each entry takes the HLC it is
+// given, or else the batch's. An erase is a put of an empty value,
+// which is kept as a tombstone. The entries are encoded as they are added,
+// as
+//    [count]([key size][key][value size][HLC][value])*
+// where every number is a size_t, so that the batch is logged as is.
+// Example:
+//    WriteBatch batch(HLC{now, 0, node_id});
+//    batch.put("a", "1");
+//    batch.erase("b");
+//    db.write(batch);
+class WriteBatch {
+   public:
+    WriteBatch();
+    explicit WriteBatch(hlc::HLC ts);
+
+    // Throws if the entry has no HLC and neither does the batch.
+    auto put(std::string_view key, std::string_view value) -> void;
+    auto put(std::string_view key, std::string_view value, hlc::HLC ts)
+        -> void;
+    auto erase(std::string_view key) -> void;
+    auto erase(std::string_view key, hlc::HLC ts) -> void;
+    auto clear() -> void;
+
+    auto count() const -> size_t;
+    auto empty() const -> bool;
+    auto data() const -> std::span<const std::byte>;
+
+    // Calls f(key, value) on each entry of an encoded batch in order, where
+    // value starts with its HLC. Returns the number of entries, and throws
+    // if data is not an encoded batch.
+    template <typename F>
+    static auto for_each(std::span<const std::byte> data, F &&f) -> size_t;
+
+   private:
+    std::optional<hlc::HLC> ts_;
+    std::vector<std::byte> rep_;
+    size_t count_ = 0;
+};
+
+// Throws that an encoded batch is malformed.
+[[noreturn]] auto throw_malformed() -> void;
+
+template <typename F>
+auto WriteBatch::for_each(std::span<const std::byte> data, F &&f) -> size_t {
+    size_t offset = 0;
+    auto read_bytes = [&]() {
+        if (data.size() - offset < sizeof(size_t)) {
+            throw_malformed();
+        }
+        auto size = coding::decode_fixed<size_t>(data.data() + offset);
+        offset += sizeof(size_t);
+        if (data.size() - offset < size) {
+            throw_malformed();
+        }
+        std::string_view bytes(
+            reinterpret_cast<const char *>(data.data() + offset), size);
+        offset += size;
+        return bytes;
+    };
+    if (data.size() < sizeof(size_t)) {
+        throw_malformed();
+    }
+    auto count = coding::decode_fixed<size_t>(data.data());
+    offset = sizeof(size_t);
+    for (size_t i = 0; i < count; ++i) {
+        auto key = read_bytes();
+        auto value = read_bytes();
+        f(key, value);
+    }
+    if (offset != data.size()) {
+        throw_malformed();
+    }
+    return count;
+}
+
+}  // namespace write_batch
+}  // namespace mousedb
@@ -0,0 +1,73 @@
+#include "write_batch.hpp"
+
+#include <gtest/gtest.h>
+
+#include <compare>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace mousedb::write_batch;
+using mousedb::hlc::HLC;
+
+static auto entries(const WriteBatch &batch)
+    -> std::vector<std::pair<std::string, std::string>> {
+    std::vector<std::pair<std::string, std::string>> entries;
+    size_t count = WriteBatch::for_each(
+        batch.data(), [&](std::string_view key, std::string_view value) {
+            entries.emplace_back(key, value);
+        });
+    EXPECT_EQ(count, batch.count());
+    return entries;
+}
+
+static auto clock_of(std::string_view value) -> HLC {
+    HLC ts;
+    std::memcpy(&ts.physical_us, value.data(), sizeof(ts.physical_us));
+    std::memcpy(&ts.logical, value.data() + sizeof(ts.physical_us),
+                sizeof(ts.logical));
+    std::memcpy(&ts.node_id,
+                value.data() + sizeof(ts.physical_us) + sizeof(ts.logical),
+                sizeof(ts.node_id));
+    return ts;
+}
+
+TEST(write_batch_WriteBatch, EncodesEntriesInOrder) {
+    constexpr size_t clock_size = 8 + 2 + 4;
+    WriteBatch batch(HLC{10, 1, 2});
+    batch.put("a", "1");
+    batch.erase("b");
+    batch.put("c", "3", HLC{20, 0, 7});
+    EXPECT_EQ(batch.count(), 3u);
+
+    auto decoded = entries(batch);
+    ASSERT_EQ(decoded.size(), 3u);
+    EXPECT_EQ(decoded[0].first, "a");
+    EXPECT_EQ(decoded[0].second.substr(clock_size), "1");
+    EXPECT_TRUE(std::is_eq(clock_of(decoded[0].second) <=> HLC{10, 1, 2}));
+    EXPECT_EQ(decoded[1].first, "b");
+    // an erase leaves only the HLC, as a tombstone
+    EXPECT_EQ(decoded[1].second.size(), clock_size);
+    EXPECT_EQ(decoded[2].first, "c");
+    EXPECT_EQ(decoded[2].second.substr(clock_size), "3");
+    EXPECT_TRUE(std::is_eq(clock_of(decoded[2].second) <=> HLC{20, 0, 7}));
+
+    batch.clear();
+    EXPECT_TRUE(batch.empty());
+    EXPECT_TRUE(entries(batch).empty());
+}
+
+TEST(write_batch_WriteBatch, RejectsMissingClockAndMalformedData) {
+    WriteBatch batch;
+    EXPECT_THROW(batch.put("a", "1"), std::runtime_error);
+    batch.put("a", "1", HLC{1, 0, 0});
+
+    auto data = batch.data();
+    auto noop = [](std::string_view, std::string_view) {};
+    EXPECT_THROW(WriteBatch::for_each(data.first(data.size() - 1), noop),
+                 std::runtime_error);
+    EXPECT_THROW(WriteBatch::for_each(data.first(4), noop),
+                 std::runtime_error);
+}